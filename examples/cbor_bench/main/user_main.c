@@ -0,0 +1,215 @@
+/*
+Copyright (c) 2020 Marko Juhanne
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file user_main.c
+@author Marko Juhanne
+@brief Compares the size and the cost of the json and CBOR encodings of the documents served to machine clients.
+
+The status document and a full list of access points are encoded from the same records BENCH_ITERATIONS times
+with json_writer_t and cbor_writer_t, exactly the way wifi_manager renders its snapshots.
+Results are printed as one line per document:
+  document json_bytes cbor_bytes json_cycles cbor_cycles (CPU cycles per response)
+No wifi is started: only the encoders are measured.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_idf_version.h"
+#include "esp_log.h"
+#include "esp_wifi_types.h"
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+#include "esp_cpu.h"
+#define bench_cycles()			esp_cpu_get_cycle_count()
+#else
+#include "soc/cpu.h"
+#define bench_cycles()			esp_cpu_get_ccount()
+#endif
+
+#include "wifi_manager.h"
+#include "json.h"
+#include "cbor.h"
+
+/* @brief tag used for ESP serial console messages */
+static const char TAG[] = "bench";
+
+#define BENCH_ITERATIONS		2000
+
+/* @brief what the status json shows once connected, with the reachability probe enabled */
+static const char status_ssid[32] = "Livebox-7C3A";
+static const char status_ip[] = "192.168.1.119";
+static const char status_netmask[] = "255.255.255.0";
+static const char status_gw[] = "192.168.1.1";
+
+static wifi_ap_record_t records[MAX_AP_NUM];
+
+
+static void bench_fill_records(){
+	static const char *ssids[] = { "Livebox-7C3A", "FreeWifi", "SFR_8D10", "Bbox-5E2F1A", "abcdefghijklmnopqrstuvwxyz012345" };
+	memset(records, 0x00, sizeof(records));
+	for(int i=0; i<MAX_AP_NUM; i++){
+		snprintf((char*)records[i].ssid, sizeof(records[i].ssid), "%s", ssids[i % 5]);
+		records[i].primary = 1 + i % 13;
+		records[i].rssi = -40 - 4 * i;
+		records[i].authmode = i % 5;
+	}
+}
+
+static size_t bench_status_json(void *out){
+	char *buf = out;
+	json_writer_t w;
+	json_writer_init(&w, buf, JSON_IP_INFO_SIZE);
+	json_writer_begin_object(&w);
+	json_writer_key(&w, "ssid");
+	json_writer_string_n(&w, status_ssid, sizeof(status_ssid));
+	json_writer_key(&w, "ip");
+	json_writer_string(&w, status_ip);
+	json_writer_key(&w, "netmask");
+	json_writer_string(&w, status_netmask);
+	json_writer_key(&w, "gw");
+	json_writer_string(&w, status_gw);
+	json_writer_key(&w, "urc");
+	json_writer_int(&w, UPDATE_CONNECTION_OK);
+	json_writer_key(&w, "reach");
+	json_writer_begin_object(&w);
+	json_writer_key(&w, "ok");
+	json_writer_int(&w, 1);
+	json_writer_key(&w, "dns");
+	json_writer_int(&w, 23);
+	json_writer_key(&w, "tcp");
+	json_writer_int(&w, 41);
+	json_writer_key(&w, "ttfb");
+	json_writer_int(&w, 87);
+	json_writer_end_object(&w);
+	json_writer_end_object(&w);
+	json_writer_raw(&w, "\n");
+	return json_writer_finish(&w) ? w.len : 0;
+}
+
+static size_t bench_status_cbor(void *out){
+	uint8_t *buf = out;
+	cbor_writer_t c;
+	cbor_writer_init(&c, buf, CBOR_IP_INFO_SIZE);
+	cbor_writer_map(&c, 6);
+	cbor_writer_text(&c, "ssid");
+	cbor_writer_text_n(&c, status_ssid, sizeof(status_ssid));
+	cbor_writer_text(&c, "ip");
+	cbor_writer_text(&c, status_ip);
+	cbor_writer_text(&c, "netmask");
+	cbor_writer_text(&c, status_netmask);
+	cbor_writer_text(&c, "gw");
+	cbor_writer_text(&c, status_gw);
+	cbor_writer_text(&c, "urc");
+	cbor_writer_int(&c, UPDATE_CONNECTION_OK);
+	cbor_writer_text(&c, "reach");
+	cbor_writer_map(&c, 4);
+	cbor_writer_text(&c, "ok");
+	cbor_writer_int(&c, 1);
+	cbor_writer_text(&c, "dns");
+	cbor_writer_int(&c, 23);
+	cbor_writer_text(&c, "tcp");
+	cbor_writer_int(&c, 41);
+	cbor_writer_text(&c, "ttfb");
+	cbor_writer_int(&c, 87);
+	return cbor_writer_finish(&c);
+}
+
+static size_t bench_ap_list_json(void *out){
+	char *buf = out;
+	json_writer_t w;
+	json_writer_init(&w, buf, JSON_ACCESS_POINTS_SIZE);
+	json_writer_begin_array(&w);
+	for(int i=0; i<MAX_AP_NUM; i++){
+		json_writer_begin_object(&w);
+		json_writer_key(&w, "ssid");
+		json_writer_string_n(&w, (const char*)records[i].ssid, sizeof(records[i].ssid));
+		json_writer_key(&w, "chan");
+		json_writer_int(&w, records[i].primary);
+		json_writer_key(&w, "rssi");
+		json_writer_int(&w, records[i].rssi);
+		json_writer_key(&w, "auth");
+		json_writer_int(&w, records[i].authmode);
+		json_writer_end_object(&w);
+	}
+	json_writer_end_array(&w);
+	json_writer_raw(&w, "\n");
+	return json_writer_finish(&w) ? w.len : 0;
+}
+
+static size_t bench_ap_list_cbor(void *out){
+	uint8_t *buf = out;
+	cbor_writer_t c;
+	cbor_writer_init(&c, buf, CBOR_ACCESS_POINTS_SIZE);
+	cbor_writer_array(&c, MAX_AP_NUM);
+	for(int i=0; i<MAX_AP_NUM; i++){
+		cbor_writer_map(&c, 4);
+		cbor_writer_text(&c, "ssid");
+		cbor_writer_text_n(&c, (const char*)records[i].ssid, sizeof(records[i].ssid));
+		cbor_writer_text(&c, "chan");
+		cbor_writer_int(&c, records[i].primary);
+		cbor_writer_text(&c, "rssi");
+		cbor_writer_int(&c, records[i].rssi);
+		cbor_writer_text(&c, "auth");
+		cbor_writer_int(&c, records[i].authmode);
+	}
+	return cbor_writer_finish(&c);
+}
+
+/**
+ * @brief encodes a document BENCH_ITERATIONS times.
+ * @return the average number of CPU cycles per encoding.
+ */
+static uint32_t bench_run(size_t (*encode)(void*), void *buf, size_t *len){
+	uint32_t start = bench_cycles();
+	for(int i=0; i<BENCH_ITERATIONS; i++){
+		*len = encode(buf);
+	}
+	return (bench_cycles() - start) / BENCH_ITERATIONS;
+}
+
+void app_main()
+{
+	static char json[JSON_ACCESS_POINTS_SIZE];
+	static uint8_t cbor[MAX_AP_NUM * CBOR_ONE_APP_SIZE + 2];
+	size_t json_len, cbor_len;
+	uint32_t json_cycles, cbor_cycles;
+
+	/* let the boot messages go out first */
+	vTaskDelay(pdMS_TO_TICKS(1000));
+	bench_fill_records();
+
+	printf("BENCH document     json_bytes cbor_bytes json_cycles cbor_cycles\n");
+
+	json_cycles = bench_run(bench_status_json, json, &json_len);
+	cbor_cycles = bench_run(bench_status_cbor, cbor, &cbor_len);
+	printf("BENCH status       %10d %10d %11d %11d\n", (int)json_len, (int)cbor_len, (int)json_cycles, (int)cbor_cycles);
+
+	json_cycles = bench_run(bench_ap_list_json, json, &json_len);
+	cbor_cycles = bench_run(bench_ap_list_cbor, cbor, &cbor_len);
+	printf("BENCH ap list (%2d) %10d %10d %11d %11d\n", MAX_AP_NUM, (int)json_len, (int)cbor_len, (int)json_cycles, (int)cbor_cycles);
+
+	if(json_len == 0 || cbor_len == 0){
+		ESP_LOGE(TAG, "a document did not fit in its buffer");
+	}
+}
@@ -41,23 +41,31 @@ SOFTWARE.
 static const char TAG[] = "main";
 
 
-static esp_err_t my_get_handler(httpd_req_t *req){
+/* @brief greeting of the /helloworld page, handed to its handler as user_ctx */
+static const char hello_world_page[] = "<html><body><h1>Hello World!</h1></body></html>";
 
-	/* our custom page sits at /helloworld in this example */
-	if(strcmp(req->uri, "/helloworld") == 0){
 
-		ESP_LOGI(TAG, "Serving page /helloworld");
+static esp_err_t hello_world_handler(httpd_req_t *req){
 
-		const char* response = "<html><body><h1>Hello World!</h1></body></html>";
+	const char* response = (const char*)req->user_ctx;
 
-		httpd_resp_set_status(req, "200 OK");
-		httpd_resp_set_type(req, "text/html");
-		httpd_resp_send(req, response, strlen(response));
-	}
-	else{
-		/* send a 404 otherwise */
-		httpd_resp_send_404(req);
-	}
+	ESP_LOGI(TAG, "Serving page %s", req->uri);
+
+	httpd_resp_set_status(req, "200 OK");
+	httpd_resp_set_type(req, "text/html");
+	httpd_resp_send(req, response, strlen(response));
+
+	return ESP_OK;
+}
+
+static esp_err_t api_handler(httpd_req_t *req){
+
+	/* every path under /api/ ends up here, whatever the method */
+	ESP_LOGI(TAG, "%d %s", (int)req->method, req->uri);
+
+	httpd_resp_set_status(req, "200 OK");
+	httpd_resp_set_type(req, "application/json");
+	httpd_resp_send(req, "{}", 2);
 
 	return ESP_OK;
 }
@@ -68,9 +76,11 @@ void app_main()
 	/* start the wifi manager */
 	wifi_manager_start();
 
-	/* set custom handler for the http server
+	/* register custom routes on the http server
 	 * Now navigate to /helloworld to see the custom page
 	 * */
-	http_app_set_handler_hook(HTTP_GET, &my_get_handler);
+	http_app_register_route(HTTP_GET, "/helloworld", HTTP_APP_MATCH_EXACT, &hello_world_handler, (void*)hello_world_page);
+	http_app_register_route(HTTP_GET, "/api/", HTTP_APP_MATCH_PREFIX, &api_handler, NULL);
+	http_app_register_route(HTTP_PUT, "/api/", HTTP_APP_MATCH_PREFIX, &api_handler, NULL);
 
 }
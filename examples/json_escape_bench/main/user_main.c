@@ -0,0 +1,167 @@
+/*
+Copyright (c) 2020 Marko Juhanne
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file user_main.c
+@author Marko Juhanne
+@brief Compares the throughput of the word-at-a-time json_print_string with the byte-at-a-time version it replaced.
+
+Each input is escaped BENCH_ITERATIONS times by both versions, which must produce the same output.
+Results are printed as one line per input:
+  input length legacy swar (throughput in kB/s of input consumed)
+No wifi is started: only the escaper is measured.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "json.h"
+
+/* @brief tag used for ESP serial console messages */
+static const char TAG[] = "bench";
+
+#define BENCH_ITERATIONS		20000
+
+typedef struct {
+	const char *name;
+	const char *input;
+} bench_input_t;
+
+/* @brief SSID-like strings first, then the pathological ones where every character has to be escaped */
+static const bench_input_t inputs[] = {
+	{ "short ssid",		"Livebox-7C3A" },
+	{ "32 char ssid",	"abcdefghijklmnopqrstuvwxyz012345" },
+	{ "utf-8 ssid",		"Caf\xc3\xa9 de la Gare \xe2\x98\x95 Wi-Fi" },
+	{ "one quote",		"Bob's \"guest\" network" },
+	{ "all quotes",		"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"" },
+	{ "all controls",	"\x01\x02\x03\x04\x05\x06\x07\x08\x0b\x0c\x0e\x0f\x10\x11\x12\x13\x14\x15\x16\x17\x18\x19\x1a\x1b\x1c\x1d\x1e\x1f\x01\x02\x03\x04" },
+};
+#define BENCH_INPUT_COUNT (sizeof(inputs) / sizeof(inputs[0]))
+
+
+/**
+ * @brief json_print_string as it was before the word-at-a-time rewrite: a sizing pass calling strchr on every
+ * character, then a copy pass printing \uXXXX escapes with sprintf.
+ */
+static bool legacy_print_string(const unsigned char *input, unsigned char *output_buffer)
+{
+	const unsigned char *input_pointer = NULL;
+	unsigned char *output = output_buffer;
+	unsigned char *output_pointer = NULL;
+	size_t output_length = 0;
+	size_t escape_characters = 0;
+
+	for (input_pointer = input; *input_pointer; input_pointer++)
+	{
+		if (strchr("\"\\\b\f\n\r\t", *input_pointer))
+		{
+			escape_characters++;
+		}
+		else if (*input_pointer < 32)
+		{
+			escape_characters += 5;
+		}
+	}
+	output_length = (size_t)(input_pointer - input) + escape_characters;
+
+	if (escape_characters == 0)
+	{
+		output[0] = '\"';
+		memcpy(output + 1, input, output_length);
+		output[output_length + 1] = '\"';
+		output[output_length + 2] = '\0';
+		return true;
+	}
+
+	output[0] = '\"';
+	output_pointer = output + 1;
+	for (input_pointer = input; *input_pointer != '\0'; (void)input_pointer++, output_pointer++)
+	{
+		if ((*input_pointer > 31) && (*input_pointer != '\"') && (*input_pointer != '\\'))
+		{
+			*output_pointer = *input_pointer;
+		}
+		else
+		{
+			*output_pointer++ = '\\';
+			switch (*input_pointer)
+			{
+			case '\\': *output_pointer = '\\'; break;
+			case '\"': *output_pointer = '\"'; break;
+			case '\b': *output_pointer = 'b'; break;
+			case '\f': *output_pointer = 'f'; break;
+			case '\n': *output_pointer = 'n'; break;
+			case '\r': *output_pointer = 'r'; break;
+			case '\t': *output_pointer = 't'; break;
+			default:
+				sprintf((char*)output_pointer, "u%04x", *input_pointer);
+				output_pointer += 4;
+				break;
+			}
+		}
+	}
+	output[output_length + 1] = '\"';
+	output[output_length + 2] = '\0';
+
+	return true;
+}
+
+typedef bool (*escaper_t)(const unsigned char *input, unsigned char *output_buffer);
+
+/**
+ * @brief runs an escaper BENCH_ITERATIONS times on an input.
+ * @return the throughput in kB/s of input consumed.
+ */
+static int bench_run(escaper_t escaper, const char *input, unsigned char *output){
+	size_t len = strlen(input);
+	int64_t start = esp_timer_get_time();
+	for(int i=0; i<BENCH_ITERATIONS; i++){
+		escaper((const unsigned char*)input, output);
+	}
+	int64_t elapsed = esp_timer_get_time() - start;
+	return elapsed > 0 ? (int)((int64_t)len * BENCH_ITERATIONS * 1000 / elapsed) : 0;
+}
+
+void app_main()
+{
+	/* 6 bytes per character at worst, plus the quotes and the terminator */
+	static unsigned char legacy_output[6 * 64 + 3];
+	static unsigned char swar_output[6 * 64 + 3];
+
+	/* let the boot messages go out first */
+	vTaskDelay(pdMS_TO_TICKS(1000));
+
+	printf("BENCH input          length  legacy    swar\n");
+	for(int i=0; i<BENCH_INPUT_COUNT; i++){
+		int legacy = bench_run(legacy_print_string, inputs[i].input, legacy_output);
+		int swar = bench_run(json_print_string, inputs[i].input, swar_output);
+
+		if(strcmp((const char*)legacy_output, (const char*)swar_output) != 0){
+			ESP_LOGE(TAG, "%s: outputs differ: %s vs %s", inputs[i].name, legacy_output, swar_output);
+		}
+
+		printf("BENCH %-15s %6d %7d %7d\n", inputs[i].name, (int)strlen(inputs[i].input), legacy, swar);
+	}
+}
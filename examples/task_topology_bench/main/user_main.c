@@ -0,0 +1,239 @@
+/*
+Copyright (c) 2020 Marko Juhanne
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file user_main.c
+@author Marko Juhanne
+@brief Measures how the placement of the wifi manager tasks affects a time critical loop running on the application core.
+
+A simulated control loop wakes up every BENCH_CONTROL_PERIOD_MS on core 1 and records how late it woke up.
+Each layout goes through four load phases: idle, wifi scans, portal requests and both at once.
+Once a layout is done the chip restarts with the next one; the layout index survives the restart in RTC memory.
+Results are printed as one line per layout and phase:
+  layout phase samples min avg max stddev misses (all in us, misses = wake ups later than one period)
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <esp_wifi.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "esp_http_client.h"
+
+#include "wifi_manager.h"
+
+/* @brief tag used for ESP serial console messages */
+static const char TAG[] = "bench";
+
+#define BENCH_PERIOD_US			(CONFIG_BENCH_CONTROL_PERIOD_MS * 1000)
+#define BENCH_LAYOUT_MAGIC		0x7A5C0DE5
+
+typedef struct {
+	const char *name;
+	int core; /* core given to every wifi manager task, -1 for no affinity */
+} bench_layout_t;
+
+/* @brief the layouts being compared. The control loop always runs on core 1 */
+static const bench_layout_t layouts[] = {
+	{ "no affinity",	-1 },
+	{ "protocol core",	0 },
+	{ "app core",		1 },
+};
+#define BENCH_LAYOUT_COUNT (sizeof(layouts) / sizeof(layouts[0]))
+
+typedef enum {
+	BENCH_PHASE_IDLE = 0,
+	BENCH_PHASE_SCAN = 1,
+	BENCH_PHASE_PORTAL = 2,
+	BENCH_PHASE_SCAN_AND_PORTAL = 3,
+	BENCH_PHASE_COUNT = 4
+} bench_phase_t;
+
+static const char *phase_names[BENCH_PHASE_COUNT] = { "idle", "scan", "portal", "scan+portal" };
+
+/* @brief layout under test. Survives esp_restart */
+static RTC_NOINIT_ATTR uint32_t layout_magic;
+static RTC_NOINIT_ATTR uint32_t layout_index;
+
+static volatile bench_phase_t current_phase = BENCH_PHASE_IDLE;
+
+/* @brief bumped every time a phase starts (and once after the last one). 0 while the portal settles */
+static volatile uint32_t phase_generation = 0;
+
+typedef struct {
+	uint32_t samples;
+	int64_t min;
+	int64_t max;
+	double sum;
+	double sum_sq;
+	uint32_t misses;
+} bench_stats_t;
+
+
+static void bench_stats_add(bench_stats_t *stats, int64_t latency){
+	if(stats->samples == 0 || latency < stats->min) stats->min = latency;
+	if(stats->samples == 0 || latency > stats->max) stats->max = latency;
+	stats->sum += latency;
+	stats->sum_sq += (double)latency * latency;
+	stats->samples++;
+	if(latency > BENCH_PERIOD_US) stats->misses++;
+}
+
+static void bench_stats_print(const bench_layout_t *layout, bench_phase_t phase, const bench_stats_t *stats){
+	if(stats->samples == 0){
+		printf("BENCH %-14s %-12s no samples\n", layout->name, phase_names[phase]);
+		return;
+	}
+	double avg = stats->sum / stats->samples;
+	double variance = stats->sum_sq / stats->samples - avg * avg;
+	printf("BENCH %-14s %-12s %7" PRIu32 " %6" PRId64 " %8.1f %6" PRId64 " %8.1f %5" PRIu32 "\n", layout->name, phase_names[phase], stats->samples,
+			stats->min, avg, stats->max, variance > 0 ? sqrt(variance) : 0.0, stats->misses);
+}
+
+
+/**
+ * @brief The simulated control loop. Wakes up every period and measures how late it is compared to its ideal schedule.
+ */
+static void control_task(void *pvParameters){
+
+	const bench_layout_t *layout = (const bench_layout_t*)pvParameters;
+	bench_stats_t stats;
+	bench_phase_t phase = current_phase;
+	uint32_t generation = phase_generation;
+	TickType_t last_wake = xTaskGetTickCount();
+	int64_t next = esp_timer_get_time() + BENCH_PERIOD_US;
+
+	memset(&stats, 0x00, sizeof(stats));
+
+	for(;;){
+		vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(CONFIG_BENCH_CONTROL_PERIOD_MS));
+		int64_t now = esp_timer_get_time();
+
+		if(phase_generation != generation){
+			if(generation > 0){
+				bench_stats_print(layout, phase, &stats);
+			}
+			memset(&stats, 0x00, sizeof(stats));
+			generation = phase_generation;
+			phase = current_phase;
+		}
+		else{
+			bench_stats_add(&stats, now > next ? now - next : 0);
+		}
+		next += BENCH_PERIOD_US;
+
+		/* resynchronize the ideal schedule after a big stall so that one miss doesn't count as many */
+		if(now - next > 10 * BENCH_PERIOD_US){
+			next = now + BENCH_PERIOD_US;
+		}
+	}
+}
+
+/**
+ * @brief Keeps the http server busy with the same requests the portal page makes, through the loopback interface.
+ */
+static void portal_load_task(void *pvParameters){
+
+	static const char *urls[] = { "http://127.0.0.1/status.json", "http://127.0.0.1/ap.json", "http://127.0.0.1/code.js" };
+	int i = 0;
+
+	for(;;){
+		if(current_phase == BENCH_PHASE_PORTAL || current_phase == BENCH_PHASE_SCAN_AND_PORTAL){
+			esp_http_client_config_t config = {
+				.url = urls[i++ % 3],
+				.timeout_ms = 1000,
+			};
+			esp_http_client_handle_t client = esp_http_client_init(&config);
+			esp_http_client_perform(client);
+			esp_http_client_cleanup(client);
+			vTaskDelay(pdMS_TO_TICKS(20));
+		}
+		else{
+			vTaskDelay(pdMS_TO_TICKS(100));
+		}
+	}
+}
+
+/**
+ * @brief Requests a scan every 300 ms during the scan phases.
+ */
+static void scan_load_task(void *pvParameters){
+	for(;;){
+		if(current_phase == BENCH_PHASE_SCAN || current_phase == BENCH_PHASE_SCAN_AND_PORTAL){
+			wifi_manager_scan_async();
+		}
+		vTaskDelay(pdMS_TO_TICKS(300));
+	}
+}
+
+
+void app_main()
+{
+	if(layout_magic != BENCH_LAYOUT_MAGIC || esp_reset_reason() != ESP_RST_SW || layout_index >= BENCH_LAYOUT_COUNT){
+		layout_magic = BENCH_LAYOUT_MAGIC;
+		layout_index = 0;
+		printf("BENCH layout         phase        samples    min      avg    max   stddev misses\n");
+	}
+	const bench_layout_t *layout = &layouts[layout_index];
+	ESP_LOGI(TAG, "layout %" PRIu32 "/%d: %s", layout_index + 1, (int)BENCH_LAYOUT_COUNT, layout->name);
+
+	/* apply the layout before anything is started */
+	for(int t=0; t<WM_TASK_COUNT; t++){
+		wifi_manager_task_config_t config = wifi_manager_get_task_config(t);
+		config.core_id = layout->core;
+		wifi_manager_set_task_config(t, &config);
+	}
+
+	/* start the wifi manager and bring the portal up whether or not a network was saved */
+	wifi_manager_start("esp-wifi-manager", true);
+	wifi_manager_set_auto_ap_shutdown(false);
+	wifi_manager_send_message(WM_ORDER_START_AP, NULL);
+
+	/* load generators run on the protocol core at low priority: only the work they cause inside the wifi manager is measured */
+	xTaskCreatePinnedToCore(&portal_load_task, "portal_load", 4096, NULL, 1, NULL, 0);
+	xTaskCreatePinnedToCore(&scan_load_task, "scan_load", 2048, NULL, 1, NULL, 0);
+	xTaskCreatePinnedToCore(&control_task, "control", 3072, (void*)layout, CONFIG_BENCH_CONTROL_PRIORITY, NULL, 1);
+
+	/* let the portal settle, then go through the phases */
+	vTaskDelay(pdMS_TO_TICKS(3000));
+	for(int p=0; p<BENCH_PHASE_COUNT; p++){
+		current_phase = p;
+		phase_generation++;
+		vTaskDelay(pdMS_TO_TICKS(CONFIG_BENCH_PHASE_DURATION_MS));
+	}
+
+	/* a new generation makes the control loop print the last phase */
+	current_phase = BENCH_PHASE_IDLE;
+	phase_generation++;
+	vTaskDelay(pdMS_TO_TICKS(100));
+
+	layout_index++;
+	if(layout_index < BENCH_LAYOUT_COUNT){
+		esp_restart();
+	}
+	ESP_LOGI(TAG, "all layouts measured");
+	layout_magic = 0;
+}
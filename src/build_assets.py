@@ -0,0 +1,197 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2020 Marko Juhanne
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+#
+# Minifies and gzips the web app at build time. For each asset, writes the
+# minified file (served to clients that don't accept gzip) and its .gz next to
+# it in the output directory, under the same names, so that the embedded symbols
+# are _binary_index_html_start and _binary_index_html_gz_start.
+#
+# The minifiers are deliberately conservative: they drop comments and
+# indentation but keep line breaks, so that they can't change what the
+# browser parses.
+#
+# index.html links the other assets with the hash of their content in the query
+# string (code.js?v=0123abcd). A new build gives new URLs, so that browsers can
+# cache them for good.
+#
+# A page holding the state marker (<!--#state-->) gets the state of the device
+# inlined there when it is served. Its gzip is built so that the server can
+# splice the state into it without compressing anything: the deflate stream
+# restarts on a byte boundary before and after the marker, and an extra field
+# of the gzip header (subfield "WM") gives where, along with the CRC of what
+# comes before the marker. See http_app_send_prerendered in http_app.c.
+#
+# usage: build_assets.py --out DIR [--rate KBIT] [--rtt MS] index.html code.js style.css
+
+import argparse
+import gzip
+import hashlib
+import os
+import re
+import struct
+import sys
+import zlib
+
+STATE_MARKER = b"<!--#state-->"
+
+
+def strip_js(text):
+    """Drops comments, indentation and blank lines. Strings and template literals are copied as is."""
+    out = []
+    i = 0
+    n = len(text)
+    while i < n:
+        c = text[i]
+        if c in "\"'`":
+            j = i + 1
+            while j < n and text[j] != c:
+                j += 2 if text[j] == "\\" else 1
+            out.append(text[i:j + 1])
+            i = j + 1
+        elif text.startswith("//", i):
+            while i < n and text[i] != "\n":
+                i += 1
+        elif text.startswith("/*", i):
+            end = text.find("*/", i + 2)
+            i = n if end < 0 else end + 2
+        else:
+            out.append(c)
+            i += 1
+    lines = (line.strip() for line in "".join(out).split("\n"))
+    return "\n".join(line for line in lines if line) + "\n"
+
+
+def strip_css(text):
+    text = re.sub(r"/\*.*?\*/", "", text, flags=re.S)
+    text = re.sub(r"\s+", " ", text)
+    text = re.sub(r"\s*([{};,>])\s*", r"\1", text)
+    text = re.sub(r":\s+", ":", text)
+    return text.replace(";}", "}").strip() + "\n"
+
+
+def strip_html(text):
+    # conditional comments and the state marker stay
+    text = re.sub(r"<!--(?![\[#]).*?-->", "", text, flags=re.S)
+    lines = (line.strip() for line in text.split("\n"))
+    return "\n".join(line for line in lines if line) + "\n"
+
+
+MINIFIERS = {".js": strip_js, ".css": strip_css, ".html": strip_html}
+
+
+def link_hashed(html, hashes):
+    """Appends ?v=<hash> to the src and href attributes naming one of the hashed assets."""
+    def replace(match):
+        name = match.group(2)
+        if name not in hashes:
+            return match.group(0)
+        return '%s="%s?v=%s"' % (match.group(1), name, hashes[name])
+    return re.sub(r'(src|href)="([^"?#]+)"', replace, html)
+
+
+def deflate(data, final):
+    """Raw deflate of data on its own. Unless final, it ends on a byte boundary with no final block, so that another stream can follow."""
+    c = zlib.compressobj(9, zlib.DEFLATED, -15)
+    return c.compress(data) + c.flush(zlib.Z_FINISH if final else zlib.Z_FULL_FLUSH)
+
+
+def gzip_spliceable(data):
+    """gzip of a page holding the state marker, deflated in three parts: before, the marker itself and after it.
+    The "WM" extra field holds the offsets in the file of the marker part and of the part after it, then the CRC of the part before."""
+    at = data.index(STATE_MARKER)
+    before, after = data[:at], data[at + len(STATE_MARKER):]
+    parts = [deflate(before, False), deflate(STATE_MARKER, False), deflate(after, True)]
+
+    extra_len = 4 + 12
+    header_len = 10 + 2 + extra_len
+    marker_offset = header_len + len(parts[0])
+    after_offset = marker_offset + len(parts[1])
+    # FEXTRA, no mtime, maximum compression, unknown OS
+    header = struct.pack("<BBBBIBBH", 0x1f, 0x8b, 8, 0x04, 0, 2, 255, extra_len)
+    header += b"WM" + struct.pack("<HIII", 12, marker_offset, after_offset, zlib.crc32(before))
+    trailer = struct.pack("<II", zlib.crc32(data), len(data) & 0xffffffff)
+
+    compressed = header + b"".join(parts) + trailer
+    assert gzip.decompress(compressed) == data
+    return compressed
+
+
+def transfer_ms(size, rate_kbit, rtt_ms):
+    """Time to fetch one asset on an idle link: one round trip for the request plus the bytes at the link rate."""
+    return rtt_ms + size * 8 / rate_kbit
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Minifies and gzips the wifi manager web app")
+    parser.add_argument("--out", required=True, help="output directory")
+    parser.add_argument("--rate", type=float, default=256, help="throttled link rate in kbit/s for the first paint estimate")
+    parser.add_argument("--rtt", type=float, default=100, help="round trip time in ms for the first paint estimate")
+    parser.add_argument("assets", nargs="+")
+    args = parser.parse_args()
+
+    os.makedirs(args.out, exist_ok=True)
+
+    raw_total = embedded_total = 0
+    raw_paint = gzip_paint = 0.0
+    hashes = {}
+
+    # pages last: they link the hashes of the others
+    for path in sorted(args.assets, key=lambda p: p.endswith(".html")):
+        name = os.path.basename(path)
+        with open(path, "r", encoding="utf-8") as f:
+            raw = f.read().encode("utf-8")
+
+        minify = MINIFIERS.get(os.path.splitext(name)[1], lambda t: t)
+        text = minify(raw.decode("utf-8"))
+        if name.endswith(".html"):
+            text = link_hashed(text, hashes)
+        minified = text.encode("utf-8")
+        hashes[name] = hashlib.sha256(minified).hexdigest()[:8]
+        # mtime=0 keeps the output, hence the firmware, reproducible
+        if STATE_MARKER in minified:
+            compressed = gzip_spliceable(minified)
+        else:
+            compressed = gzip.compress(minified, compresslevel=9, mtime=0)
+
+        for data, out_name in ((minified, name), (compressed, name + ".gz")):
+            with open(os.path.join(args.out, out_name), "wb") as f:
+                f.write(data)
+
+        raw_total += len(raw)
+        embedded_total += len(minified) + len(compressed)
+        raw_paint += transfer_ms(len(raw), args.rate, args.rtt)
+        gzip_paint += transfer_ms(len(compressed), args.rate, args.rtt)
+
+        print("wifi_manager assets: %-10s %6d bytes raw, %6d minified, %6d gzip (%d%%)"
+              % (name, len(raw), len(minified), len(compressed), 100 * len(compressed) // len(raw)))
+
+    # both encodings are embedded: the identity one is only smaller than the raw file, not gone
+    print("wifi_manager assets: flash %d bytes embedded for %d raw (%+d bytes)"
+          % (embedded_total, raw_total, embedded_total - raw_total))
+    print("wifi_manager assets: first paint at %g kbit/s, %g ms RTT: %d ms raw, %d ms gzip (estimated, assets fetched one after the other)"
+          % (args.rate, args.rtt, raw_paint, gzip_paint))
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
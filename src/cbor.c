@@ -0,0 +1,145 @@
+/*
+Copyright (c) 2020 Marko Juhanne
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file cbor.c
+@author Marko Juhanne
+@brief Minimal CBOR (RFC 8949) encoder for the status and scan documents served to machine clients.
+
+@see cbor.h
+*/
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cbor.h"
+
+
+/* @brief major types, already shifted into the 3 high bits of the initial byte */
+#define CBOR_MAJOR_UNSIGNED			0x00
+#define CBOR_MAJOR_NEGATIVE			0x20
+#define CBOR_MAJOR_TEXT				0x60
+#define CBOR_MAJOR_ARRAY			0x80
+#define CBOR_MAJOR_MAP				0xa0
+#define CBOR_FALSE					0xf4
+#define CBOR_TRUE					0xf5
+
+
+static void cbor_writer_put(cbor_writer_t *w, const void *data, size_t len){
+	if(len == 0){
+		return;
+	}
+	if(w->overflow || len > w->capacity - w->len){
+		w->overflow = true;
+		return;
+	}
+	memcpy(w->buf + w->len, data, len);
+	w->len += len;
+}
+
+/**
+ * @brief Writes the initial byte of an item and its argument in the shortest form: inside the initial byte up to 23, then on 1, 2 or 4 bytes.
+ */
+static void cbor_writer_head(cbor_writer_t *w, uint8_t major, uint32_t argument){
+	uint8_t head[5];
+	size_t len;
+
+	if(argument < 24){
+		head[0] = major | (uint8_t)argument;
+		len = 1;
+	}
+	else if(argument <= 0xff){
+		head[0] = major | 24;
+		head[1] = (uint8_t)argument;
+		len = 2;
+	}
+	else if(argument <= 0xffff){
+		head[0] = major | 25;
+		head[1] = (uint8_t)(argument >> 8);
+		head[2] = (uint8_t)argument;
+		len = 3;
+	}
+	else{
+		head[0] = major | 26;
+		head[1] = (uint8_t)(argument >> 24);
+		head[2] = (uint8_t)(argument >> 16);
+		head[3] = (uint8_t)(argument >> 8);
+		head[4] = (uint8_t)argument;
+		len = 5;
+	}
+
+	cbor_writer_put(w, head, len);
+}
+
+void cbor_writer_init(cbor_writer_t *w, uint8_t *buf, size_t capacity){
+	w->buf = buf;
+	w->capacity = capacity;
+	w->len = 0;
+	w->overflow = false;
+}
+
+void cbor_writer_reset(cbor_writer_t *w){
+	w->len = 0;
+}
+
+void cbor_writer_map(cbor_writer_t *w, size_t pairs){
+	cbor_writer_head(w, CBOR_MAJOR_MAP, (uint32_t)pairs);
+}
+
+void cbor_writer_array(cbor_writer_t *w, size_t items){
+	cbor_writer_head(w, CBOR_MAJOR_ARRAY, (uint32_t)items);
+}
+
+void cbor_writer_text_n(cbor_writer_t *w, const char *str, size_t max_len){
+	size_t len = 0;
+
+	/* no escaping in CBOR: the bytes are copied as they are, only their number is needed */
+	if(str){
+		const char *end = memchr(str, '\0', max_len);
+		len = end ? (size_t)(end - str) : max_len;
+	}
+	cbor_writer_head(w, CBOR_MAJOR_TEXT, (uint32_t)len);
+	cbor_writer_put(w, str, len);
+}
+
+void cbor_writer_text(cbor_writer_t *w, const char *str){
+	cbor_writer_text_n(w, str, str ? strlen(str) : 0);
+}
+
+void cbor_writer_int(cbor_writer_t *w, int32_t value){
+	/* negative integers are encoded as -1 - n */
+	if(value < 0){
+		cbor_writer_head(w, CBOR_MAJOR_NEGATIVE, (uint32_t)(-1 - value));
+	}
+	else{
+		cbor_writer_head(w, CBOR_MAJOR_UNSIGNED, (uint32_t)value);
+	}
+}
+
+void cbor_writer_bool(cbor_writer_t *w, bool value){
+	uint8_t simple = value ? CBOR_TRUE : CBOR_FALSE;
+	cbor_writer_put(w, &simple, 1);
+}
+
+size_t cbor_writer_finish(cbor_writer_t *w){
+	return w->overflow ? 0 : w->len;
+}
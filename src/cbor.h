@@ -0,0 +1,113 @@
+/*
+Copyright (c) 2020 Marko Juhanne
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file cbor.h
+@author Marko Juhanne
+@brief Minimal CBOR (RFC 8949) encoder for the status and scan documents served to machine clients.
+
+Only what these documents need is supported: definite length maps and arrays, text strings, integers and booleans.
+Maps and arrays are announced with their number of entries, which the documents always know up front,
+so that no end marker is needed. The data model is the same as the json documents: same keys, same values.
+*/
+
+#ifndef CBOR_H_INCLUDED
+#define CBOR_H_INCLUDED
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** @brief 1 if the documents served to the portal also get a CBOR encoding, see menuconfig */
+#ifdef CONFIG_WIFI_MANAGER_CBOR
+#define CBOR_ENABLED					1
+#else
+#define CBOR_ENABLED					0
+#endif
+
+/** @brief Size in bytes of the header of a text string of up to 255 bytes, such as an SSID */
+#define CBOR_TEXT_HEADER_SIZE			2
+
+/** @brief Largest encoding of an int32: the initial byte followed by 4 bytes */
+#define CBOR_INT_MAX_SIZE				5
+
+
+/**
+ * @brief Appends CBOR to a fixed size buffer in a single pass.
+ * Like json_writer_t every write is bounds checked and the writer stops at the first item that doesn't fit.
+ */
+typedef struct {
+	uint8_t *buf;
+	size_t capacity;
+	size_t len;			/* cursor: the next byte is written at buf[len] */
+	bool overflow;
+}cbor_writer_t;
+
+
+void cbor_writer_init(cbor_writer_t *w, uint8_t *buf, size_t capacity);
+
+/**
+ * @brief Empties the buffer, typically after it was sent as a chunk. Since maps and arrays announce their size
+ * the rest of the document can simply follow in the next chunk.
+ */
+void cbor_writer_reset(cbor_writer_t *w);
+
+/**
+ * @brief Starts a map of pairs key/value pairs. Keys and values are then written one after the other.
+ */
+void cbor_writer_map(cbor_writer_t *w, size_t pairs);
+
+/**
+ * @brief Starts an array of items values.
+ */
+void cbor_writer_array(cbor_writer_t *w, size_t items);
+
+/**
+ * @brief Writes a text string. NULL is written as an empty string.
+ */
+void cbor_writer_text(cbor_writer_t *w, const char *str);
+
+/**
+ * @brief Same as cbor_writer_text for a buffer that may not be null terminated, such as a 32 characters SSID.
+ */
+void cbor_writer_text_n(cbor_writer_t *w, const char *str, size_t max_len);
+
+void cbor_writer_int(cbor_writer_t *w, int32_t value);
+void cbor_writer_bool(cbor_writer_t *w, bool value);
+
+/**
+ * @brief Checks the result.
+ * @return the number of bytes written, or 0 if something didn't fit.
+ */
+size_t cbor_writer_finish(cbor_writer_t *w);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CBOR_H_INCLUDED */
@@ -21,43 +21,157 @@ function docReady(fn) {
 }
 
 var selectedSSID = "";
-var refreshAPInterval = null;
-var checkStatusInterval = null;
-var checkMqttStatusInterval = null;
-
-function stopCheckStatusInterval() {
-  if (checkStatusInterval != null) {
-    clearInterval(checkStatusInterval);
-    checkStatusInterval = null;
+
+// versions of the wifi status, the mqtt status and the access points shown by the page.
+// 0 is never a version: the next poll of /state.json gets all three.
+var known = { wifi: 0, mqtt: 0, ap: 0 };
+// the access points shown, that the patches of the list are applied to
+var apList = [];
+var pollTimer = null;
+var pollEpoch = 0;
+var pollPaused = true;
+var pollDelay = 0;
+var lastScan = 0;
+
+// changes are pushed on /events when the device can hold the stream open. The page polls otherwise.
+var events = null;
+var eventsRefused = false;
+
+// the poll slows down while nothing changes and stops while the page is hidden
+const POLL_MIN_DELAY = 950;
+const POLL_MAX_DELAY = 8000;
+const SCAN_INTERVAL = 3800;
+
+function schedulePoll(delay) {
+  if (pollTimer != null) {
+    clearTimeout(pollTimer);
+    pollTimer = null;
+  }
+  if (!pollPaused && !document.hidden) {
+    pollTimer = setTimeout(pollState, delay);
   }
 }
 
-function stopRefreshAPInterval() {
-  if (refreshAPInterval != null) {
-    clearInterval(refreshAPInterval);
-    refreshAPInterval = null;
-  }
+function resumePolling() {
+  //a poll still in flight is ignored when it completes
+  pollEpoch++;
+  pollDelay = POLL_MIN_DELAY;
+  schedulePoll(0);
+  openEvents();
+}
+
+function startPolling() {
+  pollPaused = false;
+  resumePolling();
 }
 
-function stopCheckMqttStatusInterval() {
-  if (checkMqttStatusInterval != null) {
-    clearInterval(checkMqttStatusInterval);
-    checkMqttStatusInterval = null;
+function stopPolling() {
+  pollPaused = true;
+  pollEpoch++;
+  schedulePoll(0);
+}
+
+document.addEventListener("visibilitychange", () => {
+  if (document.hidden) {
+    closeEvents();
+    schedulePoll(0);
+  } else {
+    eventsRefused = false;
+    if (!pollPaused) {
+      resumePolling();
+    }
   }
+});
+
+function openEvents() {
+  if (events != null || eventsRefused || document.hidden || !window.EventSource) {
+    return;
+  }
+  events = new EventSource(`events?wifi=${known.wifi}&mqtt=${known.mqtt}&ap=${known.ap}`);
+  events.addEventListener("wifi", (e) => onEvent(e, "wifi", applyStatus));
+  events.addEventListener("mqtt", (e) => onEvent(e, "mqtt", applyMqttStatus));
+  events.addEventListener("ap", (e) => onEvent(e, "ap", applyAPUpdate));
+  events.onerror = () => {
+    //all the streams are taken, the device doesn't have them or it went away: poll instead
+    console.info("Was not able to listen to /events");
+    closeEvents();
+    eventsRefused = true;
+    if (!pollPaused) {
+      resumePolling();
+    }
+  };
 }
 
-function startCheckStatusInterval() {
-  checkStatusInterval = setInterval(checkStatus, 950);
+function closeEvents() {
+  if (events != null) {
+    events.close();
+    events = null;
+  }
 }
 
-function startRefreshAPInterval() {
-  refreshAPInterval = setInterval(refreshAP, 3800);
+function onEvent(e, part, apply) {
+  //while paused, the poll that resumes catches up with what changed meanwhile
+  if (pollPaused) {
+    return;
+  }
+  //the id of an event is the version of its part
+  var version = Number(e.lastEventId);
+  if (apply(JSON.parse(e.data), version) !== false) {
+    known[part] = version;
+  }
 }
 
-function startCheckMqttStatusInterval() {
-  checkMqttStatusInterval = setInterval(checkMqttStatus, 950);
+// applies a /state.json: only the parts that changed since the versions passed have a body
+function applyState(data) {
+  var changed = false;
+  if (data.hasOwnProperty("status")) {
+    known.wifi = data["wifi"];
+    applyStatus(data["status"]);
+    changed = true;
+  }
+  if (data.hasOwnProperty("mqtt_status")) {
+    known.mqtt = data["mqtt"];
+    applyMqttStatus(data["mqtt_status"]);
+    changed = true;
+  }
+  if (data.hasOwnProperty("ap_list") || data.hasOwnProperty("ap_patch")) {
+    if (applyAPUpdate(data["ap_list"] || data["ap_patch"], data["ap"])) {
+      known.ap = data["ap"];
+    }
+    changed = true;
+  }
+  return changed;
 }
 
+async function pollState() {
+  var epoch = pollEpoch;
+  var changed = false;
+  var url = `state.json?wifi=${known.wifi}&mqtt=${known.mqtt}&ap=${known.ap}`;
+
+  pollTimer = null;
+  if (Date.now() - lastScan >= SCAN_INTERVAL) {
+    lastScan = Date.now();
+    url += "&scan=1";
+  }
+
+  try {
+    var response = await fetch(url);
+    var data = await response.json();
+    if (epoch != pollEpoch) {
+      return;
+    }
+    changed = applyState(data);
+  } catch (e) {
+    console.info("Was not able to fetch /state.json");
+    if (epoch != pollEpoch) {
+      return;
+    }
+  }
+
+  //with the events stream open, one poll was enough to catch up: the next ones only ask for a scan, whose result comes as an event
+  pollDelay = changed ? POLL_MIN_DELAY : Math.min(pollDelay * 2, POLL_MAX_DELAY);
+  schedulePoll(events == null ? pollDelay : SCAN_INTERVAL);
+}
 
 docReady(async function () {
 
@@ -196,7 +310,7 @@ docReady(async function () {
   );
 
   gel("yes-disconnect").addEventListener("click", async () => {
-    stopCheckStatusInterval();
+    stopPolling();
     selectedSSID = "";
 
     document.getElementById("diag-disconnect").style.display = "none";
@@ -210,7 +324,9 @@ docReady(async function () {
       body: { timestamp: Date.now() },
     });
 
-    startCheckStatusInterval();
+    //show the status that follows the disconnection even if it reads the same as the last one
+    known.wifi = 0;
+    startPolling();
 
     connect_details_div.style.display = "none";
     wifi_div.style.display = "block";
@@ -254,9 +370,8 @@ docReady(async function () {
       method: "POST",
       headers: {
         "Content-Type": "application/json",
-        "X-Custom-mqtt-uri": "DISCONNECT",
       },
-      body: { timestamp: Date.now() },
+      body: JSON.stringify({ mqtt_uri: "DISCONNECT" }),
     });
 
     gel("mqtt-details-wrap").style.display = "none";
@@ -275,21 +390,22 @@ docReady(async function () {
 
 
 
-  //first time the page loads: attempt get the connection status and start the wifi scan
-  await refreshAP();
-  startCheckStatusInterval();
-  startRefreshAPInterval();
-  startCheckMqttStatusInterval();
+  //the device served the page with its state: the first paint needs no request
+  try {
+    applyState(JSON.parse(gel("state").textContent));
+  } catch (e) {
+    console.info("The page came without the state of the device");
+  }
+
+  //first time the page loads: poll for what changed since and start the wifi scan
+  startPolling();
 });
 
 async function performConnect(conntype) {
-  //stop the status refresh. This prevents a race condition where a status
+  //stop the status and wifi list refresh. This prevents a race condition where a status
   //request would be refreshed with wrong ip info from a previous connection
   //and the request would automatically shows as succesful.
-  stopCheckStatusInterval();
-
-  //stop refreshing wifi list
-  stopRefreshAPInterval();
+  stopPolling();
 
   var pwd;
   if (conntype == "manual") {
@@ -300,10 +416,6 @@ async function performConnect(conntype) {
     pwd = gel("pwd").value;
   }
 
-  // bypass bug in ESP http parsing (header value cannot be empty)
-  if (pwd == "")
-    pwd = "__EMPTY__";
-
   //reset connection
   gel("loading").style.display = "block";
   gel("connect-success").style.display = "none";
@@ -315,25 +427,32 @@ async function performConnect(conntype) {
   connect_manual_div.style.display = "none";
   connect_wait_div.style.display = "block";
 
-  let response = await fetch("connect.json", {
+  //the device answers once the attempt succeeded or failed. 202 means it didn't within the wait: the status is polled instead
+  let response = await fetch("connect.json?wait=20", {
     method: "POST",
     headers: {
       "Content-Type": "application/json",
-      "X-Custom-ssid": selectedSSID,
-      "X-Custom-pwd": pwd,
     },
-    body: { timestamp: Date.now() },
+    body: JSON.stringify({ ssid: selectedSSID, pwd: pwd }),
   });
   if (!response.ok) {
       // this shouldn't happen. Exit connect wait screen
       console.info("PerformConnect failed!");
       connect_wait_div.style.display = "none";
       wifi_div.style.display = "block";
+  } else if (response.status == 200) {
+    try {
+      var result = await response.json();
+      console.info(`Connection attempt resolved: urc ${result["urc"]}, reason ${result["reason"]}`);
+      applyStatus(result["status"]);
+    } catch (e) {
+      //devices that can't hold the request answer right away with no body
+    }
   }
 
-  //now we can re-set the intervals regardless of result
-  startCheckStatusInterval();
-  startRefreshAPInterval();
+  //now we can poll again regardless of result, for a status that may read the same as the last one
+  known.wifi = 0;
+  startPolling();
 }
 
 
@@ -346,11 +465,6 @@ async function performMqttConnect() {
 
   if (mqtt_uri == "")
     return;
-  // bypass bug in ESP http parsing (header value cannot be empty)
-  if (mqtt_username == "")
-    mqtt_username = "__EMPTY__";
-  if (mqtt_pwd == "")
-    mqtt_pwd = "__EMPTY__";
 
   document.querySelector("#mqtt-connected-to div div span").textContent =
     mqtt_uri;
@@ -370,11 +484,12 @@ async function performMqttConnect() {
     method: "POST",
     headers: {
       "Content-Type": "application/json",
-      "X-Custom-mqtt-uri": mqtt_uri,
-      "X-Custom-mqtt-username": mqtt_username,
-      "X-Custom-mqtt-pwd": mqtt_pwd,
     },
-    body: { timestamp: Date.now() },
+    body: JSON.stringify({
+      mqtt_uri: mqtt_uri,
+      mqtt_username: mqtt_username,
+      mqtt_pwd: mqtt_pwd,
+    }),
   });
   if (!response.ok) {
       // this shouldn't happen. Exit connect wait screen
@@ -382,7 +497,8 @@ async function performMqttConnect() {
       gel("mqtt-connect").style.display = "block";
       gel("mqtt-connecting").style.display = "none";
   } else {
-    startCheckMqttStatusInterval();
+    //poll at full speed while connecting
+    startPolling();
   }
 }
 
@@ -399,21 +515,37 @@ function rssiToIcon(rssi) {
   }
 }
 
-async function refreshAP(url = "ap.json") {
-  try {
-    var res = await fetch(url);
-    var access_points = await res.json();
-    if (access_points.length > 0) {
-      //sort by signal strength
-      access_points.sort((a, b) => {
-        var x = a["rssi"];
-        var y = b["rssi"];
-        return x < y ? 1 : x > y ? -1 : 0;
-      });
-      refreshAPHTML(access_points);
-    }
-  } catch (e) {
-    console.info("Access points returned empty from /ap.json!");
+// the list of access points comes in full, or as what changed since the version the page has:
+// {"since":<version>,"add":[..],"chg":[..],"del":["ssid",..]}
+function applyAPUpdate(update, version) {
+  if (Array.isArray(update)) {
+    apList = update;
+  } else if (update["since"] === known.ap) {
+    //the same SSID can be listed once per security: both identify an access point
+    var key = (ap) => `${ap["auth"]}:${ap["ssid"]}`;
+    var replaced = update["chg"].concat(update["del"]).map(key);
+    apList = apList
+      .filter((ap) => !replaced.includes(key(ap)))
+      .concat(update["chg"], update["add"]);
+  } else {
+    //a patch against a list the page doesn't have: the next poll gets the full list
+    known.ap = 0;
+    schedulePoll(0);
+    return false;
+  }
+  applyAP(apList);
+  return true;
+}
+
+function applyAP(access_points) {
+  if (access_points.length > 0) {
+    //sort by signal strength
+    access_points.sort((a, b) => {
+      var x = a["rssi"];
+      var y = b["rssi"];
+      return x < y ? 1 : x > y ? -1 : 0;
+    });
+    refreshAPHTML(access_points);
   }
 }
 
@@ -429,199 +561,181 @@ function refreshAPHTML(data) {
   gel("wifi-list").innerHTML = h;
 }
 
-async function checkStatus(url = "status.json") {
-  try {
-    var response = await fetch(url);
-    var data = await response.json();
-    if (data && data.hasOwnProperty("ssid")) {
-      if (data["ssid"] === selectedSSID) {
-        // Attempting connection
-        switch (data["urc"]) {
-          case 0:
-            console.info("Got connection!");
-            document.querySelector(
-              "#connected-to div div div span"
-            ).textContent = data["ssid"];
-            document.querySelector("#connect-details h1").textContent =
-              data["ssid"];
-            gel("ip").textContent = data["ip"];
-            gel("netmask").textContent = data["netmask"];
-            gel("gw").textContent = data["gw"];
-            gel("wifi-status").style.display = "block";
-
-            //unlock the wait screen if needed
-            gel("ok-connect").disabled = false;
-
-            //update wait screen
-            gel("loading").style.display = "none";
-            gel("connect-success").style.display = "block";
-            gel("connect-fail").style.display = "none";
-            break;
-          case 1:
-            console.info("Connection attempt failed!");
-            document.querySelector(
-              "#connected-to div div div span"
-            ).textContent = data["ssid"];
-            document.querySelector("#connect-details h1").textContent =
-              data["ssid"];
-            gel("ip").textContent = "0.0.0.0";
-            gel("netmask").textContent = "0.0.0.0";
-            gel("gw").textContent = "0.0.0.0";
-
-            //don't show any connection
-            gel("wifi-status").display = "none";
-
-            //unlock the wait screen
-            gel("ok-connect").disabled = false;
-
-            //update wait screen
-            gel("loading").style.display = "none";
-            gel("connect-fail").style.display = "block";
-            gel("connect-success").style.display = "none";
-            break;
-          case 2: // user disconnnect
-          case 3: // lost connection
-            if (gel("wifi-status").style.display == "block") {
-              gel("wifi-status").style.display = "none";
-            }
-            if (gel("mqtt-status").style.display == "block") {
-              gel("mqtt-status").style.display = "none";
-            }
-            break;
-        }
-      } else if (data.hasOwnProperty("urc") && data["urc"] === 0) {
-        console.info("Connection established");
-        //ESP is already connected to a wifi server without having the user do anything
-        if (
-          gel("wifi-status").style.display == "" ||
-          gel("wifi-status").style.display == "none"
-        ) {
-          document.querySelector("#connected-to div div div span").textContent =
-            data["ssid"];
+function applyStatus(data) {
+  if (data && data.hasOwnProperty("ssid")) {
+    if (data["ssid"] === selectedSSID) {
+      // Attempting connection
+      switch (data["urc"]) {
+        case 0:
+          console.info("Got connection!");
+          document.querySelector(
+            "#connected-to div div div span"
+          ).textContent = data["ssid"];
           document.querySelector("#connect-details h1").textContent =
             data["ssid"];
           gel("ip").textContent = data["ip"];
           gel("netmask").textContent = data["netmask"];
           gel("gw").textContent = data["gw"];
           gel("wifi-status").style.display = "block";
-          gel("mqtt-status").style.display = "block";
-        }
-      } else if (data.hasOwnProperty("urc") && ((data["urc"] === 2) || (data["urc"] === 3))) {
-        console.log("Wifi in disconnected state");
-        if (gel("wifi-status").style.display == "block") {
-          gel("wifi-status").style.display = "none";
-        }
-        if (gel("mqtt-status").style.display == "block") {
-          gel("mqtt-status").style.display = "none";
-        }
+
+          //unlock the wait screen if needed
+          gel("ok-connect").disabled = false;
+
+          //update wait screen
+          gel("loading").style.display = "none";
+          gel("connect-success").style.display = "block";
+          gel("connect-fail").style.display = "none";
+          break;
+        case 1:
+          console.info("Connection attempt failed!");
+          document.querySelector(
+            "#connected-to div div div span"
+          ).textContent = data["ssid"];
+          document.querySelector("#connect-details h1").textContent =
+            data["ssid"];
+          gel("ip").textContent = "0.0.0.0";
+          gel("netmask").textContent = "0.0.0.0";
+          gel("gw").textContent = "0.0.0.0";
+
+          //don't show any connection
+          gel("wifi-status").display = "none";
+
+          //unlock the wait screen
+          gel("ok-connect").disabled = false;
+
+          //update wait screen
+          gel("loading").style.display = "none";
+          gel("connect-fail").style.display = "block";
+          gel("connect-success").style.display = "none";
+          break;
+        case 2: // user disconnnect
+        case 3: // lost connection
+          if (gel("wifi-status").style.display == "block") {
+            gel("wifi-status").style.display = "none";
+          }
+          if (gel("mqtt-status").style.display == "block") {
+            gel("mqtt-status").style.display = "none";
+          }
+          break;
+      }
+    } else if (data.hasOwnProperty("urc") && data["urc"] === 0) {
+      console.info("Connection established");
+      //ESP is already connected to a wifi server without having the user do anything
+      if (
+        gel("wifi-status").style.display == "" ||
+        gel("wifi-status").style.display == "none"
+      ) {
+        document.querySelector("#connected-to div div div span").textContent =
+          data["ssid"];
+        document.querySelector("#connect-details h1").textContent =
+          data["ssid"];
+        gel("ip").textContent = data["ip"];
+        gel("netmask").textContent = data["netmask"];
+        gel("gw").textContent = data["gw"];
+        gel("wifi-status").style.display = "block";
+        gel("mqtt-status").style.display = "block";
+      }
+    } else if (data.hasOwnProperty("urc") && ((data["urc"] === 2) || (data["urc"] === 3))) {
+      console.log("Wifi in disconnected state");
+      if (gel("wifi-status").style.display == "block") {
+        gel("wifi-status").style.display = "none";
+      }
+      if (gel("mqtt-status").style.display == "block") {
+        gel("mqtt-status").style.display = "none";
       }
     }
-  } catch (e) {
-    console.info("Was not able to fetch /status.json");
   }
 }
 
-async function checkMqttStatus(url = "mqtt_status.json") {
-  try {
-    var response = await fetch(url);
-    var data = await response.json();
-    if (data && data.hasOwnProperty("uri")) {
-      if (data["uri"] === "") {
-      } else {
-        // Attempting connection
-        switch (data["urc"]) {
-          case 0:
-            console.info("MQTT not yet configured");
-            document.querySelector(
-              "#mqtt-connected-status div"
-            ).textContent = " (Not configured)";
-            document.querySelector(
-              "#mqtt-details-wrap h2"
-            ).textContent = "Not configured";
-            document.querySelector(
-              "#mqtt-details-wrap h2"
-            ).textContent = "";
-            break;
-          case 1:
-            console.info("Connecting to MQTT server..");
-            break;
-          case 2:
-            console.info("Got MQTT connection!");
-            document.querySelector(
-              "#mqtt-connected-to div div span"
-            ).textContent = data["uri"];
-            document.querySelector(
-              "#mqtt-connected-status"
-            ).textContent = " (Connected)";
-            document.querySelector(
-              "#mqtt-details-wrap header h1"
-            ).textContent = data["uri"];            
-            document.querySelector(
-              "#mqtt-details-wrap h2"
-            ).textContent = "Connected";
-
-            //update wait screen
-            gel("mqtt-connect-wrap").style.display = "none";
-            gel("mqtt-details-wrap").style.display = "block";
-            //gel("mqtt-connect-fail").style.display = "none";
-            gel("mqtt-ok-details").disabled = false;
-            gel("mqtt-disconnect").disabled = false;
-            break;
-          case 3:
-            console.info("MQTT User disconnect");
-            document.querySelector(
-              "#mqtt-connected-to div div span"
-            ).textContent = data["uri"];
-            document.querySelector(
-              "#mqtt-connected-status"
-            ).textContent = " (Disconnected)";
-            document.querySelector(
-              "#mqtt-details-wrap h2"
-            ).textContent = "User disconnect";
-            gel("mqtt-connect-wrap").style.display = "block";
-            gel("mqtt-connect").style.display = "block";
-            gel("mqtt-connecting").style.display = "none";
-            gel("mqtt-connect-fail").style.display = "none";
-            gel("mqtt-details-wrap").style.display = "none";
-            //gel("mqtt-ok-details").disabled = false;
-            //gel("mqtt-disconnect").disabled = true;
-
-            stopCheckMqttStatusInterval();
-
-            break;
-          case 4: // attempt failed
-            console.info("MQTT Attempt failed");
-            document.querySelector(
-              "#mqtt-connect-fail h2"
-            ).textContent = data["error"];
-            // fall through
-          case 5: // conn lost
-            console.info("MQTT Disconnected");
-            document.querySelector(
-              "#mqtt-connected-to div div span"
-            ).textContent = data["uri"];
-            document.querySelector(
-              "#mqtt-connected-status"
-            ).textContent = " (Disconnected)";
-            document.querySelector(
-              "#mqtt-details-wrap h2"
-            ).textContent = "Disconnected";
-
-            //update wait screen
-            gel("mqtt-connecting").style.display = "none";
-            gel("mqtt-connect-fail").style.display = "block";
-            gel("mqtt-fail-ok").disabled = false;
-            //gel("mqtt-disconnect").disabled = true;
-            gel("mqtt-details-wrap").style.display = "none";
-
-            stopCheckMqttStatusInterval();
-
-            break;
-        }
+function applyMqttStatus(data) {
+  if (data && data.hasOwnProperty("uri")) {
+    if (data["uri"] === "") {
+    } else {
+      // Attempting connection
+      switch (data["urc"]) {
+        case 0:
+          console.info("MQTT not yet configured");
+          document.querySelector(
+            "#mqtt-connected-status div"
+          ).textContent = " (Not configured)";
+          document.querySelector(
+            "#mqtt-details-wrap h2"
+          ).textContent = "Not configured";
+          document.querySelector(
+            "#mqtt-details-wrap h2"
+          ).textContent = "";
+          break;
+        case 1:
+          console.info("Connecting to MQTT server..");
+          break;
+        case 2:
+          console.info("Got MQTT connection!");
+          document.querySelector(
+            "#mqtt-connected-to div div span"
+          ).textContent = data["uri"];
+          document.querySelector(
+            "#mqtt-connected-status"
+          ).textContent = " (Connected)";
+          document.querySelector(
+            "#mqtt-details-wrap header h1"
+          ).textContent = data["uri"];            
+          document.querySelector(
+            "#mqtt-details-wrap h2"
+          ).textContent = "Connected";
+
+          //update wait screen
+          gel("mqtt-connect-wrap").style.display = "none";
+          gel("mqtt-details-wrap").style.display = "block";
+          //gel("mqtt-connect-fail").style.display = "none";
+          gel("mqtt-ok-details").disabled = false;
+          gel("mqtt-disconnect").disabled = false;
+          break;
+        case 3:
+          console.info("MQTT User disconnect");
+          document.querySelector(
+            "#mqtt-connected-to div div span"
+          ).textContent = data["uri"];
+          document.querySelector(
+            "#mqtt-connected-status"
+          ).textContent = " (Disconnected)";
+          document.querySelector(
+            "#mqtt-details-wrap h2"
+          ).textContent = "User disconnect";
+          gel("mqtt-connect-wrap").style.display = "block";
+          gel("mqtt-connect").style.display = "block";
+          gel("mqtt-connecting").style.display = "none";
+          gel("mqtt-connect-fail").style.display = "none";
+          gel("mqtt-details-wrap").style.display = "none";
+          //gel("mqtt-ok-details").disabled = false;
+          //gel("mqtt-disconnect").disabled = true;
+          break;
+        case 4: // attempt failed
+          console.info("MQTT Attempt failed");
+          document.querySelector(
+            "#mqtt-connect-fail h2"
+          ).textContent = data["error"];
+          // fall through
+        case 5: // conn lost
+          console.info("MQTT Disconnected");
+          document.querySelector(
+            "#mqtt-connected-to div div span"
+          ).textContent = data["uri"];
+          document.querySelector(
+            "#mqtt-connected-status"
+          ).textContent = " (Disconnected)";
+          document.querySelector(
+            "#mqtt-details-wrap h2"
+          ).textContent = "Disconnected";
+
+          //update wait screen
+          gel("mqtt-connecting").style.display = "none";
+          gel("mqtt-connect-fail").style.display = "block";
+          gel("mqtt-fail-ok").disabled = false;
+          //gel("mqtt-disconnect").disabled = true;
+          gel("mqtt-details-wrap").style.display = "none";
+          break;
       }
     }
-  } catch (e) {
-    console.info("Was not able to fetch /mqtt_status.json");
   }
 }
 
@@ -1,2 +0,0 @@
-gzip index.html style.css --best --keep --force
-pause
\ No newline at end of file
@@ -37,6 +37,7 @@ Contains the freeRTOS task for the DNS server that processes the requests.
 #include <stdint.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/semphr.h>
 #include <freertos/event_groups.h>
 #include <esp_system.h>
 #include <esp_wifi.h>
@@ -52,29 +53,103 @@ Contains the freeRTOS task for the DNS server that processes the requests.
 #include <byteswap.h>
 
 #include "wifi_manager.h"
+#include "prov_arena.h"
 #include "dns_server.h"
 
 static const char TAG[] = "dns_server";
 static TaskHandle_t task_dns_server = NULL;
 int socket_fd;
 
+/* @brief set by dns_server_stop. The task checks it between queries */
+static volatile bool dns_server_stop_requested = false;
+/* @brief given by the task once it closed its socket, right before it suspends itself */
+static SemaphoreHandle_t dns_server_exited = NULL;
+
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+static StaticSemaphore_t dns_server_exited_buffer;
+static StaticTask_t task_dns_server_tcb;
+static StackType_t task_dns_server_stack[DNS_SERVER_STACK_SIZE / sizeof(StackType_t)];
+#elif defined(ESP32) && configSUPPORT_STATIC_ALLOCATION
+/* @brief when the provisioning arena exists the task stack is carved from it, the TCB always stays here */
+static StaticTask_t task_dns_server_tcb;
+static StackType_t *task_dns_server_stack = NULL;
+#endif
+
 void dns_server_start() {
-	if(task_dns_server == NULL){
-		xTaskCreate(&dns_server, "dns_server", 3072, NULL, WIFI_MANAGER_TASK_PRIORITY-1, &task_dns_server);
+	if(dns_server_exited == NULL){
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+		dns_server_exited = xSemaphoreCreateBinaryStatic(&dns_server_exited_buffer);
+#else
+		dns_server_exited = xSemaphoreCreateBinary();
+#endif
+	}
+	if(task_dns_server == NULL && dns_server_exited != NULL){
+		dns_server_stop_requested = false;
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+		task_dns_server = wifi_manager_create_task(WM_TASK_DNS_SERVER, &dns_server, "dns_server", NULL, task_dns_server_stack, &task_dns_server_tcb);
+#else
+#if defined(ESP32) && configSUPPORT_STATIC_ALLOCATION
+		if(prov_arena_is_active()){
+			task_dns_server_stack = (StackType_t*)prov_arena_alloc(wifi_manager_get_task_config(WM_TASK_DNS_SERVER).stack_size);
+			if(task_dns_server_stack){
+				task_dns_server = wifi_manager_create_task(WM_TASK_DNS_SERVER, &dns_server, "dns_server", NULL, task_dns_server_stack, &task_dns_server_tcb);
+				return;
+			}
+		}
+#endif
+		task_dns_server = wifi_manager_create_task(WM_TASK_DNS_SERVER, &dns_server, "dns_server", NULL, NULL, NULL);
+#endif
 	}
 }
 
 void dns_server_stop(){
 	if(task_dns_server){
+		/* the task is asked to exit and suspends itself once its socket is closed. It is only deleted then, so that
+		 * it can't be running on the other core while its TCB is reused or its stack released */
+		dns_server_stop_requested = true;
+		bool exited = xSemaphoreTake(dns_server_exited, pdMS_TO_TICKS(DNS_SERVER_STOP_TIMEOUT_MS)) == pdTRUE;
+		if(exited){
+#ifdef ESP32
+			/* the semaphore is given right before vTaskSuspend: wait for the task to actually be switched out */
+			while(eTaskGetState(task_dns_server) != eSuspended){
+				vTaskDelay(1);
+			}
+#endif
+		}
+		else{
+			ESP_LOGE(TAG, "DNS server did not exit within %d ms, deleting it", DNS_SERVER_STOP_TIMEOUT_MS);
+			close(socket_fd);
+		}
 		vTaskDelete(task_dns_server);
-		close(socket_fd);
 		task_dns_server = NULL;
+#if !defined(CONFIG_WIFI_MANAGER_STATIC_ALLOCATION) && defined(ESP32) && configSUPPORT_STATIC_ALLOCATION
+		if(task_dns_server_stack){
+			if(exited){
+				prov_arena_free(task_dns_server_stack);
+			}
+			else{
+				/* whatever the task was stuck in might still be using it: losing the block beats a use after free */
+				ESP_LOGE(TAG, "leaking the DNS server stack");
+			}
+			task_dns_server_stack = NULL;
+		}
+#endif
 	}
 
 }
 
 
 
+/**
+ * @brief tells dns_server_stop that the task is done with its socket and waits there to be deleted
+ */
+static void dns_server_exit(){
+	xSemaphoreGive(dns_server_exited);
+	for(;;){
+		vTaskSuspend(NULL);
+	}
+}
+
 void dns_server(void *pvParameters) {
 
 
@@ -92,9 +167,13 @@ void dns_server(void *pvParameters) {
     socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
     if (socket_fd < 0){
         ESP_LOGE(TAG, "Failed to create socket");
-        exit(0);
+        dns_server_exit();
     }
 
+    /* recvfrom returns every DNS_SERVER_POLL_MS so that a stop request is noticed */
+    struct timeval poll = { .tv_sec = 0, .tv_usec = DNS_SERVER_POLL_MS * 1000 };
+    setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &poll, sizeof(poll));
+
     /* Bind to port 53 (typical DNS Server port) */
 #ifdef ESP32
     esp_netif_ip_info_t ip;
@@ -111,7 +190,7 @@ void dns_server(void *pvParameters) {
     if (bind(socket_fd, (struct sockaddr *)&ra, sizeof(struct sockaddr_in)) == -1) {
         ESP_LOGE(TAG, "Failed to bind to 53/udp");
         close(socket_fd);
-        exit(1);
+        dns_server_exit();
     }
 
     struct sockaddr_in client;
@@ -129,7 +208,7 @@ void dns_server(void *pvParameters) {
     ESP_LOGD(TAG, "stack: %d", uxTaskGetStackHighWaterMark(NULL));
 
     /* Start loop to process DNS requests */
-    for(;;) {
+    while(!dns_server_stop_requested) {
 
     	memset(data, 0x00,  sizeof(data)); /* reset buffer */
         length = recvfrom(socket_fd, data, sizeof(data), 0, (struct sockaddr *)&client, &client_len); /* read udp request */
@@ -187,7 +266,7 @@ void dns_server(void *pvParameters) {
     }
     close(socket_fd);
 
-    vTaskDelete ( NULL );
+    dns_server_exit();
 }
 
 
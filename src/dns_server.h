@@ -45,6 +45,15 @@ extern "C" {
 /** Query + 2 byte ptr, 2 byte type, 2 byte class, 4 byte TTL, 2 byte len, 4 byte data */
 #define	DNS_ANSWER_MAX_SIZE (DNS_QUERY_MAX_SIZE+16)
 
+/** Stack size (in bytes) of the DNS server task. Comes from the provisioning arena when it exists. */
+#define DNS_SERVER_STACK_SIZE WIFI_MANAGER_DNS_TASK_STACK_SIZE
+
+/** Time (in ms) the DNS server waits for a query before checking whether it was asked to stop. */
+#define DNS_SERVER_POLL_MS 250
+
+/** Time (in ms) dns_server_stop waits for the task to exit before deleting it where it stands. */
+#define DNS_SERVER_STOP_TIMEOUT_MS (4 * DNS_SERVER_POLL_MS)
+
 
 /**
  * @brief RCODE values used in a DNS header message
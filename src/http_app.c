@@ -34,18 +34,24 @@ function to process requests, decode URLs, serve files, etc. etc.
 
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include <esp_wifi.h>
 #include <esp_event.h>
 #include <esp_log.h>
 #include <esp_system.h>
+#include <esp_timer.h>
+#include "esp_idf_version.h"
 #include "esp_netif.h"
 #include <esp_http_server.h>
 
 #include "wifi_manager.h"
 #include "http_app.h"
 #include "mqtt_manager.h"
+#include "mem_governor.h"
 
 
 /* @brief tag used for ESP serial console messages */
@@ -58,55 +64,2268 @@ static httpd_handle_t httpd_handle = NULL;
 esp_err_t (*custom_get_httpd_uri_handler)(httpd_req_t *r) = NULL;
 esp_err_t (*custom_post_httpd_uri_handler)(httpd_req_t *r) = NULL;
 
-/* strings holding the URLs of the wifi and mqtt manager */
-static char* http_root_url = NULL;
-static char* http_redirect_url = NULL;
-static char* http_js_url = NULL;
-static char* http_css_url = NULL;
-static char* http_connect_url = NULL;
-static char* http_ap_url = NULL;
-static char* http_status_url = NULL;
-static char* http_mqtt_status_url = NULL;
+/* true if the hooks above run on the async workers */
+static bool custom_get_hook_async = false;
+static bool custom_post_hook_async = false;
+
+/* requests can only be detached from the server task since esp-idf 5.1 */
+#if defined(ESP32) && ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0) && HTTP_APP_ASYNC_WORKERS > 0
+#define HTTP_APP_ASYNC_ENABLED			1
+#else
+#define HTTP_APP_ASYNC_ENABLED			0
+#endif
+
+/* so can the requests of the event streams */
+#if defined(ESP32) && ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0) && HTTP_APP_MAX_EVENT_STREAMS > 0
+#define HTTP_APP_EVENTS_ENABLED			1
+#else
+#define HTTP_APP_EVENTS_ENABLED			0
+#endif
+
+#if HTTP_APP_ASYNC_ENABLED
+/**
+ * @brief a detached request waiting for a worker
+ */
+typedef struct{
+	httpd_req_t *req;
+	esp_err_t (*handler)(httpd_req_t *r);
+	void *user_ctx;
+	int route;			/* index of the registered route for its counters, -1 for a hook */
+}http_app_async_job_t;
+
+static QueueHandle_t http_app_async_queue = NULL;
+static volatile uint8_t http_app_async_jobs = 0;		/* requests offloaded, from their queuing until a worker completes them */
+static volatile bool http_app_async_closing = false;
+static portMUX_TYPE http_app_async_mux = portMUX_INITIALIZER_UNLOCKED;
+/* @brief given by the last job to complete once closing is set */
+static SemaphoreHandle_t http_app_async_idle = NULL;
+
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+static StaticSemaphore_t http_app_async_idle_buffer;
+static StaticQueue_t http_app_async_queue_buffer;
+static uint8_t http_app_async_queue_storage[HTTP_APP_ASYNC_QUEUE_LENGTH * sizeof(http_app_async_job_t)];
+static StaticTask_t http_app_worker_buffers[HTTP_APP_ASYNC_WORKERS];
+static StackType_t http_app_worker_stacks[HTTP_APP_ASYNC_WORKERS][WIFI_MANAGER_HTTPD_WORKER_STACK_SIZE / sizeof(StackType_t)];
+#endif
+#endif
+
+#if HTTP_APP_EVENTS_ENABLED
+/**
+ * @brief An open /events stream. Its request is detached from the server task and only written by the events task.
+ */
+typedef struct{
+	httpd_req_t *req;								/* NULL if the slot is free */
+	uint8_t queue[HTTP_APP_EVENT_QUEUE_LENGTH];		/* pending http_app_event_t, oldest at head */
+	uint8_t head;
+	uint8_t count;
+	bool overflow;									/* events were dropped: every part is checked */
+	uint32_t versions[HTTP_APP_EVENT_COUNT];		/* versions the client has */
+}http_app_event_stream_t;
+
+static http_app_event_stream_t http_app_streams[HTTP_APP_MAX_EVENT_STREAMS];
+static volatile uint8_t http_app_stream_count = 0;
+static wifi_manager_ap_list_t http_app_events_ap_base;		/* as http_app_ap_base, for the events task */
+
+/**
+ * @brief A POST /connect.json?wait= held until its connection attempt resolves. Also detached and answered by the events task.
+ */
+typedef struct{
+	httpd_req_t *req;				/* NULL if the slot is free */
+	uint32_t attempt;				/* as returned by wifi_manager_connect_async */
+	TickType_t deadline;
+}http_app_connect_wait_t;
+
+static http_app_connect_wait_t http_app_connect_waits[HTTP_APP_MAX_CONNECT_WAITS];
+static volatile uint8_t http_app_wait_count = 0;
+static volatile bool http_app_events_closing = false;
+static TaskHandle_t http_app_events_task = NULL;
+static portMUX_TYPE http_app_streams_mux = portMUX_INITIALIZER_UNLOCKED;
+/* @brief given by the events task once closing has released every stream and connect wait */
+static SemaphoreHandle_t http_app_events_closed = NULL;
+
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+static StaticSemaphore_t http_app_events_closed_buffer;
+static StaticTask_t http_app_events_task_buffer;
+static StackType_t http_app_events_task_stack[WIFI_MANAGER_HTTPD_EVENTS_STACK_SIZE / sizeof(StackType_t)];
+#endif
+#endif
+
+/* names of the events, also the keys of the versions in the query strings of /events and /state.json */
+static const char * const http_app_event_names[HTTP_APP_EVENT_COUNT] = { "wifi", "mqtt", "ap" };
+
+/* the list of access points a client has, diffed against the published one to send only what changed. Only used by the server task */
+static wifi_manager_ap_list_t http_app_ap_base;
+
+/**
+ * @brief pages served by the wifi and mqtt managers
+ */
+typedef enum http_app_route_t{
+	HTTP_APP_ROUTE_NONE = -1,
+	HTTP_APP_ROUTE_ROOT = 0,
+	HTTP_APP_ROUTE_JS,
+	HTTP_APP_ROUTE_CSS,
+	HTTP_APP_ROUTE_CONNECT,
+	HTTP_APP_ROUTE_AP,
+	HTTP_APP_ROUTE_STATUS,
+	HTTP_APP_ROUTE_MQTT_STATUS,
+	HTTP_APP_ROUTE_STATE,
+	HTTP_APP_ROUTE_EVENTS,
+	HTTP_APP_ROUTE_CAPTIVE,
+	HTTP_APP_ROUTE_COUNT
+}http_app_route_t;
+
+typedef struct{
+	const char *url;
+	size_t len;
+}http_app_page_t;
+
+/* @brief URL of a page, put together at compile time */
+#define HTTP_APP_PAGE(page)			{ WEBAPP_LOCATION page, sizeof(WEBAPP_LOCATION page) - 1 }
+
+/* @brief URLs of the wifi and mqtt manager */
+static const http_app_page_t http_app_pages[HTTP_APP_ROUTE_COUNT] = {
+	[HTTP_APP_ROUTE_ROOT] = HTTP_APP_PAGE(""),
+	[HTTP_APP_ROUTE_JS] = HTTP_APP_PAGE("code.js"),
+	[HTTP_APP_ROUTE_CSS] = HTTP_APP_PAGE("style.css"),
+	[HTTP_APP_ROUTE_CONNECT] = HTTP_APP_PAGE("connect.json"),
+	[HTTP_APP_ROUTE_AP] = HTTP_APP_PAGE("ap.json"),
+	[HTTP_APP_ROUTE_STATUS] = HTTP_APP_PAGE("status.json"),
+	[HTTP_APP_ROUTE_MQTT_STATUS] = HTTP_APP_PAGE("mqtt_status.json"),
+	[HTTP_APP_ROUTE_STATE] = HTTP_APP_PAGE("state.json"),
+	[HTTP_APP_ROUTE_EVENTS] = HTTP_APP_PAGE("events"),
+	[HTTP_APP_ROUTE_CAPTIVE] = HTTP_APP_PAGE("captive.json")
+};
+
+/* @brief where the captive portal sends every request made to another host */
+static const char http_redirect_url[] = "http://" DEFAULT_AP_IP WEBAPP_LOCATION;
+
+/* @brief open addressing table from the hash of a URL to its page, -1 for an empty slot. Built once, on the first start */
+static int8_t http_app_route_slots[HTTP_APP_ROUTE_SLOTS];
+static uint32_t http_app_route_hashes[HTTP_APP_ROUTE_COUNT];
+static bool http_app_routes_built = false;
+
+/* @brief address of the access point in the byte order of ip4_addr_t, parsed once from DEFAULT_AP_IP */
+static uint32_t http_app_ap_ip = 0;
+
+/**
+ * @brief a route registered by the application
+ */
+typedef struct{
+	const char *path;
+	size_t len;
+	uint32_t hash;
+	esp_err_t (*handler)(httpd_req_t *r);		/* NULL for a free entry */
+	void *user_ctx;
+	httpd_method_t method;
+	http_app_match_t match;
+	bool async;
+	http_app_route_stats_t stats;
+}http_app_registered_route_t;
+
+/* @brief routes registered by the application */
+static http_app_registered_route_t http_app_registry[HTTP_APP_MAX_ROUTES];
+
+/* @brief open addressing table from the hash of a path to its route: 0 for an empty slot, -1 for a removed one, the index of the route + 1 otherwise */
+static int8_t http_app_registry_slots[HTTP_APP_REGISTRY_SLOTS];
+static uint8_t http_app_registry_count = 0;
+static uint8_t http_app_registry_prefixes = 0;
+
+/* the registry is changed by application tasks and read by the http server: it is only accessed in short critical sections */
+#ifdef ESP32
+static portMUX_TYPE http_app_registry_mux = portMUX_INITIALIZER_UNLOCKED;
+#define HTTP_APP_REGISTRY_ENTER()		portENTER_CRITICAL(&http_app_registry_mux)
+#define HTTP_APP_REGISTRY_EXIT()		portEXIT_CRITICAL(&http_app_registry_mux)
+#else
+#define HTTP_APP_REGISTRY_ENTER()		portENTER_CRITICAL()
+#define HTTP_APP_REGISTRY_EXIT()		portEXIT_CRITICAL()
+#endif
+
+/* @brief FNV-1a */
+#define HTTP_APP_HASH_OFFSET			2166136261u
+#define HTTP_APP_HASH_PRIME				16777619u
+
+/**
+ * @brief embedded binary data.
+ * @see file "component.mk"
+ * @see https://docs.espressif.com/projects/esp-idf/en/latest/api-guides/build-system.html#embedding-binary-data
+ */
+extern const uint8_t style_css_start[] asm("_binary_style_css_start");
+extern const uint8_t style_css_end[]   asm("_binary_style_css_end");
+extern const uint8_t code_js_start[] asm("_binary_code_js_start");
+extern const uint8_t code_js_end[] asm("_binary_code_js_end");
+extern const uint8_t index_html_start[] asm("_binary_index_html_start");
+extern const uint8_t index_html_end[] asm("_binary_index_html_end");
+#ifdef WIFI_MANAGER_GZIP_ASSETS
+/* gzipped at build time next to the minified files above */
+extern const uint8_t style_css_gz_start[] asm("_binary_style_css_gz_start");
+extern const uint8_t style_css_gz_end[]   asm("_binary_style_css_gz_end");
+extern const uint8_t code_js_gz_start[] asm("_binary_code_js_gz_start");
+extern const uint8_t code_js_gz_end[] asm("_binary_code_js_gz_end");
+extern const uint8_t index_html_gz_start[] asm("_binary_index_html_gz_start");
+extern const uint8_t index_html_gz_end[] asm("_binary_index_html_gz_end");
+#endif
+
+
+/* const httpd related values stored in ROM */
+const static char http_200_hdr[] = "200 OK";
+const static char http_202_hdr[] = "202 Accepted";
+const static char http_302_hdr[] = "302 Found";
+const static char http_400_hdr[] = "400 Bad Request";
+const static char http_304_hdr[] = "304 Not Modified";
+const static char http_404_hdr[] = "404 Not Found";
+const static char http_500_hdr[] = "500 Internal Server Error";
+const static char http_503_hdr[] = "503 Service Unavailable";
+const static char http_retry_after_hdr[] = "Retry-After";
+const static char http_location_hdr[] = "Location";
+const static char http_content_type_html[] = "text/html";
+const static char http_content_type_js[] = "text/javascript";
+const static char http_content_type_css[] = "text/css";
+const static char http_content_type_json[] = "application/json";
+const static char http_content_type_cbor[] = "application/cbor";
+const static char http_content_type_event_stream[] = "text/event-stream";
+const static char http_content_type_captive[] = "application/captive+json";
+const static char http_cache_control_hdr[] = "Cache-Control";
+const static char http_cache_control_no_cache[] = "no-store, no-cache, must-revalidate, max-age=0";
+const static char http_cache_control_cache[] = "public, max-age=31536000";
+const static char http_cache_control_revalidate[] = "no-cache";
+const static char http_cache_control_immutable[] = "public, max-age=31536000, immutable";
+const static char http_etag_hdr[] = "ETag";
+const static char http_if_none_match_hdr[] = "If-None-Match";
+const static char http_pragma_hdr[] = "Pragma";
+const static char http_pragma_no_cache[] = "no-cache";
+const static char http_accept_hdr[] = "Accept";
+const static char http_vary_hdr[] = "Vary";
+const static char http_host_hdr[] = "Host";
+const static char http_accept_encoding_hdr[] = "Accept-Encoding";
+const static char http_content_encoding_hdr[] = "Content-Encoding";
+const static char http_gzip[] = "gzip";
+const static char http_connection_hdr[] = "Connection";
+const static char http_connection_close[] = "close";
+
+typedef struct{
+	const char *field;
+	const char *value;
+}http_app_header_t;
+
+/**
+ * @brief everything but the body of a response. esp_http_server keeps pointers to these strings: nothing is copied.
+ */
+typedef struct{
+	const char *status;
+	const char *type;					/* NULL: set by the handler, or no body */
+	const http_app_header_t *headers;	/* terminated by a NULL field, NULL if none */
+}http_app_response_t;
+
+static const http_app_header_t http_no_cache_headers[] = {
+	{ http_cache_control_hdr, http_cache_control_no_cache },
+	{ http_pragma_hdr, http_pragma_no_cache },
+	{ NULL, NULL }
+};
+/* status documents are revalidated with their ETag on every request. They also depend on the Accept header when they can be sent as CBOR */
+static const http_app_header_t http_document_headers[] = {
+	{ http_cache_control_hdr, http_cache_control_revalidate },
+	{ CBOR_ENABLED ? http_vary_hdr : NULL, http_accept_hdr },
+	{ NULL, NULL }
+};
+/* assets are sent gzipped or not depending on Accept-Encoding */
+static const http_app_header_t http_asset_headers[] = {
+	{ http_cache_control_hdr, http_cache_control_revalidate },
+	{ http_vary_hdr, http_accept_encoding_hdr },
+	{ NULL, NULL }
+};
+/* index.html holds the state of the device: it is fetched again every time, gzipped or not depending on Accept-Encoding */
+static const http_app_header_t http_prerendered_headers[] = {
+	{ http_cache_control_hdr, http_cache_control_no_cache },
+	{ http_vary_hdr, http_accept_encoding_hdr },
+	{ NULL, NULL }
+};
+static const http_app_header_t http_cache_headers[] = {
+	{ http_cache_control_hdr, http_cache_control_cache },
+	{ http_vary_hdr, http_accept_encoding_hdr },
+	{ NULL, NULL }
+};
+/* index.html links the build's code.js and style.css by the hash of their content: they can be kept for good */
+static const http_app_header_t http_immutable_headers[] = {
+	{ http_cache_control_hdr, http_cache_control_immutable },
+	{ http_vary_hdr, http_accept_encoding_hdr },
+	{ NULL, NULL }
+};
+/* probes of the OSes are never cached, and their connection is closed: they come in bursts, each on a socket of its own */
+static const http_app_header_t http_probe_redirect_headers[] = {
+	{ http_location_hdr, http_redirect_url },
+	{ http_cache_control_hdr, http_cache_control_no_cache },
+	{ http_connection_hdr, http_connection_close },
+	{ NULL, NULL }
+};
+static const http_app_header_t http_probe_page_headers[] = {
+	{ http_cache_control_hdr, http_cache_control_no_cache },
+	{ http_connection_hdr, http_connection_close },
+	{ NULL, NULL }
+};
+static const http_app_header_t http_busy_headers[] = {
+	{ http_retry_after_hdr, "1" },
+	{ NULL, NULL }
+};
+static const http_app_header_t http_redirect_headers[] = {
+	{ http_location_hdr, http_redirect_url },
+	{ NULL, NULL }
+};
+
+static const http_app_response_t http_response_html = { http_200_hdr, http_content_type_html, http_asset_headers };
+static const http_app_response_t http_response_prerendered = { http_200_hdr, http_content_type_html, http_prerendered_headers };
+#ifdef WIFI_MANAGER_GZIP_ASSETS
+static const http_app_response_t http_response_js = { http_200_hdr, http_content_type_js, http_immutable_headers };
+static const http_app_response_t http_response_css = { http_200_hdr, http_content_type_css, http_immutable_headers };
+#else
+static const http_app_response_t http_response_js = { http_200_hdr, http_content_type_js, http_asset_headers };
+static const http_app_response_t http_response_css = { http_200_hdr, http_content_type_css, http_cache_headers };
+#endif
+static const http_app_response_t http_response_json = { http_200_hdr, http_content_type_json, http_no_cache_headers };
+static const http_app_response_t http_response_accepted = { http_202_hdr, http_content_type_json, http_no_cache_headers };
+static const http_app_response_t http_response_document = { http_200_hdr, NULL, http_document_headers };
+static const http_app_response_t http_response_event_stream = { http_200_hdr, http_content_type_event_stream, http_no_cache_headers };
+static const http_app_response_t http_response_captive = { http_200_hdr, http_content_type_captive, http_no_cache_headers };
+static const http_app_response_t http_response_redirect = { http_302_hdr, NULL, http_redirect_headers };
+static const http_app_response_t http_response_probe_redirect = { http_302_hdr, NULL, http_probe_redirect_headers };
+static const http_app_response_t http_response_probe_page = { http_200_hdr, http_content_type_html, http_probe_page_headers };
+static const http_app_response_t http_response_bad_request = { http_400_hdr, NULL, NULL };
+static const http_app_response_t http_response_not_found = { http_404_hdr, NULL, NULL };
+static const http_app_response_t http_response_server_error = { http_500_hdr, NULL, http_no_cache_headers };
+static const http_app_response_t http_response_busy = { http_503_hdr, NULL, http_busy_headers };
+
+
+/**
+ * @brief Sets the status and headers of a response in one call.
+ */
+static void http_app_set_response(httpd_req_t *req, const http_app_response_t *response){
+	httpd_resp_set_status(req, response->status);
+	if(response->type){
+		httpd_resp_set_type(req, response->type);
+	}
+	for(const http_app_header_t *header = response->headers; header && header->field; header++){
+		httpd_resp_set_hdr(req, header->field, header->value);
+	}
+}
+
+/**
+ * @brief FNV-1a hash of the len first characters of str
+ */
+static uint32_t http_app_hash(const char *str, size_t len){
+	uint32_t hash = HTTP_APP_HASH_OFFSET;
+	for(size_t i=0; i<len; i++){
+		hash ^= (uint8_t)str[i];
+		hash *= HTTP_APP_HASH_PRIME;
+	}
+	return hash;
+}
+
+/**
+ * @brief Parses a dotted quad, optionally followed by a port such as in a Host header.
+ * @param addr receives the address in the byte order of ip4_addr_t on the little endian ESP32 and ESP8266.
+ * @return false if str isn't an IPv4 address.
+ */
+static bool http_app_parse_ipv4(const char *str, uint32_t *addr){
+
+	uint32_t result = 0;
+
+	for(int i=0; i<4; i++){
+		uint32_t octet = 0;
+		int digits = 0;
+		while(*str >= '0' && *str <= '9' && digits < 3){
+			octet = octet * 10 + (uint32_t)(*str++ - '0');
+			digits++;
+		}
+		if(digits == 0 || octet > 255){
+			return false;
+		}
+		result |= octet << (8 * i);
+		if(i < 3 && *str++ != '.'){
+			return false;
+		}
+	}
+	if(*str != '\0' && *str != ':'){
+		return false;
+	}
+
+	*addr = result;
+	return true;
+}
+
+/**
+ * @brief Fills the route table and parses the address of the access point. Only the first call does something.
+ */
+static void http_app_build_routes(){
+
+	if(http_app_routes_built){
+		return;
+	}
+
+	memset(http_app_route_slots, -1, sizeof(http_app_route_slots));
+	for(int route=0; route<HTTP_APP_ROUTE_COUNT; route++){
+		uint32_t hash = http_app_hash(http_app_pages[route].url, http_app_pages[route].len);
+		uint32_t slot = hash & (HTTP_APP_ROUTE_SLOTS - 1);
+		while(http_app_route_slots[slot] >= 0){
+			slot = (slot + 1) & (HTTP_APP_ROUTE_SLOTS - 1);
+		}
+		http_app_route_slots[slot] = (int8_t)route;
+		http_app_route_hashes[route] = hash;
+	}
+
+	if(!http_app_parse_ipv4(DEFAULT_AP_IP, &http_app_ap_ip)){
+		ESP_LOGE(TAG, "DEFAULT_AP_IP %s is not an IPv4 address", DEFAULT_AP_IP);
+	}
+
+	http_app_routes_built = true;
+}
+
+/**
+ * @brief Finds the page a request is for. The query string is ignored.
+ */
+static http_app_route_t http_app_route_lookup(const char *uri){
+
+	size_t len = strcspn(uri, "?");
+	uint32_t hash = http_app_hash(uri, len);
+
+	for(uint32_t slot = hash & (HTTP_APP_ROUTE_SLOTS - 1); http_app_route_slots[slot] >= 0; slot = (slot + 1) & (HTTP_APP_ROUTE_SLOTS - 1)){
+		int route = http_app_route_slots[slot];
+		if(http_app_route_hashes[route] == hash && http_app_pages[route].len == len && memcmp(http_app_pages[route].url, uri, len) == 0){
+			return (http_app_route_t)route;
+		}
+	}
+
+	return HTTP_APP_ROUTE_NONE;
+}
+
+/**
+ * @brief true if the request was made to the device itself, by the IP of its access point or of its STA.
+ * Requests for any other host are captive portal checks or pages the user wanted from the internet.
+ * The Host header is read on the stack and compared as a number: no allocation and no lock.
+ * @param host receives the Host header, HTTP_APP_HOST_MAX bytes. Empty if it is missing or longer.
+ */
+static bool http_app_host_is_local(httpd_req_t *req, char *host){
+
+	uint32_t addr;
+
+	esp_err_t err = httpd_req_get_hdr_value_str(req, http_host_hdr, host, HTTP_APP_HOST_MAX);
+	if(err != ESP_OK){
+		host[0] = '\0';
+	}
+	if(err == ESP_ERR_NOT_FOUND){
+		/* an HTTP/1.0 client without Host can only be talking to us */
+		return true;
+	}
+	if(err != ESP_OK || !http_app_parse_ipv4(host, &addr)){
+		return false;
+	}
+
+	uint32_t sta_ip = wifi_manager_get_sta_ip();
+	return addr == http_app_ap_ip || (sta_ip != 0 && addr == sta_ip);
+}
+
+
+/**
+ * @brief A connectivity check of an OS: a path it requests on a host of the internet to find out whether it is behind a captive portal.
+ * Anything but the answer it expects makes it open its portal window, each one on its own terms.
+ */
+typedef struct{
+	const char *host;						/* NULL: the path is recognised on any host, eg. the many hosts of Android vendors */
+	const char *path;
+	size_t len;								/* of path */
+	const http_app_response_t *response;
+	const char *body;						/* NULL for none */
+}http_app_probe_t;
+
+#define HTTP_APP_PROBE(host, path, response, body)		{ host, path, sizeof(path) - 1, response, body }
+
+/* Apple's sheet shows the page its probe gets: one that isn't "Success" opens it at once, then forwards to the portal */
+static const char http_probe_page_body[] = "<html><head><meta http-equiv=\"refresh\" content=\"0;url=" "http://" DEFAULT_AP_IP WEBAPP_LOCATION "\"></head>"
+		"<body><a href=\"" "http://" DEFAULT_AP_IP WEBAPP_LOCATION "\">Wi-Fi setup</a></body></html>";
+
+/* @brief the probes answered without going through the routes of the web app. The others follow a 302 to the portal in their own window */
+static const http_app_probe_t http_app_probes[] = {
+	/* Android and ChromeOS expect 204: connectivitycheck.gstatic.com, clients3.google.com, www.google.com and the hosts of vendors */
+	HTTP_APP_PROBE(NULL, "/generate_204", &http_response_probe_redirect, NULL),
+	HTTP_APP_PROBE(NULL, "/gen_204", &http_response_probe_redirect, NULL),
+	/* Apple expects a page saying Success: captive.apple.com, www.apple.com */
+	HTTP_APP_PROBE(NULL, "/hotspot-detect.html", &http_response_probe_page, http_probe_page_body),
+	HTTP_APP_PROBE(NULL, "/library/test/success.html", &http_response_probe_page, http_probe_page_body),
+	/* Windows expects "Microsoft Connect Test" or "Microsoft NCSI", then opens /redirect in the browser */
+	HTTP_APP_PROBE(NULL, "/connecttest.txt", &http_response_probe_redirect, NULL),
+	HTTP_APP_PROBE(NULL, "/ncsi.txt", &http_response_probe_redirect, NULL),
+	HTTP_APP_PROBE("www.msftconnecttest.com", "/redirect", &http_response_probe_redirect, NULL),
+	/* Firefox */
+	HTTP_APP_PROBE("detectportal.firefox.com", "/success.txt", &http_response_probe_redirect, NULL),
+	HTTP_APP_PROBE("detectportal.firefox.com", "/canonical.html", &http_response_probe_redirect, NULL),
+	/* NetworkManager: fedoraproject.org and nmcheck.gnome.org, Ubuntu */
+	HTTP_APP_PROBE(NULL, "/check_network_status.txt", &http_response_probe_redirect, NULL),
+	HTTP_APP_PROBE("connectivity-check.ubuntu.com", "/", &http_response_probe_redirect, NULL),
+	/* Kindle */
+	HTTP_APP_PROBE(NULL, "/kindle-wifi/wifistub.html", &http_response_probe_redirect, NULL)
+};
+
+#define HTTP_APP_PROBE_COUNT			(sizeof(http_app_probes) / sizeof(http_app_probes[0]))
+
+/* @brief number of times each probe was answered. Only written by the server task */
+static uint32_t http_app_probe_hits[HTTP_APP_PROBE_COUNT];
+
+/**
+ * @brief true if the Host header names host. Host names are case insensitive, and the port and the trailing dot of a fully qualified name aren't part of it.
+ */
+static bool http_app_host_matches(const char *host, const char *header){
+
+	size_t len = strcspn(header, ":");
+	if(len > 0 && header[len - 1] == '.'){
+		len--;
+	}
+	return strlen(host) == len && strncasecmp(host, header, len) == 0;
+}
+
+/**
+ * @brief Answers a request for another host if it is a known probe, from its precomputed response, and closes the connection.
+ * @param host the Host header, empty if it is unknown: only the probes recognised on any host match.
+ * @return false if the request isn't a probe: nothing was sent.
+ */
+static bool http_app_answer_probe(httpd_req_t *req, const char *host){
+
+	size_t len = strcspn(req->uri, "?");
+
+	for(int i=0; i<HTTP_APP_PROBE_COUNT; i++){
+
+		const http_app_probe_t *probe = &http_app_probes[i];
+
+		if(probe->len == len && memcmp(probe->path, req->uri, len) == 0 && (probe->host == NULL || http_app_host_matches(probe->host, host))){
+
+			http_app_probe_hits[i]++;
+			http_app_set_response(req, probe->response);
+			httpd_resp_send(req, probe->body, probe->body ? strlen(probe->body) : 0);
+
+			/* the socket is freed once the response is sent rather than when the client or the LRU purge gets to it */
+			httpd_sess_trigger_close(req->handle, httpd_req_to_sockfd(req));
+			return true;
+		}
+	}
+
+	return false;
+}
+
+size_t http_app_get_probe_stats(http_app_probe_stats_t *stats, size_t max){
+
+	for(size_t i=0; i<HTTP_APP_PROBE_COUNT && i<max; i++){
+		stats[i].host = http_app_probes[i].host;
+		stats[i].path = http_app_probes[i].path;
+		stats[i].hits = http_app_probe_hits[i];
+	}
+	return HTTP_APP_PROBE_COUNT;
+}
+
+
+/**
+ * @brief Finds the slot of a registered route. Must be called in a critical section.
+ * @return the slot, or -1 if there is no such route.
+ */
+static int http_app_registry_find(uint32_t hash, const char *path, size_t len, httpd_method_t method, http_app_match_t match){
+
+	uint32_t slot = hash & (HTTP_APP_REGISTRY_SLOTS - 1);
+
+	for(int probe=0; probe<HTTP_APP_REGISTRY_SLOTS && http_app_registry_slots[slot] != 0; probe++){
+		if(http_app_registry_slots[slot] > 0){
+			const http_app_registered_route_t *route = &http_app_registry[http_app_registry_slots[slot] - 1];
+			if(route->hash == hash && route->len == len && route->method == method && route->match == match && memcmp(route->path, path, len) == 0){
+				return (int)slot;
+			}
+		}
+		slot = (slot + 1) & (HTTP_APP_REGISTRY_SLOTS - 1);
+	}
+
+	return -1;
+}
+
+/**
+ * @brief Looks a path up in a critical section and copies what it takes to run the route.
+ * @return the index of the route, or -1.
+ */
+static int http_app_registry_lookup(uint32_t hash, const char *path, size_t len, httpd_method_t method, http_app_match_t match, esp_err_t (**handler)(httpd_req_t *r), void **user_ctx, bool *async){
+
+	int index = -1;
+
+	HTTP_APP_REGISTRY_ENTER();
+	int slot = http_app_registry_find(hash, path, len, method, match);
+	if(slot >= 0){
+		index = http_app_registry_slots[slot] - 1;
+		*handler = http_app_registry[index].handler;
+		*user_ctx = http_app_registry[index].user_ctx;
+		*async = http_app_registry[index].async;
+	}
+	HTTP_APP_REGISTRY_EXIT();
+
+	return index;
+}
+
+/**
+ * @brief Adds a request to the counters of a registered route.
+ */
+static void http_app_count_route(int index, esp_err_t (*handler)(httpd_req_t *r), void *user_ctx, uint32_t elapsed){
+
+	/* the route may have been unregistered while its handler ran */
+	HTTP_APP_REGISTRY_ENTER();
+	http_app_registered_route_t *route = &http_app_registry[index];
+	if(route->handler == handler && route->user_ctx == user_ctx){
+		route->stats.hits++;
+		route->stats.total_us += elapsed;
+		if(elapsed > route->stats.max_us){
+			route->stats.max_us = elapsed;
+		}
+	}
+	HTTP_APP_REGISTRY_EXIT();
+}
+
+#if HTTP_APP_ASYNC_ENABLED
+/**
+ * @brief Counts a job out once its request is given back to the server, and wakes up http_app_stop when it was the last one.
+ */
+static void http_app_async_release(){
+
+	portENTER_CRITICAL(&http_app_async_mux);
+	http_app_async_jobs--;
+	bool idle = http_app_async_closing && http_app_async_jobs == 0;
+	portEXIT_CRITICAL(&http_app_async_mux);
+
+	if(idle){
+		xSemaphoreGive(http_app_async_idle);
+	}
+}
+
+/**
+ * @brief Runs detached requests until the end of times. Each worker handles one request at a time.
+ */
+static void http_app_async_worker(void *pvParameters){
+
+	http_app_async_job_t job;
+
+	for(;;){
+		if(xQueueReceive(http_app_async_queue, &job, portMAX_DELAY) == pdTRUE){
+
+			int64_t start = esp_timer_get_time();
+			(*job.handler)(job.req);
+			uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+
+			if(job.route >= 0){
+				http_app_count_route(job.route, job.handler, job.user_ctx, elapsed);
+			}
+
+			/* gives the socket back to the server */
+			httpd_req_async_handler_complete(job.req);
+			http_app_async_release();
+		}
+	}
+}
+
+/**
+ * @brief Creates the queue and the workers. They are kept for the lifetime of the application, like the route registry.
+ */
+static void http_app_async_start(){
+
+	http_app_async_closing = false;
+
+	if(http_app_async_queue != NULL){
+		return;
+	}
+
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+	http_app_async_idle = xSemaphoreCreateBinaryStatic(&http_app_async_idle_buffer);
+#else
+	http_app_async_idle = xSemaphoreCreateBinary();
+#endif
+	if(http_app_async_idle == NULL){
+		ESP_LOGE(TAG, "could not create the async queue");
+		return;
+	}
+
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+	http_app_async_queue = xQueueCreateStatic(HTTP_APP_ASYNC_QUEUE_LENGTH, sizeof(http_app_async_job_t), http_app_async_queue_storage, &http_app_async_queue_buffer);
+#else
+	http_app_async_queue = xQueueCreate(HTTP_APP_ASYNC_QUEUE_LENGTH, sizeof(http_app_async_job_t));
+#endif
+	if(http_app_async_queue == NULL){
+		ESP_LOGE(TAG, "could not create the async queue");
+		return;
+	}
+
+	for(int i=0; i<HTTP_APP_ASYNC_WORKERS; i++){
+		char name[] = "httpd_worker0";
+		name[sizeof(name) - 2] += i;
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+		TaskHandle_t task = wifi_manager_create_task(WM_TASK_HTTPD_WORKER, &http_app_async_worker, name, NULL, http_app_worker_stacks[i], &http_app_worker_buffers[i]);
+#else
+		TaskHandle_t task = wifi_manager_create_task(WM_TASK_HTTPD_WORKER, &http_app_async_worker, name, NULL, NULL, NULL);
+#endif
+		if(task == NULL){
+			ESP_LOGE(TAG, "could not create %s", name);
+		}
+	}
+}
+
+/**
+ * @brief Detaches a request from the server task and queues it for the workers.
+ * The queue is bounded: when it is full the request is answered with 503 right away rather than holding its socket.
+ */
+static esp_err_t http_app_offload(httpd_req_t *req, esp_err_t (*handler)(httpd_req_t *r), void *user_ctx, int route){
+
+	http_app_async_job_t job = { NULL, handler, user_ctx, route };
+
+	/* counted before it is queued, so that http_app_stop cannot miss it */
+	portENTER_CRITICAL(&http_app_async_mux);
+	bool closing = http_app_async_closing;
+	if(!closing){
+		http_app_async_jobs++;
+	}
+	portEXIT_CRITICAL(&http_app_async_mux);
+
+	if(closing){
+		http_app_set_response(req, &http_response_busy);
+		return httpd_resp_send(req, NULL, 0);
+	}
+
+	/* checked first: detaching a request copies it */
+	if(http_app_async_queue == NULL || uxQueueSpacesAvailable(http_app_async_queue) == 0 || httpd_req_async_handler_begin(req, &job.req) != ESP_OK){
+		http_app_async_release();
+		ESP_LOGW(TAG, "async queue full: %s refused", req->uri);
+		http_app_set_response(req, &http_response_busy);
+		return httpd_resp_send(req, NULL, 0);
+	}
+
+	job.req->user_ctx = user_ctx;
+	if(xQueueSend(http_app_async_queue, &job, 0) != pdTRUE){
+		httpd_req_async_handler_complete(job.req);
+		http_app_async_release();
+		http_app_set_response(req, &http_response_busy);
+		return httpd_resp_send(req, NULL, 0);
+	}
+
+	return ESP_OK;
+}
+
+/**
+ * @brief Refuses new async requests, answers the ones still queued with 503 and waits for the workers to complete the others:
+ * their requests would outlive the server. Gives up after HTTP_APP_ASYNC_STOP_TIMEOUT_MS.
+ * @return false if some are still running. New async requests are then accepted again since the server must be kept.
+ */
+static bool http_app_async_stop(){
+
+	if(http_app_async_queue == NULL){
+		return true;
+	}
+
+	/* a give left over from an earlier stop must not be taken for this one */
+	xSemaphoreTake(http_app_async_idle, 0);
+	portENTER_CRITICAL(&http_app_async_mux);
+	http_app_async_closing = true;
+	portEXIT_CRITICAL(&http_app_async_mux);
+
+	http_app_async_job_t job;
+	while(xQueueReceive(http_app_async_queue, &job, 0) == pdTRUE){
+		http_app_set_response(job.req, &http_response_busy);
+		httpd_resp_send(job.req, NULL, 0);
+		httpd_req_async_handler_complete(job.req);
+		http_app_async_release();
+	}
+
+	portENTER_CRITICAL(&http_app_async_mux);
+	bool running = http_app_async_jobs != 0;
+	portEXIT_CRITICAL(&http_app_async_mux);
+
+	if(running && xSemaphoreTake(http_app_async_idle, pdMS_TO_TICKS(HTTP_APP_ASYNC_STOP_TIMEOUT_MS)) != pdTRUE){
+		ESP_LOGE(TAG, "%d async requests still running", http_app_async_jobs);
+		http_app_async_closing = false;
+		return false;
+	}
+
+	return true;
+}
+#endif
+
+/**
+ * @brief Runs a registered route or a hook, on the server task or on the async workers.
+ * @param route index of the registered route for its counters, -1 for a hook.
+ */
+static esp_err_t http_app_run_handler(httpd_req_t *req, esp_err_t (*handler)(httpd_req_t *r), void *user_ctx, int route, bool async){
+
+#if HTTP_APP_ASYNC_ENABLED
+	if(async){
+		return http_app_offload(req, handler, user_ctx, route);
+	}
+#endif
+
+	req->user_ctx = user_ctx;
+	int64_t start = esp_timer_get_time();
+	esp_err_t ret = (*handler)(req);
+	uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+
+	if(route >= 0){
+		http_app_count_route(route, handler, user_ctx, elapsed);
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Runs the registered route a request matches, if any: its exact path first, then its longest prefix.
+ * The hash of the path is computed once. Each '/' along the way gives the hash of a prefix for free, so the cost doesn't depend on the number of routes.
+ * @return true if a route handled the request. Its result is then in ret.
+ */
+static bool http_app_dispatch_route(httpd_req_t *req, esp_err_t *ret){
+
+	if(http_app_registry_count == 0){
+		return false;
+	}
+
+	httpd_method_t method = (httpd_method_t)req->method;
+	size_t len = strcspn(req->uri, "?");
+	esp_err_t (*handler)(httpd_req_t *r) = NULL;
+	void *user_ctx = NULL;
+	bool async = false;
+	int index = -1;
+
+	uint32_t hash = HTTP_APP_HASH_OFFSET;
+	for(size_t i=0; i<len; i++){
+		hash ^= (uint8_t)req->uri[i];
+		hash *= HTTP_APP_HASH_PRIME;
+		if(req->uri[i] == '/' && http_app_registry_prefixes > 0){
+			/* longer prefixes come later and replace shorter ones */
+			int found = http_app_registry_lookup(hash, req->uri, i + 1, method, HTTP_APP_MATCH_PREFIX, &handler, &user_ctx, &async);
+			index = found >= 0 ? found : index;
+		}
+	}
+	int found = http_app_registry_lookup(hash, req->uri, len, method, HTTP_APP_MATCH_EXACT, &handler, &user_ctx, &async);
+	index = found >= 0 ? found : index;
+
+	if(index < 0){
+		return false;
+	}
+
+	*ret = http_app_run_handler(req, handler, user_ctx, index, async);
+
+	return true;
+}
+
+
+/**
+ * @brief an embedded file of the web app, in both encodings
+ */
+typedef struct{
+	const uint8_t *start;
+	const uint8_t *end;
+	const uint8_t *gz_start;		/* NULL when the build didn't compress the assets */
+	const uint8_t *gz_end;
+	const http_app_response_t *response;
+	char *etag;						/* hash of the content, filled in by http_app_build_routes */
+}http_app_asset_t;
+
+#ifdef WIFI_MANAGER_GZIP_ASSETS
+#define HTTP_APP_ASSET(name, response)		{ name##_start, name##_end, name##_gz_start, name##_gz_end, response, name##_etag }
+#else
+#define HTTP_APP_ASSET(name, response)		{ name##_start, name##_end, NULL, NULL, response, name##_etag }
+#endif
+
+static char index_html_etag[HTTP_APP_ETAG_SIZE];
+static char code_js_etag[HTTP_APP_ETAG_SIZE];
+static char style_css_etag[HTTP_APP_ETAG_SIZE];
+
+static const http_app_asset_t http_app_index_html = HTTP_APP_ASSET(index_html, &http_response_html);
+static const http_app_asset_t http_app_code_js = HTTP_APP_ASSET(code_js, &http_response_js);
+static const http_app_asset_t http_app_style_css = HTTP_APP_ASSET(style_css, &http_response_css);
+
+/* where index.html gets the state of the device, in both encodings. The marker isn't sent */
+#define HTTP_APP_STATE_MARKER				"<!--#state-->"
+#define HTTP_APP_STATE_MARKER_LEN			(sizeof(HTTP_APP_STATE_MARKER) - 1)
+
+/* a stored deflate block starts with its type on a byte boundary, its length and the complement of its length */
+#define HTTP_APP_STORED_BLOCK_HEADER		5
+
+/**
+ * @brief Where the state goes in index.html, found once by http_app_find_state_slot. build_assets.py gives the offsets in the gzip
+ * in the "WM" extra field of its header: the deflate stream restarts on a byte boundary at both.
+ */
+typedef struct{
+	uint32_t at;					/* offset of the marker in the page, 0 if it has none: the page is sent as is */
+	uint32_t gz_marker;				/* offset in the gzip of the deflated marker, 0 if the gzip can't take the state */
+	uint32_t gz_after;				/* offset in the gzip of the deflated rest of the page */
+	uint32_t gz_crc;				/* CRC-32 of the page up to the marker */
+}http_app_state_slot_t;
+
+static http_app_state_slot_t http_app_state_slot;
+
+/**
+ * @brief The state being written into index.html by http_app_send_prerendered. Only used by the server task.
+ */
+typedef struct{
+	httpd_req_t *req;				/* the request of the page, NULL when none: the json writers send their chunks through http_app_prerender_write */
+	bool gzip;
+	uint32_t crc;					/* CRC-32 and size of the page sent so far, for the gzip trailer */
+	uint32_t size;
+	uint16_t len;					/* bytes gathered in block, after room for the header of a stored block */
+	uint8_t block[HTTP_APP_STORED_BLOCK_HEADER + HTTP_APP_PRERENDER_BLOCK_SIZE];
+}http_app_prerender_t;
+
+static http_app_prerender_t http_app_prerender;
+
+/**
+ * @brief Computes the ETag of an asset from its content, once. Both encodings share it as a weak ETag since they have the same content.
+ */
+static void http_app_hash_asset(const http_app_asset_t *asset){
+	if(asset->etag[0] == '\0'){
+		uint32_t hash = http_app_hash((const char*)asset->start, asset->end - asset->start);
+		snprintf(asset->etag, HTTP_APP_ETAG_SIZE, "W/\"%08x\"", (unsigned int)hash);
+	}
+}
+
+/**
+ * @brief Reads a little endian number of 16 or 32 bits, as gzip stores them.
+ */
+static uint32_t http_app_read_le(const uint8_t *p, int bytes){
+	uint32_t value = 0;
+	for(int i=bytes-1; i>=0; i--){
+		value = (value << 8) | p[i];
+	}
+	return value;
+}
+
+/**
+ * @brief Finds the state marker in index.html and, if the gzip was built to take the state, where it goes in the gzip. Once.
+ */
+static void http_app_find_state_slot(){
+
+	const http_app_asset_t *page = &http_app_index_html;
+	http_app_state_slot_t *slot = &http_app_state_slot;
+	size_t len = page->end - page->start;
+
+	if(slot->at != 0){
+		return;
+	}
+
+	for(size_t i=1; i + HTTP_APP_STATE_MARKER_LEN <= len; i++){
+		if(memcmp(page->start + i, HTTP_APP_STATE_MARKER, HTTP_APP_STATE_MARKER_LEN) == 0){
+			slot->at = i;
+			break;
+		}
+	}
+
+	/* header: magic, method and flags, then with FEXTRA the length of the extra field and its subfields: 2 letters, length, data */
+	const uint8_t *gz = page->gz_start;
+	size_t gz_len = gz ? page->gz_end - gz : 0;
+	if(slot->at == 0 || gz_len < 12 || gz[0] != 0x1f || gz[1] != 0x8b || !(gz[3] & 0x04)){
+		return;
+	}
+	size_t extra_end = 12 + http_app_read_le(gz + 10, 2);
+	for(size_t i=12; i + 4 <= extra_end && extra_end <= gz_len; i += 4 + http_app_read_le(gz + i + 2, 2)){
+		if(gz[i] == 'W' && gz[i + 1] == 'M' && http_app_read_le(gz + i + 2, 2) == 12 && i + 16 <= extra_end){
+			uint32_t marker = http_app_read_le(gz + i + 4, 4);
+			uint32_t after = http_app_read_le(gz + i + 8, 4);
+			if(marker >= extra_end && marker <= after && after + 8 <= gz_len){
+				slot->gz_marker = marker;
+				slot->gz_after = after;
+				slot->gz_crc = http_app_read_le(gz + i + 12, 4);
+			}
+			return;
+		}
+	}
+}
+
+/**
+ * @brief Answers 304 with no body if the client already has the version tagged etag.
+ * The ETag is sent either way. It must stay valid until the response is sent.
+ * @return true if the 304 was sent: there is nothing left to do.
+ */
+static bool http_app_not_modified(httpd_req_t *req, const char *etag){
+
+	char if_none_match[HTTP_APP_IF_NONE_MATCH_MAX];
+
+	httpd_resp_set_hdr(req, http_etag_hdr, etag);
+
+	/* W/ prefixes are ignored: If-None-Match uses the weak comparison. The quotes keep "0123abcd" from matching "0123abcdc" */
+	const char *tag = etag[0] == 'W' ? etag + 2 : etag;
+	esp_err_t err = httpd_req_get_hdr_value_str(req, http_if_none_match_hdr, if_none_match, sizeof(if_none_match));
+	if((err != ESP_OK && err != ESP_ERR_HTTPD_RESULT_TRUNC) || (strstr(if_none_match, tag) == NULL && strcmp(if_none_match, "*") != 0)){
+		return false;
+	}
+
+	httpd_resp_set_status(req, http_304_hdr);
+	httpd_resp_send(req, NULL, 0);
+	return true;
+}
+
+/**
+ * @brief true if the client accepts gzip, as every browser does.
+ */
+static bool http_app_accepts_gzip(httpd_req_t *req){
+
+	/* browsers list gzip first: a truncated header still has it */
+	char accept[HTTP_APP_ACCEPT_MAX];
+	esp_err_t err = httpd_req_get_hdr_value_str(req, http_accept_encoding_hdr, accept, sizeof(accept));
+	return (err == ESP_OK || err == ESP_ERR_HTTPD_RESULT_TRUNC) && strstr(accept, http_gzip) != NULL;
+}
+
+/**
+ * @brief Sends a file of the web app, gzipped if the client accepts it.
+ */
+static esp_err_t http_app_send_asset(httpd_req_t *req, const http_app_asset_t *asset){
+
+	http_app_set_response(req, asset->response);
+
+	if(http_app_not_modified(req, asset->etag)){
+		return ESP_OK;
+	}
+
+	if(asset->gz_start && http_app_accepts_gzip(req)){
+		httpd_resp_set_hdr(req, http_content_encoding_hdr, http_gzip);
+		return httpd_resp_send(req, (const char*)asset->gz_start, asset->gz_end - asset->gz_start);
+	}
+
+	return httpd_resp_send(req, (const char*)asset->start, asset->end - asset->start);
+}
+
+
+/**
+ * @brief true if the client asked for CBOR in its Accept header, as the machine clients of the device do.
+ */
+static bool http_app_accepts_cbor(httpd_req_t *req){
+
+	if(!CBOR_ENABLED){
+		return false;
+	}
+
+	/* a truncated header still holds what machine clients send: they only list application/cbor */
+	char accept[HTTP_APP_ACCEPT_MAX];
+	esp_err_t err = httpd_req_get_hdr_value_str(req, http_accept_hdr, accept, sizeof(accept));
+	return (err == ESP_OK || err == ESP_ERR_HTTPD_RESULT_TRUNC) && strstr(accept, http_content_type_cbor) != NULL;
+}
+
+/**
+ * @brief Sends a status document as CBOR if the client accepts it and it exists, as json otherwise.
+ * Both encodings come from the same pinned snapshot.
+ */
+static esp_err_t http_app_send_document(httpd_req_t *req, const char *json, const uint8_t *cbor, size_t cbor_len, uint32_t version){
+
+	char etag[HTTP_APP_ETAG_SIZE];
+	bool send_cbor = cbor && http_app_accepts_cbor(req);
+
+	http_app_set_response(req, &http_response_document);
+	httpd_resp_set_type(req, send_cbor ? http_content_type_cbor : http_content_type_json);
+
+	/* nothing is published yet: there is no version to tag */
+	if(version != 0){
+		snprintf(etag, sizeof(etag), "\"%08x%s\"", (unsigned int)version, send_cbor ? "c" : "");
+		if(http_app_not_modified(req, etag)){
+			return ESP_OK;
+		}
+	}
+
+	if(send_cbor){
+		return httpd_resp_send(req, (const char*)cbor, cbor_len);
+	}
+	return httpd_resp_send(req, json, strlen(json));
+}
+
+
+/**
+ * @brief CRC-32 of gzip, continued from crc over len more bytes. Only the state inlined in index.html and the end of the page go through it.
+ */
+static uint32_t http_app_crc32(uint32_t crc, const uint8_t *data, size_t len){
+	crc = ~crc;
+	while(len--){
+		crc ^= *data++;
+		for(int k=0; k<8; k++){
+			crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+		}
+	}
+	return ~crc;
+}
+
+/**
+ * @brief Sends the block gathered by http_app_prerender_write.
+ */
+static esp_err_t http_app_prerender_flush(){
+
+	http_app_prerender_t *p = &http_app_prerender;
+	uint16_t len = p->len;
+	uint8_t *data = p->block + HTTP_APP_STORED_BLOCK_HEADER;
+
+	if(len == 0){
+		return ESP_OK;
+	}
+	p->len = 0;
+
+	if(!p->gzip){
+		return httpd_resp_send_chunk(p->req, (const char*)data, len);
+	}
+
+	/* a stored block: not the last one, type 00 on a byte boundary, then its length and the complement of its length */
+	p->crc = http_app_crc32(p->crc, data, len);
+	p->size += len;
+	p->block[0] = 0x00;
+	p->block[1] = len & 0xff;
+	p->block[2] = len >> 8;
+	p->block[3] = ~len & 0xff;
+	p->block[4] = (~len >> 8) & 0xff;
+	return httpd_resp_send_chunk(p->req, (const char*)p->block, HTTP_APP_STORED_BLOCK_HEADER + len);
+}
+
+/**
+ * @brief GET /captive.json: the captive portal API of RFC 8908, found by the clients in DHCP option 114.
+ * Clients are captive until the STA is connected. Once it is, they are told that they aren't anymore, so that they stop probing,
+ * and how long the access point has left if its shutdown timer runs.
+ */
+static esp_err_t http_app_send_captive(httpd_req_t *req){
+
+	char json[HTTP_APP_CAPTIVE_JSON_MAX + sizeof(http_redirect_url)];
+	bool captive = wifi_manager_get_sta_ip() == 0;
+	int32_t remaining = wifi_manager_get_ap_shutdown_remaining();
+	json_writer_t w;
+
+	json_writer_init(&w, json, sizeof(json));
+	json_writer_begin_object(&w);
+	json_writer_key(&w, "captive");
+	json_writer_bool(&w, captive);
+	json_writer_key(&w, "user-portal-url");
+	json_writer_string(&w, http_redirect_url);
+	if(remaining >= 0){
+		json_writer_key(&w, "seconds-remaining");
+		json_writer_int(&w, remaining);
+	}
+	json_writer_key(&w, "can-extend-session");
+	json_writer_bool(&w, false);
+	json_writer_end_object(&w);
+	json_writer_raw(&w, "\n");
+	if(!json_writer_finish(&w)){
+		/* a url full of characters to escape: an empty or truncated document would be invalid for the clients */
+		ESP_LOGE(TAG, "captive.json overflow");
+		http_app_set_response(req, &http_response_server_error);
+		return httpd_resp_send(req, NULL, 0);
+	}
+
+	http_app_set_response(req, &http_response_captive);
+	return httpd_resp_send(req, json, w.len);
+}
+
+/**
+ * @brief Sends the bytes of the state written into index.html: escaped so that an SSID can't close the script element holding them,
+ * and framed as stored deflate blocks when the page is sent gzipped. They are gathered into blocks of HTTP_APP_PRERENDER_BLOCK_SIZE.
+ */
+static esp_err_t http_app_prerender_write(const char *data, size_t len){
+
+	http_app_prerender_t *p = &http_app_prerender;
+	esp_err_t err = ESP_OK;
+
+	for(size_t i=0; i<len && err == ESP_OK; i++){
+
+		/* '<' can only be in the strings of a json, where \u003c is the same character */
+		const char *out = data[i] == '<' ? "\\u003c" : &data[i];
+		size_t n = data[i] == '<' ? 6 : 1;
+
+		if(p->len + n > HTTP_APP_PRERENDER_BLOCK_SIZE){
+			err = http_app_prerender_flush();
+		}
+		memcpy(p->block + HTTP_APP_STORED_BLOCK_HEADER + p->len, out, n);
+		p->len += n;
+	}
+	return err;
+}
+
+/**
+ * @brief Sends a chunk of json built by the writers below: as is, or through http_app_prerender_write while it goes into index.html.
+ */
+static esp_err_t http_app_chunk_send(httpd_req_t *req, const char *buf, size_t len){
+	if(req == http_app_prerender.req){
+		return http_app_prerender_write(buf, len);
+	}
+	return httpd_resp_send_chunk(req, buf, len);
+}
+
+/**
+ * @brief Appends str to the chunk built in w, sending the chunk first if str doesn't fit after it.
+ * A string larger than the whole chunk is sent on its own.
+ */
+static esp_err_t http_app_chunk_append(httpd_req_t *req, json_writer_t *w, const char *str){
+
+	size_t len = strlen(str);
+	esp_err_t err = ESP_OK;
+
+	if(w->len + len >= w->capacity){
+		err = http_app_chunk_send(req, w->buf, w->len);
+		json_writer_reset(w);
+	}
+	if(err == ESP_OK && len >= w->capacity){
+		return http_app_chunk_send(req, str, len);
+	}
+	json_writer_raw(w, str);
+	return err;
+}
+
+/**
+ * @brief Sends the chunk built in w if less than size bytes are left in it, so that the next size bytes can be appended.
+ */
+static esp_err_t http_app_chunk_reserve(httpd_req_t *req, json_writer_t *w, size_t size){
+
+	esp_err_t err = ESP_OK;
+
+	if(w->capacity - w->len < size){
+		err = http_app_chunk_send(req, w->buf, w->len);
+		json_writer_reset(w);
+	}
+	return err;
+}
+
+/**
+ * @brief Appends one access point as a json object. It takes at most HTTP_APP_AP_JSON_MAX bytes.
+ */
+static void http_app_write_ap_json(json_writer_t *w, const wifi_manager_ap_t *ap){
+
+	json_writer_begin_object(w);
+	json_writer_key(w, "ssid");
+	json_writer_string_n(w, (const char*)ap->ssid, sizeof(ap->ssid));
+	json_writer_key(w, "chan");
+	json_writer_int(w, ap->primary);
+	json_writer_key(w, "rssi");
+	json_writer_int(w, ap->rssi);
+	json_writer_key(w, "auth");
+	json_writer_int(w, ap->authmode);
+	json_writer_end_object(w);
+}
+
+/**
+ * @brief Appends a list of access points as a json array to the chunk built in w, sending the chunk whenever the next access point doesn't fit.
+ * What is left in w is for the caller to send, once it has closed its own document.
+ * @param list NULL is written as an empty list.
+ */
+static esp_err_t http_app_write_ap_list_json(httpd_req_t *req, json_writer_t *w, const wifi_manager_ap_list_t *list){
+
+	int count = list ? list->count : 0;
+	esp_err_t err = ESP_OK;
+
+	json_writer_begin_array(w);
+
+	for(int i=0; i<count && err == ESP_OK; i++){
+		/* room for one more access point, the closing brackets of the list and of /state.json, a new line and the terminator of the writer */
+		err = http_app_chunk_reserve(req, w, HTTP_APP_AP_JSON_MAX + 4);
+		http_app_write_ap_json(w, &list->ap[i]);
+	}
+
+	json_writer_end_array(w);
+	return err;
+}
+
+/**
+ * @brief Index in list of the access point named ssid with this security, -1 if it has none.
+ * wifi_manager_filter_unique keeps one access point per SSID and security: together they identify an entry of the list.
+ */
+static int http_app_find_ap(const wifi_manager_ap_list_t *list, const wifi_manager_ap_t *ap){
+
+	for(int i=0; i<list->count; i++){
+		if(list->ap[i].authmode == ap->authmode && strncmp((const char*)list->ap[i].ssid, (const char*)ap->ssid, sizeof(list->ap[i].ssid)) == 0){
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * @brief Appends what changed in a list of access points since the version base the client has, as a json object:
+ * {"since":<version of base>,"add":[..],"chg":[..],"del":["ssid",..]}. Access points are matched by SSID; "add" and "chg" hold
+ * the new and the changed ones with all their fields, "del" the SSIDs of those gone. Chunks are sent as in http_app_write_ap_list_json.
+ */
+static esp_err_t http_app_write_ap_patch_json(httpd_req_t *req, json_writer_t *w, const wifi_manager_ap_list_t *list, const wifi_manager_ap_list_t *base, uint32_t since){
+
+	/* room for one access point, the key of the next section and what closes the patch and the document around it */
+	const size_t reserve = HTTP_APP_AP_JSON_MAX + 16;
+	char head[24];
+	esp_err_t err;
+
+	/* versions are 32 bit unsigned, json_writer_int is signed */
+	snprintf(head, sizeof(head), "{\"since\":%u", (unsigned int)since);
+	err = http_app_chunk_reserve(req, w, reserve + sizeof(head));
+	json_writer_raw(w, head);
+	w->need_comma = true;
+
+	/* access points base doesn't have */
+	json_writer_key(w, "add");
+	json_writer_begin_array(w);
+	for(int i=0; i<list->count && err == ESP_OK; i++){
+		if(http_app_find_ap(base, &list->ap[i]) < 0){
+			err = http_app_chunk_reserve(req, w, reserve);
+			http_app_write_ap_json(w, &list->ap[i]);
+		}
+	}
+	json_writer_end_array(w);
+
+	/* access points of both whose channel or signal changed */
+	if(err == ESP_OK){
+		err = http_app_chunk_reserve(req, w, reserve);
+	}
+	json_writer_key(w, "chg");
+	json_writer_begin_array(w);
+	for(int i=0; i<list->count && err == ESP_OK; i++){
+		const wifi_manager_ap_t *ap = &list->ap[i];
+		int j = http_app_find_ap(base, ap);
+		if(j >= 0 && (ap->primary != base->ap[j].primary || ap->rssi != base->ap[j].rssi)){
+			err = http_app_chunk_reserve(req, w, reserve);
+			http_app_write_ap_json(w, ap);
+		}
+	}
+	json_writer_end_array(w);
+
+	/* access points list doesn't have anymore, as {"ssid":..,"auth":..} */
+	if(err == ESP_OK){
+		err = http_app_chunk_reserve(req, w, reserve);
+	}
+	json_writer_key(w, "del");
+	json_writer_begin_array(w);
+	for(int i=0; i<base->count && err == ESP_OK; i++){
+		if(http_app_find_ap(list, &base->ap[i]) < 0){
+			err = http_app_chunk_reserve(req, w, reserve);
+			json_writer_begin_object(w);
+			json_writer_key(w, "ssid");
+			json_writer_string_n(w, (const char*)base->ap[i].ssid, sizeof(base->ap[i].ssid));
+			json_writer_key(w, "auth");
+			json_writer_int(w, base->ap[i].authmode);
+			json_writer_end_object(w);
+		}
+	}
+	json_writer_end_array(w);
+
+	json_writer_end_object(w);
+	return err;
+}
+
+/**
+ * @brief Reads the version of a part of /state.json or /ap.json the client already has from the query string. 0, which is never a version, if it has none.
+ */
+static uint32_t http_app_query_version(const char *query, const char *key){
+
+	char value[12];
+
+	if(query == NULL || httpd_query_key_value(query, key, value, sizeof(value)) != ESP_OK){
+		return 0;
+	}
+	return (uint32_t)strtoul(value, NULL, 10);
+}
+
+/**
+ * @brief Appends a list of access points for a client that has the version since: what changed, as http_app_write_ap_patch_json,
+ * if that version is one of the lists kept by the wifi manager, the full list otherwise.
+ * @param base receives the list the client has.
+ * @param list_prefix, patch_prefix written first, depending on which of the two is sent. NULL for nothing.
+ */
+static esp_err_t http_app_write_ap_update_json(httpd_req_t *req, json_writer_t *w, const wifi_manager_ap_list_t *list, uint32_t since,
+		wifi_manager_ap_list_t *base, const char *list_prefix, const char *patch_prefix){
+
+	bool patch = list && wifi_manager_get_ap_list_since(since, base);
+	const char *prefix = patch ? patch_prefix : list_prefix;
+	esp_err_t err = ESP_OK;
+
+	if(prefix){
+		err = http_app_chunk_append(req, w, prefix);
+	}
+	if(err == ESP_OK){
+		err = patch ? http_app_write_ap_patch_json(req, w, list, base, since) : http_app_write_ap_list_json(req, w, list);
+	}
+	return err;
+}
+
+/**
+ * @brief Streams a list of access points as json, or as CBOR if the client accepts it, straight from the records.
+ * The document is built in chunks of HTTP_APP_CHUNK_SIZE bytes on the stack, so its size is only bounded by the number of records.
+ * @param list NULL is sent as an empty list.
+ * @param since version of the list the json client has, from ?since=: only what changed is sent if it is still known. 0 for the full list.
+ */
+static esp_err_t http_app_send_ap_list(httpd_req_t *req, const wifi_manager_ap_list_t *list, uint32_t since){
+
+	char chunk[HTTP_APP_CHUNK_SIZE];
+	char etag[HTTP_APP_ETAG_SIZE];
+	int count = list ? list->count : 0;
+	bool send_cbor = http_app_accepts_cbor(req);
+	esp_err_t err = ESP_OK;
+
+	http_app_set_response(req, &http_response_document);
+
+	if(list){
+		snprintf(etag, sizeof(etag), "\"%08x%s\"", (unsigned int)wifi_manager_get_ap_list_version(list), send_cbor ? "c" : "");
+		if(http_app_not_modified(req, etag)){
+			return ESP_OK;
+		}
+	}
+
+	if(send_cbor){
+
+		cbor_writer_t c;
+		httpd_resp_set_type(req, http_content_type_cbor);
+		cbor_writer_init(&c, (uint8_t*)chunk, sizeof(chunk));
+		cbor_writer_array(&c, count);
+
+		for(int i=0; i<count && err == ESP_OK; i++){
+
+			const wifi_manager_ap_t *ap = &list->ap[i];
+
+			if(c.capacity - c.len < CBOR_ONE_APP_SIZE){
+				err = httpd_resp_send_chunk(req, chunk, c.len);
+				cbor_writer_reset(&c);
+			}
+			cbor_writer_map(&c, 4);
+			cbor_writer_text(&c, "ssid");
+			cbor_writer_text_n(&c, (const char*)ap->ssid, sizeof(ap->ssid));
+			cbor_writer_text(&c, "chan");
+			cbor_writer_int(&c, ap->primary);
+			cbor_writer_text(&c, "rssi");
+			cbor_writer_int(&c, ap->rssi);
+			cbor_writer_text(&c, "auth");
+			cbor_writer_int(&c, ap->authmode);
+		}
+
+		if(err == ESP_OK){
+			err = httpd_resp_send_chunk(req, chunk, c.len);
+		}
+	}
+	else{
+
+		json_writer_t w;
+		httpd_resp_set_type(req, http_content_type_json);
+		json_writer_init(&w, chunk, sizeof(chunk));
+		err = http_app_write_ap_update_json(req, &w, list, since, &http_app_ap_base, NULL, NULL);
+		json_writer_raw(&w, "\n");
+		if(err == ESP_OK){
+			err = httpd_resp_send_chunk(req, chunk, w.len);
+		}
+	}
+
+	/* an empty chunk ends the response */
+	if(err == ESP_OK){
+		err = httpd_resp_send_chunk(req, NULL, 0);
+	}
+	return err;
+}
+
+
+/**
+ * @brief Writes the versions of the wifi status, the mqtt status and the list of access points in one json to the empty chunk built in w,
+ * with the body of the parts whose version differs from the one the client passed in the query string:
+ * ?wifi=<version>&mqtt=<version>&ap=<version>. A poll where nothing changed is answered in a few dozen bytes.
+ * The list of access points comes as "ap_list", or as "ap_patch" holding what changed since the version the client has if it is still known.
+ * What is left in w is for the caller to send.
+ * @param known the query string, NULL for every part.
+ */
+static esp_err_t http_app_write_state(httpd_req_t *req, json_writer_t *w, const char *known){
+
+	esp_err_t err = ESP_OK;
+
+	/* all three are pinned before their versions are read, so that each body matches the version sent with it */
+	const char *wifi = wifi_manager_pin_ip_info_json();
+	const char *mqtt = mqtt_manager_pin_info_json();
+	const wifi_manager_ap_list_t *list = wifi_manager_pin_ap_list();
+	uint32_t wifi_version = wifi_manager_get_pinned_version(wifi);
+	uint32_t mqtt_version = mqtt_manager_get_pinned_info_version(mqtt);
+	uint32_t ap_version = list ? wifi_manager_get_ap_list_version(list) : 0;
+
+	/* the versions are unsigned 32 bits: formatted here rather than with json_writer_int. 3 x 10 digits and the keys */
+	char versions[64];
+	snprintf(versions, sizeof(versions), "{\"wifi\":%u,\"mqtt\":%u,\"ap\":%u",
+			(unsigned int)wifi_version, (unsigned int)mqtt_version, (unsigned int)ap_version);
+	err = http_app_chunk_append(req, w, versions);
+
+	if(err == ESP_OK && wifi && wifi_version != http_app_query_version(known, http_app_event_names[HTTP_APP_EVENT_WIFI])){
+		err = http_app_chunk_append(req, w, ",\"status\":");
+		if(err == ESP_OK){
+			err = http_app_chunk_append(req, w, wifi);
+		}
+	}
+	if(err == ESP_OK && mqtt && mqtt_version != http_app_query_version(known, http_app_event_names[HTTP_APP_EVENT_MQTT])){
+		err = http_app_chunk_append(req, w, ",\"mqtt_status\":");
+		if(err == ESP_OK){
+			err = http_app_chunk_append(req, w, mqtt);
+		}
+	}
+	uint32_t ap_known = http_app_query_version(known, http_app_event_names[HTTP_APP_EVENT_SCAN]);
+	if(err == ESP_OK && list && ap_version != ap_known){
+		err = http_app_write_ap_update_json(req, w, list, ap_known, &http_app_ap_base, ",\"ap_list\":", ",\"ap_patch\":");
+	}
+
+	wifi_manager_unpin_json(wifi);
+	mqtt_manager_unpin_info_json(mqtt);
+	wifi_manager_unpin_ap_list(list);
+
+	if(err == ESP_OK){
+		err = http_app_chunk_append(req, w, "}\n");
+	}
+	return err;
+}
+
+/**
+ * @brief GET /state.json: see http_app_write_state. "scan=1" also requests a wifi scan, as GET /ap.json does.
+ */
+static esp_err_t http_app_send_state(httpd_req_t *req){
+
+	char query[HTTP_APP_QUERY_MAX];
+	char chunk[HTTP_APP_CHUNK_SIZE];
+	json_writer_t w;
+
+	/* a query that doesn't fit is ignored: every part is sent */
+	bool has_query = httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK;
+
+	http_app_set_response(req, &http_response_json);
+	json_writer_init(&w, chunk, sizeof(chunk));
+	esp_err_t err = http_app_write_state(req, &w, has_query ? query : NULL);
+
+	if(err == ESP_OK){
+		err = httpd_resp_send_chunk(req, chunk, w.len);
+	}
+	/* an empty chunk ends the response */
+	if(err == ESP_OK){
+		err = httpd_resp_send_chunk(req, NULL, 0);
+	}
+
+	if(has_query && httpd_query_key_value(query, "scan", chunk, sizeof(chunk)) == ESP_OK){
+		wifi_manager_scan_async();
+	}
+
+	return err;
+}
+
+/**
+ * @brief GET /: sends index.html with the state of the device, the json of http_app_write_state for every part, in place of the state marker.
+ * The page can show the access points and the status before code.js makes a single request.
+ * Gzipped, the page is sent as built up to the marker, then the state as stored blocks, then the rest of the page as built and a new trailer:
+ * nothing is compressed on the device. Pages without a marker are sent as is.
+ */
+static esp_err_t http_app_send_prerendered(httpd_req_t *req){
+
+	const http_app_asset_t *page = &http_app_index_html;
+	const http_app_state_slot_t *slot = &http_app_state_slot;
+	http_app_prerender_t *p = &http_app_prerender;
+	char chunk[HTTP_APP_CHUNK_SIZE];
+	json_writer_t w;
+	esp_err_t err;
+
+	if(slot->at == 0){
+		return http_app_send_asset(req, page);
+	}
+
+	const uint8_t *after = page->start + slot->at + HTTP_APP_STATE_MARKER_LEN;
+	size_t after_len = page->end - after;
+
+	/* the state changes from one request to the next: there is no ETag, the page is fetched again */
+	http_app_set_response(req, &http_response_prerendered);
+	p->req = req;
+	p->gzip = slot->gz_after != 0 && http_app_accepts_gzip(req);
+	p->len = 0;
+	p->crc = slot->gz_crc;
+	p->size = slot->at;
+
+	if(p->gzip){
+		httpd_resp_set_hdr(req, http_content_encoding_hdr, http_gzip);
+		err = httpd_resp_send_chunk(req, (const char*)page->gz_start, slot->gz_marker);
+	}
+	else{
+		err = httpd_resp_send_chunk(req, (const char*)page->start, slot->at);
+	}
+
+	if(err == ESP_OK){
+		json_writer_init(&w, chunk, sizeof(chunk));
+		err = http_app_write_state(req, &w, NULL);
+	}
+	if(err == ESP_OK){
+		err = http_app_prerender_write(chunk, w.len);
+	}
+	if(err == ESP_OK){
+		err = http_app_prerender_flush();
+	}
+	p->req = NULL;
+
+	if(err == ESP_OK && p->gzip){
+
+		/* the rest of the deflate stream, which holds the final block, without the trailer of the page as built */
+		uint8_t trailer[8];
+		err = httpd_resp_send_chunk(req, (const char*)page->gz_start + slot->gz_after, (page->gz_end - 8) - (page->gz_start + slot->gz_after));
+
+		p->crc = http_app_crc32(p->crc, after, after_len);
+		p->size += after_len;
+		for(int i=0; i<4; i++){
+			trailer[i] = (p->crc >> (8 * i)) & 0xff;
+			trailer[4 + i] = (p->size >> (8 * i)) & 0xff;
+		}
+		if(err == ESP_OK){
+			err = httpd_resp_send_chunk(req, (const char*)trailer, sizeof(trailer));
+		}
+	}
+	else if(err == ESP_OK){
+		err = httpd_resp_send_chunk(req, (const char*)after, after_len);
+	}
+
+	/* an empty chunk ends the response */
+	if(err == ESP_OK){
+		err = httpd_resp_send_chunk(req, NULL, 0);
+	}
+	return err;
+}
+
+
+#if HTTP_APP_EVENTS_ENABLED
+/**
+ * @brief Sends a part of the state as one event if its version differs from the one the client has: "event: wifi", "mqtt" or "ap",
+ * its version as id and the same json as /status.json, /mqtt_status.json or /ap.json?since=<version the client has> as data.
+ * @param known version the client has, updated once the event is sent.
+ */
+static esp_err_t http_app_send_event(httpd_req_t *req, http_app_event_t event, uint32_t *known, char *chunk){
+
+	json_writer_t w;
+	const char *json = NULL;
+	const wifi_manager_ap_list_t *list = NULL;
+	uint32_t version;
+	esp_err_t err = ESP_OK;
+
+	switch(event){
+	case HTTP_APP_EVENT_WIFI:
+		json = wifi_manager_pin_ip_info_json();
+		version = wifi_manager_get_pinned_version(json);
+		break;
+	case HTTP_APP_EVENT_MQTT:
+		json = mqtt_manager_pin_info_json();
+		version = mqtt_manager_get_pinned_info_version(json);
+		break;
+	default:
+		list = wifi_manager_pin_ap_list();
+		version = list ? wifi_manager_get_ap_list_version(list) : 0;
+		break;
+	}
+
+	/* nothing published yet, or nothing new for this client */
+	if(version != 0 && version != *known){
+
+		/* the event names are short and the id takes at most 10 digits */
+		char fields[48];
+		snprintf(fields, sizeof(fields), "event: %s\nid: %u\ndata: ", http_app_event_names[event], (unsigned int)version);
+
+		json_writer_init(&w, chunk, HTTP_APP_CHUNK_SIZE);
+		err = http_app_chunk_append(req, &w, fields);
+
+		/* the json ends its data line with its own new line, the blank line after it ends the event */
+		if(err == ESP_OK && json){
+			err = http_app_chunk_append(req, &w, json);
+		}
+		else if(err == ESP_OK){
+			err = http_app_write_ap_update_json(req, &w, list, *known, &http_app_events_ap_base, NULL, NULL);
+			if(err == ESP_OK){
+				err = http_app_chunk_append(req, &w, "\n");
+			}
+		}
+		if(err == ESP_OK){
+			err = http_app_chunk_append(req, &w, "\n");
+		}
+
+		if(err == ESP_OK){
+			err = httpd_resp_send_chunk(req, chunk, w.len);
+		}
+		if(err == ESP_OK){
+			*known = version;
+		}
+	}
+
+	if(event == HTTP_APP_EVENT_WIFI){
+		wifi_manager_unpin_json(json);
+	}
+	else if(event == HTTP_APP_EVENT_MQTT){
+		mqtt_manager_unpin_info_json(json);
+	}
+	else{
+		wifi_manager_unpin_ap_list(list);
+	}
+
+	return err;
+}
+
+/**
+ * @brief Answers a held POST /connect.json with the outcome of the attempt and the status json. The status can be longer than
+ * a chunk, so the answer is streamed.
+ */
+static esp_err_t http_app_send_connect_result(httpd_req_t *req, const wifi_manager_connect_result_t *result, char *chunk){
+
+	json_writer_t w;
+	char fields[48];
+	esp_err_t err;
+
+	snprintf(fields, sizeof(fields), "{\"urc\":%d,\"reason\":%u,\"status\":", (int)result->urc, (unsigned int)result->reason);
+
+	http_app_set_response(req, &http_response_json);
+	json_writer_init(&w, chunk, HTTP_APP_CHUNK_SIZE);
+	err = http_app_chunk_append(req, &w, fields);
+
+	const char *json = wifi_manager_pin_ip_info_json();
+	if(err == ESP_OK){
+		/* the status json ends with a new line, which doesn't hurt inside the object */
+		err = http_app_chunk_append(req, &w, json ? json : "{}\n");
+	}
+	wifi_manager_unpin_json(json);
+
+	if(err == ESP_OK){
+		err = http_app_chunk_append(req, &w, "}\n");
+	}
+	if(err == ESP_OK){
+		err = httpd_resp_send_chunk(req, chunk, w.len);
+	}
+	/* an empty chunk ends the response */
+	if(err == ESP_OK){
+		err = httpd_resp_send_chunk(req, NULL, 0);
+	}
+
+	return err;
+}
+
+/**
+ * @brief Answers the connect waits whose attempt resolved with {"urc":..,"reason":..,"status":{..}}: the result, the wifi disconnect
+ * reason of a failed attempt and the status json. Those whose deadline passed get 202 with no body, their client polls the status instead.
+ * @param closing the server stops: every wait is closed without an answer.
+ */
+static void http_app_answer_connect_waits(TickType_t now, bool closing, char *chunk){
+
+	if(http_app_wait_count == 0){
+		return;
+	}
+
+	wifi_manager_connect_result_t result = wifi_manager_get_connect_result();
+
+	for(int i=0; i<HTTP_APP_MAX_CONNECT_WAITS; i++){
+
+		http_app_connect_wait_t *wait = &http_app_connect_waits[i];
+		httpd_req_t *req = wait->req;
+
+		if(req == NULL){
+			continue;
+		}
+
+		bool resolved = (int32_t)(result.attempt - wait->attempt) >= 0;
+		bool expired = (int32_t)(now - wait->deadline) >= 0;
+
+		if(!resolved && !expired && !closing){
+			continue;
+		}
+
+		if(closing){
+			/* the socket is closed with the server */
+		}
+		else if(resolved){
+			http_app_send_connect_result(req, &result, chunk);
+		}
+		else{
+			http_app_set_response(req, &http_response_accepted);
+			httpd_resp_send(req, NULL, 0);
+		}
+
+		portENTER_CRITICAL(&http_app_streams_mux);
+		wait->req = NULL;
+		http_app_wait_count--;
+		portEXIT_CRITICAL(&http_app_streams_mux);
+
+		/* gives the socket back to the server */
+		httpd_req_async_handler_complete(req);
+	}
+}
+
+/**
+ * @brief Writes the event streams until the end of times. It wakes up on http_app_notify, and every HTTP_APP_EVENT_PERIOD_MS to send
+ * a keepalive and check every part for changes whose event found the json still locked. Scans are left to the clients, which ask
+ * for them like the polling web app did. A stream whose client went away fails its next write and is closed.
+ */
+static void http_app_events_task_fn(void *pvParameters){
+
+	char chunk[HTTP_APP_CHUNK_SIZE];
+	uint8_t queue[HTTP_APP_EVENT_QUEUE_LENGTH];
+	const TickType_t period = pdMS_TO_TICKS(HTTP_APP_EVENT_PERIOD_MS);
+	TickType_t last_period = xTaskGetTickCount();
+
+	for(;;){
+
+		/* the next period, or the first deadline of a connect wait if it comes sooner */
+		TickType_t now = xTaskGetTickCount();
+		TickType_t timeout = now - last_period < period ? period - (now - last_period) : 0;
+		for(int i=0; i<HTTP_APP_MAX_CONNECT_WAITS; i++){
+			if(http_app_connect_waits[i].req != NULL){
+				TickType_t left = (int32_t)(http_app_connect_waits[i].deadline - now) > 0 ? http_app_connect_waits[i].deadline - now : 0;
+				timeout = left < timeout ? left : timeout;
+			}
+		}
+
+		ulTaskNotifyTake(pdTRUE, timeout);
+
+		now = xTaskGetTickCount();
+		bool periodic = now - last_period >= period;
+		bool closing = http_app_events_closing;
+		if(periodic){
+			last_period = now;
+		}
+
+		http_app_answer_connect_waits(now, closing, chunk);
+
+		for(int i=0; i<HTTP_APP_MAX_EVENT_STREAMS; i++){
+
+			http_app_event_stream_t *stream = &http_app_streams[i];
+			esp_err_t err = ESP_OK;
+			bool all;
+			int count;
+
+			portENTER_CRITICAL(&http_app_streams_mux);
+			httpd_req_t *req = stream->req;
+			count = stream->count;
+			for(int j=0; j<count; j++){
+				queue[j] = stream->queue[(stream->head + j) % HTTP_APP_EVENT_QUEUE_LENGTH];
+			}
+			all = stream->overflow || periodic;
+			stream->head = 0;
+			stream->count = 0;
+			stream->overflow = false;
+			portEXIT_CRITICAL(&http_app_streams_mux);
+
+			if(req == NULL){
+				continue;
+			}
+
+			if(closing){
+				err = ESP_FAIL;
+			}
+			else if(all){
+				for(int event=0; event<HTTP_APP_EVENT_COUNT && err == ESP_OK; event++){
+					err = http_app_send_event(req, event, &stream->versions[event], chunk);
+				}
+			}
+			else{
+				for(int j=0; j<count && err == ESP_OK; j++){
+					err = http_app_send_event(req, queue[j], &stream->versions[queue[j]], chunk);
+				}
+			}
+
+			/* a comment line: clients ignore it, but a dead socket shows up */
+			if(err == ESP_OK && periodic){
+				err = httpd_resp_send_chunk(req, ":\n\n", 3);
+			}
+
+			if(err != ESP_OK){
+				portENTER_CRITICAL(&http_app_streams_mux);
+				stream->req = NULL;
+				http_app_stream_count--;
+				portEXIT_CRITICAL(&http_app_streams_mux);
+
+				/* gives the socket back to the server */
+				httpd_req_async_handler_complete(req);
+			}
+		}
+
+		if(closing && http_app_stream_count == 0 && http_app_wait_count == 0){
+			xSemaphoreGive(http_app_events_closed);
+		}
+	}
+}
+
+/**
+ * @brief Creates the events task. It is kept for the lifetime of the application, like the async workers.
+ */
+static void http_app_events_start(){
+
+	http_app_events_closing = false;
+
+	if(http_app_events_task != NULL){
+		return;
+	}
+
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+	http_app_events_closed = xSemaphoreCreateBinaryStatic(&http_app_events_closed_buffer);
+#else
+	http_app_events_closed = xSemaphoreCreateBinary();
+#endif
+	if(http_app_events_closed == NULL){
+		ESP_LOGE(TAG, "could not create httpd_events");
+		return;
+	}
+
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+	http_app_events_task = wifi_manager_create_task(WM_TASK_HTTPD_EVENTS, &http_app_events_task_fn, "httpd_events", NULL, http_app_events_task_stack, &http_app_events_task_buffer);
+#else
+	http_app_events_task = wifi_manager_create_task(WM_TASK_HTTPD_EVENTS, &http_app_events_task_fn, "httpd_events", NULL, NULL, NULL);
+#endif
+	if(http_app_events_task == NULL){
+		ESP_LOGE(TAG, "could not create httpd_events");
+	}
+}
+
+/**
+ * @brief Has the events task close every stream and connect wait, and waits for it: their requests would outlive the server.
+ * Their sessions are closed first so that a write blocked on a stalled client fails rather than waiting for the send timeout.
+ * Gives up after HTTP_APP_EVENTS_STOP_TIMEOUT_MS.
+ * @return false if some are still open. The events task then goes on serving them since the server must be kept.
+ */
+static bool http_app_events_stop(){
+
+	if(http_app_events_task == NULL){
+		return true;
+	}
+
+	/* a give left over from an earlier stop must not be taken for this one */
+	xSemaphoreTake(http_app_events_closed, 0);
+	http_app_events_closing = true;
+
+	/* no stream or wait can be added once closing is set: the sockets are collected first, the server is not called under the lock */
+	int fds[HTTP_APP_MAX_EVENT_STREAMS + HTTP_APP_MAX_CONNECT_WAITS];
+	int fd_count = 0;
+	portENTER_CRITICAL(&http_app_streams_mux);
+	for(int i=0; i<HTTP_APP_MAX_EVENT_STREAMS; i++){
+		if(http_app_streams[i].req != NULL){
+			fds[fd_count++] = httpd_req_to_sockfd(http_app_streams[i].req);
+		}
+	}
+	for(int i=0; i<HTTP_APP_MAX_CONNECT_WAITS; i++){
+		if(http_app_connect_waits[i].req != NULL){
+			fds[fd_count++] = httpd_req_to_sockfd(http_app_connect_waits[i].req);
+		}
+	}
+	portEXIT_CRITICAL(&http_app_streams_mux);
+
+	for(int i=0; i<fd_count; i++){
+		httpd_sess_trigger_close(httpd_handle, fds[i]);
+	}
+	xTaskNotifyGive(http_app_events_task);
+
+	if(xSemaphoreTake(http_app_events_closed, pdMS_TO_TICKS(HTTP_APP_EVENTS_STOP_TIMEOUT_MS)) != pdTRUE){
+
+		portENTER_CRITICAL(&http_app_streams_mux);
+		bool open = http_app_stream_count != 0 || http_app_wait_count != 0;
+		portEXIT_CRITICAL(&http_app_streams_mux);
+
+		if(open){
+			ESP_LOGE(TAG, "httpd_events did not release %d streams and %d connect waits", http_app_stream_count, http_app_wait_count);
+			http_app_events_closing = false;
+			return false;
+		}
+	}
+
+	return true;
+}
+#endif
+
+void http_app_notify(http_app_event_t event){
+
+#if HTTP_APP_EVENTS_ENABLED
+	/* connect waits are resolved by the wifi status events */
+	if((http_app_stream_count == 0 && http_app_wait_count == 0) || event >= HTTP_APP_EVENT_COUNT){
+		return;
+	}
+
+	portENTER_CRITICAL(&http_app_streams_mux);
+	for(int i=0; i<HTTP_APP_MAX_EVENT_STREAMS; i++){
+
+		http_app_event_stream_t *stream = &http_app_streams[i];
+
+		if(stream->req == NULL){
+			continue;
+		}
+		if(stream->count < HTTP_APP_EVENT_QUEUE_LENGTH){
+			stream->queue[(stream->head + stream->count) % HTTP_APP_EVENT_QUEUE_LENGTH] = event;
+			stream->count++;
+		}
+		else{
+			stream->overflow = true;
+		}
+	}
+	portEXIT_CRITICAL(&http_app_streams_mux);
+
+	xTaskNotifyGive(http_app_events_task);
+#endif
+}
+
+/**
+ * @brief Opens a Server-Sent Events stream: GET /events. The client gets an event whenever the wifi status or the mqtt status change
+ * or a scan completes, see http_app_send_event. It can pass the versions it has like for /state.json, and only gets what changed since.
+ * At most HTTP_APP_MAX_EVENT_STREAMS are open at once. Past that, or without support for detached requests, the client has to poll.
+ */
+static esp_err_t http_app_open_event_stream(httpd_req_t *req){
+
+#if HTTP_APP_EVENTS_ENABLED
+	char query[HTTP_APP_QUERY_MAX];
+	http_app_event_stream_t *stream = NULL;
+	httpd_req_t *copy = NULL;
+	bool opened = false;
+
+	/* slots are only ever taken on the server task: a free one stays free until it is taken below */
+	for(int i=0; i<HTTP_APP_MAX_EVENT_STREAMS && stream == NULL; i++){
+		if(http_app_streams[i].req == NULL){
+			stream = &http_app_streams[i];
+		}
+	}
+
+	if(stream == NULL || http_app_events_task == NULL || http_app_events_closing){
+		ESP_LOGW(TAG, "event stream refused: %d open", http_app_stream_count);
+		http_app_set_response(req, &http_response_busy);
+		return httpd_resp_send(req, NULL, 0);
+	}
+
+	bool has_query = httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK;
+	for(int event=0; event<HTTP_APP_EVENT_COUNT; event++){
+		stream->versions[event] = http_app_query_version(has_query ? query : NULL, http_app_event_names[event]);
+	}
+
+	if(httpd_req_async_handler_begin(req, &copy) != ESP_OK){
+		http_app_set_response(req, &http_response_busy);
+		return httpd_resp_send(req, NULL, 0);
+	}
+
+	/* the headers go out with a first comment, so that the client knows the stream is open before anything changes */
+	http_app_set_response(copy, &http_response_event_stream);
+	if(httpd_resp_send_chunk(copy, ":\n\n", 3) == ESP_OK){
+
+		/* the stream starts with every part the client doesn't have yet */
+		portENTER_CRITICAL(&http_app_streams_mux);
+		if(!http_app_events_closing){
+			stream->head = 0;
+			stream->count = 0;
+			stream->overflow = true;
+			stream->req = copy;
+			http_app_stream_count++;
+			opened = true;
+		}
+		portEXIT_CRITICAL(&http_app_streams_mux);
+	}
+
+	if(opened){
+		xTaskNotifyGive(http_app_events_task);
+	}
+	else{
+		httpd_req_async_handler_complete(copy);
+	}
+	return ESP_OK;
+#else
+	http_app_set_response(req, &http_response_not_found);
+	return httpd_resp_send(req, NULL, 0);
+#endif
+}
+
+
+/**
+ * @brief Holds a POST /connect.json?wait=<seconds> until its connection attempt resolves, at most HTTP_APP_CONNECT_WAIT_MAX seconds.
+ * The events task answers it, see http_app_answer_connect_waits, so that the portal keeps serving meanwhile.
+ * @return false if the request doesn't ask to wait or can't: it is then answered right away, as without wait.
+ */
+static bool http_app_wait_connect(httpd_req_t *req, uint32_t attempt){
+
+#if HTTP_APP_EVENTS_ENABLED
+	char query[HTTP_APP_QUERY_MAX];
+	char value[12];
+	http_app_connect_wait_t *wait = NULL;
+	httpd_req_t *copy = NULL;
+	bool held = false;
+
+	if(httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK || httpd_query_key_value(query, "wait", value, sizeof(value)) != ESP_OK){
+		return false;
+	}
+	uint32_t seconds = (uint32_t)strtoul(value, NULL, 10);
+	if(seconds == 0 || http_app_events_task == NULL || http_app_events_closing){
+		return false;
+	}
+	if(seconds > HTTP_APP_CONNECT_WAIT_MAX){
+		seconds = HTTP_APP_CONNECT_WAIT_MAX;
+	}
+
+	/* like the streams, slots are only ever taken on the server task */
+	for(int i=0; i<HTTP_APP_MAX_CONNECT_WAITS && wait == NULL; i++){
+		if(http_app_connect_waits[i].req == NULL){
+			wait = &http_app_connect_waits[i];
+		}
+	}
+	if(wait == NULL || httpd_req_async_handler_begin(req, &copy) != ESP_OK){
+		ESP_LOGW(TAG, "connect.json: can't wait for attempt %u", (unsigned int)attempt);
+		return false;
+	}
+
+	portENTER_CRITICAL(&http_app_streams_mux);
+	if(!http_app_events_closing){
+		wait->attempt = attempt;
+		wait->deadline = xTaskGetTickCount() + pdMS_TO_TICKS(seconds * 1000);
+		wait->req = copy;
+		http_app_wait_count++;
+		held = true;
+	}
+	portEXIT_CRITICAL(&http_app_streams_mux);
+
+	if(held){
+		/* the attempt may have resolved already */
+		xTaskNotifyGive(http_app_events_task);
+		return true;
+	}
+
+	/* the server is stopping: the copy is answered now, as the request would have been */
+	http_app_set_response(copy, &http_response_json);
+	httpd_resp_send(copy, NULL, 0);
+	httpd_req_async_handler_complete(copy);
+	return true;
+#else
+	return false;
+#endif
+}
+
+
+#ifndef ESP32
+static void http_app_register_uri_handler(httpd_handle_t handle, const char * url, uint32_t method);
+#endif
 
 /**
- * @brief embedded binary data.
- * @see file "component.mk"
- * @see https://docs.espressif.com/projects/esp-idf/en/latest/api-guides/build-system.html#embedding-binary-data
+ * @brief Adds a route to the registry.
  */
-extern const uint8_t style_css_start[] asm("_binary_style_css_start");
-extern const uint8_t style_css_end[]   asm("_binary_style_css_end");
-extern const uint8_t code_js_start[] asm("_binary_code_js_start");
-extern const uint8_t code_js_end[] asm("_binary_code_js_end");
-extern const uint8_t index_html_start[] asm("_binary_index_html_start");
-extern const uint8_t index_html_end[] asm("_binary_index_html_end");
+static esp_err_t http_app_add_route(httpd_method_t method, const char *path, http_app_match_t match, esp_err_t (*handler)(httpd_req_t *r), void *user_ctx, bool async){
 
+	if(path == NULL || handler == NULL || path[0] != '/'){
+		return ESP_ERR_INVALID_ARG;
+	}
 
-/* const httpd related values stored in ROM */
-const static char http_200_hdr[] = "200 OK";
-const static char http_302_hdr[] = "302 Found";
-const static char http_400_hdr[] = "400 Bad Request";
-const static char http_404_hdr[] = "404 Not Found";
-const static char http_503_hdr[] = "503 Service Unavailable";
-const static char http_location_hdr[] = "Location";
-const static char http_content_type_html[] = "text/html";
-const static char http_content_type_js[] = "text/javascript";
-const static char http_content_type_css[] = "text/css";
-const static char http_content_type_json[] = "application/json";
-const static char http_cache_control_hdr[] = "Cache-Control";
-const static char http_cache_control_no_cache[] = "no-store, no-cache, must-revalidate, max-age=0";
-const static char http_cache_control_cache[] = "public, max-age=31536000";
-const static char http_pragma_hdr[] = "Pragma";
-const static char http_pragma_no_cache[] = "no-cache";
+	size_t len = strlen(path);
+	if(match == HTTP_APP_MATCH_PREFIX && path[len - 1] != '/'){
+		return ESP_ERR_INVALID_ARG;
+	}
+#ifndef ESP32
+	if(match != HTTP_APP_MATCH_EXACT){
+		return ESP_ERR_NOT_SUPPORTED;
+	}
+#endif
+
+	uint32_t hash = http_app_hash(path, len);
+	esp_err_t err = ESP_OK;
+
+	HTTP_APP_REGISTRY_ENTER();
+	if(http_app_registry_find(hash, path, len, method, match) >= 0){
+		err = ESP_ERR_INVALID_STATE;
+	}
+	else if(http_app_registry_count >= HTTP_APP_MAX_ROUTES){
+		err = ESP_ERR_NO_MEM;
+	}
+	else{
+		int index = 0;
+		while(http_app_registry[index].handler != NULL){
+			index++;
+		}
+		/* removed slots are reused: with twice as many slots as routes there is always a free one */
+		uint32_t slot = hash & (HTTP_APP_REGISTRY_SLOTS - 1);
+		while(http_app_registry_slots[slot] > 0){
+			slot = (slot + 1) & (HTTP_APP_REGISTRY_SLOTS - 1);
+		}
+
+		http_app_registered_route_t *route = &http_app_registry[index];
+		memset(route, 0x00, sizeof(http_app_registered_route_t));
+		route->path = path;
+		route->len = len;
+		route->hash = hash;
+		route->handler = handler;
+		route->user_ctx = user_ctx;
+		route->method = method;
+		route->match = match;
+		route->async = async;
+		http_app_registry_slots[slot] = (int8_t)(index + 1);
+
+		http_app_registry_count++;
+		if(match == HTTP_APP_MATCH_PREFIX){
+			http_app_registry_prefixes++;
+		}
+	}
+	HTTP_APP_REGISTRY_EXIT();
+
+#ifndef ESP32
+	/* without wildcards the server must know every path. Routes registered before the server starts are added by http_app_start */
+	if(err == ESP_OK && httpd_handle != NULL){
+		http_app_register_uri_handler(httpd_handle, path, method);
+	}
+#endif
+
+	return err;
+}
+
+esp_err_t http_app_register_route(httpd_method_t method, const char *path, http_app_match_t match, esp_err_t (*handler)(httpd_req_t *r), void *user_ctx){
+	return http_app_add_route(method, path, match, handler, user_ctx, false);
+}
+
+esp_err_t http_app_register_async_route(httpd_method_t method, const char *path, http_app_match_t match, esp_err_t (*handler)(httpd_req_t *r), void *user_ctx){
+	return http_app_add_route(method, path, match, handler, user_ctx, true);
+}
+
+esp_err_t http_app_unregister_route(httpd_method_t method, const char *path, http_app_match_t match){
+
+	if(path == NULL){
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	size_t len = strlen(path);
+	esp_err_t err = ESP_ERR_NOT_FOUND;
+
+	HTTP_APP_REGISTRY_ENTER();
+	int slot = http_app_registry_find(http_app_hash(path, len), path, len, method, match);
+	if(slot >= 0){
+		http_app_registry[http_app_registry_slots[slot] - 1].handler = NULL;
+		http_app_registry_slots[slot] = -1;
+		http_app_registry_count--;
+		if(match == HTTP_APP_MATCH_PREFIX){
+			http_app_registry_prefixes--;
+		}
+		err = ESP_OK;
+	}
+	HTTP_APP_REGISTRY_EXIT();
 
+#ifndef ESP32
+	if(err == ESP_OK && httpd_handle != NULL){
+		httpd_unregister_uri_handler(httpd_handle, path, method);
+	}
+#endif
+
+	return err;
+}
+
+esp_err_t http_app_get_route_stats(httpd_method_t method, const char *path, http_app_match_t match, http_app_route_stats_t *stats){
+
+	if(path == NULL || stats == NULL){
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	size_t len = strlen(path);
+	esp_err_t err = ESP_ERR_NOT_FOUND;
+
+	HTTP_APP_REGISTRY_ENTER();
+	int slot = http_app_registry_find(http_app_hash(path, len), path, len, method, match);
+	if(slot >= 0){
+		*stats = http_app_registry[http_app_registry_slots[slot] - 1].stats;
+		err = ESP_OK;
+	}
+	HTTP_APP_REGISTRY_EXIT();
+
+	return err;
+}
 
 
 esp_err_t http_app_set_handler_hook( httpd_method_t method,  esp_err_t (*handler)(httpd_req_t *r)  ){
 
 	if(method == HTTP_GET){
+		custom_get_httpd_uri_handler = handler;
+		custom_get_hook_async = false;
+		return ESP_OK;
+	}
+	else if(method == HTTP_POST){
+		custom_post_httpd_uri_handler = handler;
+		custom_post_hook_async = false;
+		return ESP_OK;
+	}
+	else{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+}
+
+esp_err_t http_app_set_async_handler_hook( httpd_method_t method,  esp_err_t (*handler)(httpd_req_t *r)  ){
+
+	if(method == HTTP_GET){
+		custom_get_hook_async = true;
 		custom_get_httpd_uri_handler = handler;
 		return ESP_OK;
 	}
 	else if(method == HTTP_POST){
+		custom_post_hook_async = true;
 		custom_post_httpd_uri_handler = handler;
 		return ESP_OK;
 	}
@@ -119,20 +2338,23 @@ esp_err_t http_app_set_handler_hook( httpd_method_t method,  esp_err_t (*handler
 
 static esp_err_t http_server_delete_handler(httpd_req_t *req){
 
+	esp_err_t ret = ESP_OK;
+
 	ESP_LOGI(TAG, "DELETE %s", req->uri);
 
+	if(http_app_dispatch_route(req, &ret)){
+		return ret;
+	}
+
 	/* DELETE /connect.json */
-	if(strcmp(req->uri, http_connect_url) == 0){
+	if(http_app_route_lookup(req->uri) == HTTP_APP_ROUTE_CONNECT){
 		wifi_manager_disconnect_async();
 
-		httpd_resp_set_status(req, http_200_hdr);
-		httpd_resp_set_type(req, http_content_type_json);
-		httpd_resp_set_hdr(req, http_cache_control_hdr, http_cache_control_no_cache);
-		httpd_resp_set_hdr(req, http_pragma_hdr, http_pragma_no_cache);
+		http_app_set_response(req, &http_response_json);
 		httpd_resp_send(req, NULL, 0);
 	}
 	else{
-		httpd_resp_set_status(req, http_404_hdr);
+		http_app_set_response(req, &http_response_not_found);
 		httpd_resp_send(req, NULL, 0);
 	}
 
@@ -140,6 +2362,179 @@ static esp_err_t http_server_delete_handler(httpd_req_t *req){
 }
 
 
+int http_app_parse_json_body(httpd_req_t *req, char *buf, size_t buf_size, json_token_t *tokens, int num_tokens){
+
+	if(req->content_len == 0){
+		return JSON_ERROR_PART;
+	}
+	if(req->content_len >= buf_size){
+		return JSON_ERROR_NOMEM;
+	}
+
+	size_t received = 0;
+	int timeouts = 0;
+	while(received < req->content_len){
+		int ret = httpd_req_recv(req, buf + received, req->content_len - received);
+		if(ret == HTTPD_SOCK_ERR_TIMEOUT && ++timeouts < HTTP_APP_RECV_MAX_TIMEOUTS){
+			/* a client that stopped sending mid-body must not hold the http server forever */
+			continue;
+		}
+		if(ret <= 0){
+			return JSON_ERROR_PART;
+		}
+		timeouts = 0;
+		received += ret;
+	}
+	buf[received] = '\0';
+
+	return json_parse(buf, received, tokens, num_tokens);
+}
+
+/**
+ * @brief saves the credentials posted to connect.json and starts connecting to the access point.
+ * @param attempt receives the number of the connection attempt.
+ * @return false if they don't fit in the wifi config.
+ */
+static bool http_app_connect_sta(const char *ssid, const char *password, uint32_t *attempt){
+
+	size_t ssid_len = strlen(ssid);
+	size_t password_len = strlen(password);
+	if(ssid_len == 0 || ssid_len > MAX_SSID_SIZE || password_len > MAX_PASSWORD_SIZE){
+		return false;
+	}
+
+	wifi_config_t* config = wifi_manager_get_wifi_sta_config();
+	memset(config, 0x00, sizeof(wifi_config_t));
+	memcpy(config->sta.ssid, ssid, ssid_len);
+	memcpy(config->sta.password, password, password_len);
+
+	ESP_LOGI(TAG, "ssid: %s, password: %s", ssid, password);
+	ESP_LOGD(TAG, "http_server_post_handler: wifi_manager_connect_async() call");
+	*attempt = wifi_manager_connect_async();
+
+	return true;
+}
+
+/**
+ * @brief saves the broker settings posted to connect.json and connects to it. The uri "DISCONNECT" disconnects from the broker.
+ * @return false if they don't fit in the mqtt config.
+ */
+static bool http_app_connect_mqtt(const char *uri, const char *username, const char *password){
+
+	if(strcmp(uri, "DISCONNECT") == 0){
+		ESP_LOGI(TAG, "manual disconnect");
+		mqtt_manager_disconnect_async();
+		return true;
+	}
+
+	/* same bounds as the X-Custom- headers have always been checked against */
+	if(strlen(uri) == 0 || strlen(uri) > MQTT_MAX_HOST_LEN || strlen(username) > MQTT_MAX_USERNAME_LEN || strlen(password) > MQTT_MAX_PASSWORD_LEN){
+		return false;
+	}
+
+	mqtt_manager_set_uri(uri);
+	mqtt_manager_set_username(username);
+	mqtt_manager_set_password(password);
+	ESP_LOGI(TAG, "mqtt URI: '%s' username: '%s', password: '%s'", uri, username, password);
+	mqtt_manager_connect_async();
+
+	return true;
+}
+
+/**
+ * @brief POST /connect.json with a JSON body: {"ssid":"..","pwd":".."} or {"mqtt_uri":"..","mqtt_username":"..","mqtt_pwd":".."}
+ * Missing passwords and usernames are empty.
+ * @param attempt receives the number of the wifi connection attempt, if it is one.
+ * @return false if the body is not one of the above.
+ */
+static bool http_app_connect_json(httpd_req_t *req, uint32_t *attempt){
+
+	/* the body is parsed and unescaped in place: nothing is allocated */
+	char body[HTTP_APP_JSON_BODY_MAX];
+	json_token_t tokens[HTTP_APP_JSON_MAX_TOKENS];
+
+	int count = http_app_parse_json_body(req, body, sizeof(body), tokens, HTTP_APP_JSON_MAX_TOKENS);
+	if(count <= 0 || tokens[0].type != JSON_OBJECT){
+		ESP_LOGW(TAG, "connect.json: invalid body (%d)", count);
+		return false;
+	}
+
+	int ssid = json_object_get(body, tokens, count, 0, "ssid");
+	int pwd = json_object_get(body, tokens, count, 0, "pwd");
+	int mqtt_uri = json_object_get(body, tokens, count, 0, "mqtt_uri");
+	int mqtt_username = json_object_get(body, tokens, count, 0, "mqtt_username");
+	int mqtt_pwd = json_object_get(body, tokens, count, 0, "mqtt_pwd");
+
+	/* unescaping writes within the span of each string so the other tokens stay valid */
+	if(ssid >= 0){
+		const char *ssid_str = json_token_string(body, &tokens[ssid]);
+		const char *pwd_str = pwd >= 0 ? json_token_string(body, &tokens[pwd]) : "";
+		return ssid_str && pwd_str && http_app_connect_sta(ssid_str, pwd_str, attempt);
+	}
+	else if(mqtt_uri >= 0){
+		const char *uri_str = json_token_string(body, &tokens[mqtt_uri]);
+		const char *username_str = mqtt_username >= 0 ? json_token_string(body, &tokens[mqtt_username]) : "";
+		const char *pwd_str = mqtt_pwd >= 0 ? json_token_string(body, &tokens[mqtt_pwd]) : "";
+		return uri_str && username_str && pwd_str && http_app_connect_mqtt(uri_str, username_str, pwd_str);
+	}
+
+	return false;
+}
+
+/**
+ * @brief POST /connect.json with the settings in X-Custom- headers, the way the web app used to send them.
+ * Empty values were sent as "__EMPTY__" since headers can't be empty.
+ * @param attempt receives the number of the wifi connection attempt, if it is one.
+ * @return false if the headers are incomplete or too long.
+ */
+static bool http_app_connect_headers(httpd_req_t *req, uint32_t *attempt){
+
+	/* buffers for the headers. Their lengths are checked against these maximums before anything is copied so they can live on the stack */
+	size_t ssid_len = 0, password_len = 0, mqtt_uri_len = 0, mqtt_username_len = 0, mqtt_pwd_len = 0;
+	char ssid[MAX_SSID_SIZE + 1], password[MAX_PASSWORD_SIZE + 1];
+	char mqtt_uri[MQTT_MAX_HOST_LEN + 1], mqtt_username[MQTT_MAX_USERNAME_LEN + 1], mqtt_pwd[MQTT_MAX_PASSWORD_LEN + 1];
+
+	/* len of values provided */
+	ssid_len = httpd_req_get_hdr_value_len(req, "X-Custom-ssid");
+	password_len = httpd_req_get_hdr_value_len(req, "X-Custom-pwd");
+	mqtt_uri_len = httpd_req_get_hdr_value_len(req, "X-Custom-mqtt-uri");
+	mqtt_username_len = httpd_req_get_hdr_value_len(req, "X-Custom-mqtt-username");
+	mqtt_pwd_len = httpd_req_get_hdr_value_len(req, "X-Custom-mqtt-pwd");
+
+	ESP_LOGI(TAG,"lengths - ssid %d pwd %d uri %d username %d pwd %d", ssid_len, password_len, mqtt_uri_len,
+		mqtt_username_len, mqtt_pwd_len);
+
+	if(ssid_len && ssid_len <= MAX_SSID_SIZE &&
+		password_len && password_len <= MAX_PASSWORD_SIZE ) {
+
+		/* get the actual value of the headers */
+		httpd_req_get_hdr_value_str(req, "X-Custom-ssid", ssid, ssid_len+1);
+		httpd_req_get_hdr_value_str(req, "X-Custom-pwd", password, password_len+1);
+
+		return http_app_connect_sta(ssid, strcmp(password, "__EMPTY__") == 0 ? "" : password, attempt);
+	}
+	else if(mqtt_uri_len && mqtt_uri_len <= MQTT_MAX_HOST_LEN) {
+
+		httpd_req_get_hdr_value_str(req, "X-Custom-mqtt-uri", mqtt_uri, mqtt_uri_len+1);
+		if(strcmp(mqtt_uri, "DISCONNECT") == 0){
+			return http_app_connect_mqtt(mqtt_uri, "", "");
+		}
+
+		if(mqtt_username_len && mqtt_username_len <= MQTT_MAX_USERNAME_LEN &&
+			mqtt_pwd_len && mqtt_pwd_len <= MQTT_MAX_PASSWORD_LEN){
+
+			httpd_req_get_hdr_value_str(req, "X-Custom-mqtt-username", mqtt_username, mqtt_username_len+1);
+			httpd_req_get_hdr_value_str(req, "X-Custom-mqtt-pwd", mqtt_pwd, mqtt_pwd_len+1);
+
+			return http_app_connect_mqtt(mqtt_uri,
+					strcmp(mqtt_username, "__EMPTY__") == 0 ? "" : mqtt_username,
+					strcmp(mqtt_pwd, "__EMPTY__") == 0 ? "" : mqtt_pwd);
+		}
+	}
+
+	return false;
+}
+
 static esp_err_t http_server_post_handler(httpd_req_t *req){
 
 
@@ -147,102 +2542,27 @@ static esp_err_t http_server_post_handler(httpd_req_t *req){
 
 	ESP_LOGI(TAG, "POST %s", req->uri);
 
-	/* POST /connect.json */
-	if(strcmp(req->uri, http_connect_url) == 0){
-
-
-		/* buffers for the headers */
-		size_t ssid_len = 0, password_len = 0, mqtt_uri_len = 0, mqtt_username_len = 0, mqtt_pwd_len = 0;
-		char *ssid = NULL, *password = NULL, *mqtt_uri = NULL, *mqtt_username = NULL, *mqtt_pwd = NULL;
-
-		/* len of values provided */
-		ssid_len = httpd_req_get_hdr_value_len(req, "X-Custom-ssid");
-		password_len = httpd_req_get_hdr_value_len(req, "X-Custom-pwd");
-		mqtt_uri_len = httpd_req_get_hdr_value_len(req, "X-Custom-mqtt-uri");
-		mqtt_username_len = httpd_req_get_hdr_value_len(req, "X-Custom-mqtt-username");
-		mqtt_pwd_len = httpd_req_get_hdr_value_len(req, "X-Custom-mqtt-pwd");
-
-
-		ESP_LOGI(TAG,"lengths - ssid %d pwd %d uri %d username %d pwd %d", ssid_len, password_len, mqtt_uri_len, 
-			mqtt_username_len, mqtt_pwd_len);
-		if(ssid_len && ssid_len <= MAX_SSID_SIZE && 
-			password_len && password_len <= MAX_PASSWORD_SIZE ) {
-
-			/* get the actual value of the headers */
-			ssid = malloc(sizeof(char) * (ssid_len + 1));
-			password = malloc(sizeof(char) * (password_len + 1));
-			httpd_req_get_hdr_value_str(req, "X-Custom-ssid", ssid, ssid_len+1);
-			httpd_req_get_hdr_value_str(req, "X-Custom-pwd", password, password_len+1);
-
-			wifi_config_t* config = wifi_manager_get_wifi_sta_config();
-			memset(config, 0x00, sizeof(wifi_config_t));
-			memcpy(config->sta.ssid, ssid, ssid_len);
-			if (strcmp(password,"__EMPTY__")==0) {
-				// empty password
-				config->sta.password[0]=0;
-			} else {
-				memcpy(config->sta.password, password, password_len);
-			}
-			ESP_LOGI(TAG, "ssid: %s, password: %s", ssid, password);
-			ESP_LOGD(TAG, "http_server_post_handler: wifi_manager_connect_async() call");
-			wifi_manager_connect_async();
-
-			/* free memory */
-			free(ssid);
-			free(password);
-
-			httpd_resp_set_status(req, http_200_hdr);
-			httpd_resp_set_type(req, http_content_type_json);
-			httpd_resp_set_hdr(req, http_cache_control_hdr, http_cache_control_no_cache);
-			httpd_resp_set_hdr(req, http_pragma_hdr, http_pragma_no_cache);
-			httpd_resp_send(req, NULL, 0);
-
-		} else if  (mqtt_uri_len && mqtt_uri_len <= MQTT_MAX_HOST_LEN &&
-			mqtt_username_len && mqtt_username_len <= MQTT_MAX_USERNAME_LEN &&
-			mqtt_pwd_len && mqtt_pwd_len <= MQTT_MAX_PASSWORD_LEN ){
-		
-			mqtt_uri = malloc(sizeof(char) * (mqtt_uri_len + 1));
-			httpd_req_get_hdr_value_str(req, "X-Custom-mqtt-uri", mqtt_uri, mqtt_uri_len+1);
-			if (strcmp(mqtt_uri,"DISCONNECT")==0) {
-				free(mqtt_uri);
-				ESP_LOGI(TAG, "manual disconnect");
-				mqtt_manager_disconnect_async();
-			} else {
-
-				mqtt_username = malloc(sizeof(char) * (mqtt_username_len + 1));
-				mqtt_pwd = malloc(sizeof(char) * (mqtt_pwd_len + 1));
-				httpd_req_get_hdr_value_str(req, "X-Custom-mqtt-username", mqtt_username, mqtt_username_len+1);
-				httpd_req_get_hdr_value_str(req, "X-Custom-mqtt-pwd", mqtt_pwd, mqtt_pwd_len+1);
-
-				mqtt_manager_set_uri(mqtt_uri);
-				if (strcmp(mqtt_username,"__EMPTY__")==0) {
-					// empty user name
-					mqtt_manager_set_username("");
-				} else {
-					mqtt_manager_set_username(mqtt_username);
-				}
-				if (strcmp(mqtt_pwd,"__EMPTY__")==0) {
-					mqtt_manager_set_password("");
-				} else {
-					mqtt_manager_set_password(mqtt_pwd);
-				}
-				ESP_LOGI(TAG, "mqtt URI: '%s' username: '%s', password: '%s'", mqtt_uri, mqtt_username, mqtt_pwd);
-				mqtt_manager_connect_async();
+	if(http_app_dispatch_route(req, &ret)){
+		return ret;
+	}
 
-				free(mqtt_uri);
-				free(mqtt_username);
-				free(mqtt_pwd);
+	/* POST /connect.json */
+	if(http_app_route_lookup(req->uri) == HTTP_APP_ROUTE_CONNECT){
 
-			}
+		/* the web app posts a JSON body. Older clients send the settings in headers and no body */
+		uint32_t attempt = 0;
+		bool ok = req->content_len > 0 ? http_app_connect_json(req, &attempt) : http_app_connect_headers(req, &attempt);
 
-			httpd_resp_set_status(req, http_200_hdr);
-			httpd_resp_set_type(req, http_content_type_json);
-			httpd_resp_set_hdr(req, http_cache_control_hdr, http_cache_control_no_cache);
-			httpd_resp_set_hdr(req, http_pragma_hdr, http_pragma_no_cache);
+		if(ok && attempt != 0 && http_app_wait_connect(req, attempt)){
+			/* answered once the wifi connection attempt resolves */
+		}
+		else if(ok){
+			http_app_set_response(req, &http_response_json);
 			httpd_resp_send(req, NULL, 0);
-		} else {
-			/* bad request the authentification header is not complete/not the correct format */
-			httpd_resp_set_status(req, http_400_hdr);
+		}
+		else{
+			/* bad request: the settings are incomplete or not in the correct format */
+			http_app_set_response(req, &http_response_bad_request);
 			httpd_resp_send(req, NULL, 0);
 		}
 
@@ -250,13 +2570,13 @@ static esp_err_t http_server_post_handler(httpd_req_t *req){
 	else{
 
 		if(custom_post_httpd_uri_handler == NULL){
-			httpd_resp_set_status(req, http_404_hdr);
+			http_app_set_response(req, &http_response_not_found);
 			httpd_resp_send(req, NULL, 0);
 		}
 		else{
 
 			/* if there's a hook, run it */
-			ret = (*custom_post_httpd_uri_handler)(req);
+			ret = http_app_run_handler(req, custom_post_httpd_uri_handler, req->user_ctx, -1, custom_post_hook_async);
 		}
 	}
 
@@ -266,152 +2586,130 @@ static esp_err_t http_server_post_handler(httpd_req_t *req){
 
 static esp_err_t http_server_get_handler(httpd_req_t *req){
 
-    char* host = NULL;
-    size_t buf_len;
-    esp_err_t ret = ESP_OK;
+	esp_err_t ret = ESP_OK;
 
-    ESP_LOGD(TAG, "GET %s", req->uri);
+	char host[HTTP_APP_HOST_MAX];
 
-    /* Get header value string length and allocate memory for length + 1,
-     * extra byte for null termination */
-    buf_len = httpd_req_get_hdr_value_len(req, "Host") + 1;
-    if (buf_len > 1) {
-    	host = malloc(buf_len);
-    	if(httpd_req_get_hdr_value_str(req, "Host", host, buf_len) != ESP_OK){
-    		/* if something is wrong we just 0 the whole memory */
-    		memset(host, 0x00, buf_len);
-    	}
-    }
+	ESP_LOGD(TAG, "GET %s", req->uri);
 
-	/* determine if Host is from the STA IP address */
-	wifi_manager_lock_sta_ip_string(portMAX_DELAY);
-	bool access_from_sta_ip = host != NULL?strstr(host, wifi_manager_get_sta_ip_string()):false;
-	wifi_manager_unlock_sta_ip_string();
+	if(!http_app_host_is_local(req, host)){
 
+		/* Captive Portal functionality: the probes of the OSes get the answer that opens their portal window fastest,
+		 * anything else a 302 Redirect to IP of the access point */
+		if(!http_app_answer_probe(req, host)){
+			http_app_set_response(req, &http_response_redirect);
+			httpd_resp_send(req, NULL, 0);
+		}
+		return ESP_OK;
+	}
 
-	if (host != NULL && !strstr(host, DEFAULT_AP_IP) && !access_from_sta_ip) {
+	if(http_app_dispatch_route(req, &ret)){
+		return ret;
+	}
 
-		/* Captive Portal functionality */
-		/* 302 Redirect to IP of the access point */
-		httpd_resp_set_status(req, http_302_hdr);
-		httpd_resp_set_hdr(req, http_location_hdr, http_redirect_url);
-		httpd_resp_send(req, NULL, 0);
+	switch(http_app_route_lookup(req->uri)){
+
+	/* GET /  */
+	case HTTP_APP_ROUTE_ROOT:
+		http_app_send_prerendered(req);
+		break;
+
+	/* GET /code.js */
+	case HTTP_APP_ROUTE_JS:
+		http_app_send_asset(req, &http_app_code_js);
+		break;
+
+	/* GET /style.css */
+	case HTTP_APP_ROUTE_CSS:
+		http_app_send_asset(req, &http_app_style_css);
+		break;
+
+	/* GET /ap.json */
+	case HTTP_APP_ROUTE_AP:{
+
+		/* the last version of the AP list is pinned rather than locked: a slow client never holds up the next scan.
+		 * The list doesn't exist until a first scan was requested. */
+		const wifi_manager_ap_list_t *list = wifi_manager_pin_ap_list();
+		char query[HTTP_APP_QUERY_MAX];
+		bool has_query = httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK;
+		http_app_send_ap_list(req, list, http_app_query_version(has_query ? query : NULL, "since"));
+		wifi_manager_unpin_ap_list(list);
+
+		/* request a wifi scan */
+		wifi_manager_scan_async();
+		break;
+	}
+
+	/* GET /status.json */
+	case HTTP_APP_ROUTE_STATUS:{
 
+		size_t cbor_len;
+		const char *buff = wifi_manager_pin_ip_info_json();
+		const uint8_t *cbor = wifi_manager_get_pinned_cbor(buff, &cbor_len);
+		http_app_send_document(req, buff ? buff : "{}\n", cbor, cbor_len, wifi_manager_get_pinned_version(buff));
+		wifi_manager_unpin_json(buff);
+		break;
 	}
-	else{
 
-		/* GET /  */
-		if(strcmp(req->uri, http_root_url) == 0){
-			httpd_resp_set_status(req, http_200_hdr);
-			httpd_resp_set_type(req, http_content_type_html);
-			httpd_resp_send(req, (char*)index_html_start, index_html_end - index_html_start);
-		}
-		/* GET /code.js */
-		else if(strcmp(req->uri, http_js_url) == 0){
-			httpd_resp_set_status(req, http_200_hdr);
-			httpd_resp_set_type(req, http_content_type_js);
-			httpd_resp_send(req, (char*)code_js_start, code_js_end - code_js_start);
-		}
-		/* GET /style.css */
-		else if(strcmp(req->uri, http_css_url) == 0){
-			httpd_resp_set_status(req, http_200_hdr);
-			httpd_resp_set_type(req, http_content_type_css);
-			httpd_resp_set_hdr(req, http_cache_control_hdr, http_cache_control_cache);
-			httpd_resp_send(req, (char*)style_css_start, style_css_end - style_css_start);
-		}
-		/* GET /ap.json */
-		else if(strcmp(req->uri, http_ap_url) == 0){
-
-			/* if we can get the mutex, write the last version of the AP list */
-			if(wifi_manager_lock_json_buffer(( TickType_t ) 10)){
-
-				httpd_resp_set_status(req, http_200_hdr);
-				httpd_resp_set_type(req, http_content_type_json);
-				httpd_resp_set_hdr(req, http_cache_control_hdr, http_cache_control_no_cache);
-				httpd_resp_set_hdr(req, http_pragma_hdr, http_pragma_no_cache);
-				char* ap_buf = wifi_manager_get_ap_list_json();
-				httpd_resp_send(req, ap_buf, strlen(ap_buf));
-				wifi_manager_unlock_json_buffer();
-			}
-			else{
-				httpd_resp_set_status(req, http_503_hdr);
-				httpd_resp_send(req, NULL, 0);
-				ESP_LOGE(TAG, "http_server_netconn_serve: GET /ap.json failed to obtain mutex");
-			}
+	/* GET /mqtt_status.json */
+	case HTTP_APP_ROUTE_MQTT_STATUS:{
 
-			/* request a wifi scan */
-			wifi_manager_scan_async();
-		}
-		/* GET /status.json */
-		else if(strcmp(req->uri, http_status_url) == 0){
-
-			if(wifi_manager_lock_json_buffer(( TickType_t ) 10)){
-				char *buff = wifi_manager_get_ip_info_json();
-				if(buff){
-					httpd_resp_set_status(req, http_200_hdr);
-					httpd_resp_set_type(req, http_content_type_json);
-					httpd_resp_set_hdr(req, http_cache_control_hdr, http_cache_control_no_cache);
-					httpd_resp_set_hdr(req, http_pragma_hdr, http_pragma_no_cache);
-					httpd_resp_send(req, buff, strlen(buff));
-					wifi_manager_unlock_json_buffer();
-				}
-				else{
-					httpd_resp_set_status(req, http_503_hdr);
-					httpd_resp_send(req, NULL, 0);
-				}
-			}
-			else{
-				httpd_resp_set_status(req, http_503_hdr);
-				httpd_resp_send(req, NULL, 0);
-				ESP_LOGE(TAG, "http_server_netconn_serve: GET /status.json failed to obtain mutex");
-			}
-		}
-		/* GET /mqtt_status.json */
-		else if(strcmp(req->uri, http_mqtt_status_url) == 0){
-
-			if(mqtt_manager_lock_json_buffer(( TickType_t ) 10)){
-				char *buff = mqtt_manager_get_info_json();
-				if(buff){
-					httpd_resp_set_status(req, http_200_hdr);
-					httpd_resp_set_type(req, http_content_type_json);
-					httpd_resp_set_hdr(req, http_cache_control_hdr, http_cache_control_no_cache);
-					httpd_resp_set_hdr(req, http_pragma_hdr, http_pragma_no_cache);
-					httpd_resp_send(req, buff, strlen(buff));
-					mqtt_manager_unlock_json_buffer();
-				}
-				else{
-					httpd_resp_set_status(req, http_503_hdr);
-					httpd_resp_send(req, NULL, 0);
-				}
-			}
-			else{
-				httpd_resp_set_status(req, http_503_hdr);
-				httpd_resp_send(req, NULL, 0);
-				ESP_LOGE(TAG, "http_server_netconn_serve: GET /mqtt_status.json failed to obtain mutex");
-			}
-		}
-		else{
+		size_t cbor_len;
+		const char *buff = mqtt_manager_pin_info_json();
+		const uint8_t *cbor = mqtt_manager_get_pinned_info_cbor(buff, &cbor_len);
+		http_app_send_document(req, buff ? buff : "{}\n", cbor, cbor_len, mqtt_manager_get_pinned_info_version(buff));
+		mqtt_manager_unpin_info_json(buff);
+		break;
+	}
 
-			if(custom_get_httpd_uri_handler == NULL){
-				httpd_resp_set_status(req, http_404_hdr);
-				httpd_resp_send(req, NULL, 0);
-			}
-			else{
+	/* GET /state.json */
+	case HTTP_APP_ROUTE_STATE:
+		http_app_send_state(req);
+		break;
 
-				/* if there's a hook, run it */
-				ret = (*custom_get_httpd_uri_handler)(req);
-			}
+	/* GET /events */
+	case HTTP_APP_ROUTE_EVENTS:
+		http_app_open_event_stream(req);
+		break;
+
+	/* GET /captive.json */
+	case HTTP_APP_ROUTE_CAPTIVE:
+		http_app_send_captive(req);
+		break;
+
+	default:
+
+		if(custom_get_httpd_uri_handler == NULL){
+			http_app_set_response(req, &http_response_not_found);
+			httpd_resp_send(req, NULL, 0);
 		}
+		else{
 
+			/* if there's a hook, run it */
+			ret = http_app_run_handler(req, custom_get_httpd_uri_handler, req->user_ctx, -1, custom_get_hook_async);
+		}
+		break;
 	}
 
-    /* memory clean up */
-    if(host != NULL){
-    	free(host);
-    }
+	return ret;
+
+}
+
+/**
+ * @brief handler of the methods the wifi manager doesn't serve itself: only registered routes answer them.
+ */
+static esp_err_t http_server_route_handler(httpd_req_t *req){
 
-    return ret;
+	esp_err_t ret = ESP_OK;
+
+	ESP_LOGD(TAG, "%d %s", (int)req->method, req->uri);
+
+	if(!http_app_dispatch_route(req, &ret)){
+		http_app_set_response(req, &http_response_not_found);
+		httpd_resp_send(req, NULL, 0);
+	}
 
+	return ret;
 }
 
 #ifdef ESP32
@@ -434,6 +2732,13 @@ static const httpd_uri_t http_server_delete_request = {
 	.method = HTTP_DELETE,
 	.handler = http_server_delete_handler
 };
+
+/* other methods can only reach registered routes */
+static const httpd_uri_t http_server_route_requests[] = {
+	{ .uri = "*", .method = HTTP_PUT, .handler = http_server_route_handler },
+	{ .uri = "*", .method = HTTP_PATCH, .handler = http_server_route_handler },
+	{ .uri = "*", .method = HTTP_OPTIONS, .handler = http_server_route_handler }
+};
 #else
 
 // We need additional HTTP_GET for http://10.10.0.1/  since ESP8266 RTOS SDK doesn't have wildcard config.uri_match_fn
@@ -449,67 +2754,30 @@ void http_app_stop(){
 
 	if(httpd_handle != NULL){
 
-
-		/* dealloc URLs */
-		if(http_root_url) {
-			free(http_root_url);
-			http_root_url = NULL;
-		}
-		if(http_redirect_url){
-			free(http_redirect_url);
-			http_redirect_url = NULL;
-		}
-		if(http_js_url){
-			free(http_js_url);
-			http_js_url = NULL;
-		}
-		if(http_css_url){
-			free(http_css_url);
-			http_css_url = NULL;
+#if HTTP_APP_ASYNC_ENABLED
+		/* freeing the server under a running handler would be a use after free: better keep it */
+		if(!http_app_async_stop()){
+			ESP_LOGE(TAG, "the http server is kept running");
+			return;
 		}
-		if(http_connect_url){
-			free(http_connect_url);
-			http_connect_url = NULL;
-		}
-		if(http_ap_url){
-			free(http_ap_url);
-			http_ap_url = NULL;
-		}
-		if(http_status_url){
-			free(http_status_url);
-			http_status_url = NULL;
-		}
-		if(http_mqtt_status_url){
-			free(http_mqtt_status_url);
-			http_mqtt_status_url = NULL;
+#endif
+
+#if HTTP_APP_EVENTS_ENABLED
+		if(!http_app_events_stop()){
+#if HTTP_APP_ASYNC_ENABLED
+			http_app_async_closing = false;
+#endif
+			ESP_LOGE(TAG, "the http server is kept running");
+			return;
 		}
+#endif
 
-		/* stop server */
 		httpd_stop(httpd_handle);
 		httpd_handle = NULL;
 	}
 }
 
 
-/**
- * @brief helper to generate URLs of the wifi manager
- */
-static char* http_app_generate_url(const char* page){
-
-	char* ret;
-
-	int root_len = strlen(WEBAPP_LOCATION);
-	const size_t url_sz = sizeof(char) * ( (root_len+1) + ( strlen(page) + 1) );
-
-	ret = malloc(url_sz);
-	memset(ret, 0x00, url_sz);
-	strcpy(ret, WEBAPP_LOCATION);
-	ret = strcat(ret, page);
-
-	return ret;
-}
-
-
 /**
  * @brief helper to register request handler for a specific URL
  */
@@ -524,12 +2792,27 @@ static void http_app_register_uri_handler(httpd_handle_t handle, const char * ur
 		req.handler = http_server_post_handler;
 	} else if (method == HTTP_DELETE) {
 		req.handler = http_server_delete_handler;
+	} else {
+		req.handler = http_server_route_handler;
 	}
 	httpd_register_uri_handler( handle, &req );
 	ESP_LOGI(TAG,"Registered URL %s", url);
 }
 #endif
 
+/**
+ * @brief called by the http server for every new socket.
+ * Sessions are refused while the memory governor is at MEM_PRESSURE_REFUSE_SESSIONS or above:
+ * each open session costs a socket and its receive buffers, which is exactly what can't be spared then.
+ */
+static esp_err_t http_app_open_fn(httpd_handle_t hd, int sockfd){
+	if(mem_governor_get_level() >= MEM_PRESSURE_REFUSE_SESSIONS){
+		ESP_LOGW(TAG, "Refusing http session on socket %d: low memory", sockfd);
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
 void http_app_start(bool lru_purge_enable){
 
 	esp_err_t err;
@@ -544,49 +2827,33 @@ void http_app_start(bool lru_purge_enable){
 		config.uri_match_fn = httpd_uri_match_wildcard;
 #else
 		// increase max number of URI handlers 
-		config.max_uri_handlers = 16;		
+		config.max_uri_handlers = 16 + HTTP_APP_PROBE_COUNT;
 #endif
 
 		config.lru_purge_enable = lru_purge_enable;
 
-		/* generate the URLs */
-		if(http_root_url == NULL){
-			int root_len = strlen(WEBAPP_LOCATION);
-
-			/* all the pages */
-			const char page_js[] = "code.js";
-			const char page_css[] = "style.css";
-			const char page_connect[] = "connect.json";
-			const char page_ap[] = "ap.json";
-			const char page_status[] = "status.json";
-			const char page_mqtt_status[] = "mqtt_status.json";
-
-			/* root url, eg "/"   */
-			const size_t http_root_url_sz = sizeof(char) * (root_len+1);
-			http_root_url = malloc(http_root_url_sz);
-			memset(http_root_url, 0x00, http_root_url_sz);
-			strcpy(http_root_url, WEBAPP_LOCATION);
-
-			/* redirect url */
-			size_t redirect_sz = 22 + root_len + 1; /* strlen(http://255.255.255.255) + strlen("/") + 1 for \0 */
-			http_redirect_url = malloc(sizeof(char) * redirect_sz);
-			*http_redirect_url = '\0';
-
-			if(root_len == 1){
-				snprintf(http_redirect_url, redirect_sz, "http://%s", DEFAULT_AP_IP);
-			}
-			else{
-				snprintf(http_redirect_url, redirect_sz, "http://%s%s", DEFAULT_AP_IP, WEBAPP_LOCATION);
-			}
+		/* task placement */
+		wifi_manager_task_config_t task_config = wifi_manager_get_task_config(WM_TASK_HTTPD);
+		config.task_priority = task_config.priority;
+		config.stack_size = task_config.stack_size;
+#ifdef ESP32
+		config.core_id = task_config.core_id < 0 ? tskNO_AFFINITY : task_config.core_id;
+#endif
+		config.open_fn = http_app_open_fn;
 
-			/* generate the other pages URLs*/
-			http_js_url = http_app_generate_url(page_js);
-			http_css_url = http_app_generate_url(page_css);
-			http_connect_url = http_app_generate_url(page_connect);
-			http_ap_url = http_app_generate_url(page_ap);
-			http_status_url = http_app_generate_url(page_status);
-			http_mqtt_status_url = http_app_generate_url(page_mqtt_status);
-		}
+		/* the route table and the address of the access point never change: they are only worked out once */
+		http_app_build_routes();
+		http_app_hash_asset(&http_app_index_html);
+		http_app_find_state_slot();
+		http_app_hash_asset(&http_app_code_js);
+		http_app_hash_asset(&http_app_style_css);
+
+#if HTTP_APP_ASYNC_ENABLED
+		http_app_async_start();
+#endif
+#if HTTP_APP_EVENTS_ENABLED
+		http_app_events_start();
+#endif
 
 		err = httpd_start(&httpd_handle, &config);
 
@@ -596,17 +2863,37 @@ void http_app_start(bool lru_purge_enable){
 	        httpd_register_uri_handler(httpd_handle, &http_server_get_request);
 	        httpd_register_uri_handler(httpd_handle, &http_server_post_request);
 	        httpd_register_uri_handler(httpd_handle, &http_server_delete_request);
+	        for(int i=0; i<sizeof(http_server_route_requests)/sizeof(http_server_route_requests[0]); i++){
+	        	httpd_register_uri_handler(httpd_handle, &http_server_route_requests[i]);
+	        }
 #else
 	        // Register all the documents separately for ESP8266
 	        httpd_register_uri_handler(httpd_handle, &http_server_get_request_root);
-	        http_app_register_uri_handler(httpd_handle, http_js_url, HTTP_GET);
-	        http_app_register_uri_handler(httpd_handle, http_js_url, HTTP_POST);
-	        http_app_register_uri_handler(httpd_handle, http_css_url, HTTP_GET);
-	        http_app_register_uri_handler(httpd_handle, http_connect_url, HTTP_POST);
-	        http_app_register_uri_handler(httpd_handle, http_connect_url, HTTP_DELETE);
-	        http_app_register_uri_handler(httpd_handle, http_ap_url, HTTP_GET);
-	        http_app_register_uri_handler(httpd_handle, http_status_url, HTTP_GET);
-	        http_app_register_uri_handler(httpd_handle, http_mqtt_status_url, HTTP_GET);
+	        http_app_register_uri_handler(httpd_handle, http_app_pages[HTTP_APP_ROUTE_JS].url, HTTP_GET);
+	        http_app_register_uri_handler(httpd_handle, http_app_pages[HTTP_APP_ROUTE_JS].url, HTTP_POST);
+	        http_app_register_uri_handler(httpd_handle, http_app_pages[HTTP_APP_ROUTE_CSS].url, HTTP_GET);
+	        http_app_register_uri_handler(httpd_handle, http_app_pages[HTTP_APP_ROUTE_CONNECT].url, HTTP_POST);
+	        http_app_register_uri_handler(httpd_handle, http_app_pages[HTTP_APP_ROUTE_CONNECT].url, HTTP_DELETE);
+	        http_app_register_uri_handler(httpd_handle, http_app_pages[HTTP_APP_ROUTE_AP].url, HTTP_GET);
+	        http_app_register_uri_handler(httpd_handle, http_app_pages[HTTP_APP_ROUTE_STATUS].url, HTTP_GET);
+	        http_app_register_uri_handler(httpd_handle, http_app_pages[HTTP_APP_ROUTE_MQTT_STATUS].url, HTTP_GET);
+	        http_app_register_uri_handler(httpd_handle, http_app_pages[HTTP_APP_ROUTE_STATE].url, HTTP_GET);
+	        http_app_register_uri_handler(httpd_handle, http_app_pages[HTTP_APP_ROUTE_EVENTS].url, HTTP_GET);
+	        http_app_register_uri_handler(httpd_handle, http_app_pages[HTTP_APP_ROUTE_CAPTIVE].url, HTTP_GET);
+
+	        /* the paths of the probes, "/" is the root */
+	        for(int i=0; i<HTTP_APP_PROBE_COUNT; i++){
+	        	if(http_app_probes[i].len > 1){
+	        		http_app_register_uri_handler(httpd_handle, http_app_probes[i].path, HTTP_GET);
+	        	}
+	        }
+
+	        /* and the routes the application registered so far */
+	        for(int i=0; i<HTTP_APP_MAX_ROUTES; i++){
+	        	if(http_app_registry[i].handler != NULL){
+	        		http_app_register_uri_handler(httpd_handle, http_app_registry[i].path, http_app_registry[i].method);
+	        	}
+	        }
 #endif
 	    }
 	}
@@ -35,8 +35,11 @@ function to process requests, decode URLs, serve files, etc. etc.
 #define HTTP_APP_H_INCLUDED
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <esp_http_server.h>
 
+#include "json.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -48,6 +51,124 @@ extern "C" {
  */
 #define WEBAPP_LOCATION 					CONFIG_WEBAPP_LOCATION
 
+/** @brief URL of the captive portal API (RFC 8908), handed to the clients of the access point in DHCP option 114 */
+#define HTTP_APP_CAPTIVE_API_URL			"http://" DEFAULT_AP_IP WEBAPP_LOCATION "captive.json"
+
+/** @brief Size of the buffer the captive portal API document is written into, besides the length of the portal url */
+#define HTTP_APP_CAPTIVE_JSON_MAX			160
+
+/** @brief Maximum size in bytes of a JSON request body, such as the one posted to connect.json. It is read on the stack of the http server. */
+#define HTTP_APP_JSON_BODY_MAX				512
+
+/** @brief Number of tokens used to parse a JSON request body. connect.json needs at most 7 */
+#define HTTP_APP_JSON_MAX_TOKENS			16
+
+/** @brief Number of consecutive receive timeouts after which a request body is given up. Each timeout lasts recv_wait_timeout seconds of the httpd config */
+#define HTTP_APP_RECV_MAX_TIMEOUTS			3
+
+/** @brief Size in bytes of the chunks the list of access points is streamed in. They are built on the stack of the http server */
+#define HTTP_APP_CHUNK_SIZE					512
+
+/** @brief Size in bytes of the blocks the state inlined in index.html is sent in. They are gathered in a static buffer used by the http server task only */
+#define HTTP_APP_PRERENDER_BLOCK_SIZE		512
+
+/** @brief Largest json of one access point: JSON_ONE_APP_SIZE only allows for 2 byte escapes, an SSID of control characters takes 6 bytes per character */
+#define HTTP_APP_AP_JSON_MAX				(JSON_ONE_APP_SIZE + 5 * 32)
+
+/** @brief Size of the buffer the Accept header is read into to look for application/cbor. Longer headers, such as the ones of browsers, are truncated */
+#define HTTP_APP_ACCEPT_MAX					64
+
+/** @brief Size of the buffer the query string of /state.json is read into: three versions of 10 digits and the scan request fit */
+#define HTTP_APP_QUERY_MAX					64
+
+/** @brief Size of the buffer the Host header is read into. An IPv4 address with a port takes at most 21 bytes, longer hosts are never local */
+#define HTTP_APP_HOST_MAX					32
+
+/** @brief Size of an ETag, quotes and terminator included: W/"0123abcd" for the assets, "0123abcd" or "0123abcdc" for the json documents and their CBOR encoding */
+#define HTTP_APP_ETAG_SIZE					16
+
+/** @brief Size of the buffer the If-None-Match header is read into. Clients send back the one ETag they got */
+#define HTTP_APP_IF_NONE_MATCH_MAX			64
+
+/** @brief Number of slots of the table the URLs of the web app are looked up in. A power of two, at least twice the number of pages */
+#define HTTP_APP_ROUTE_SLOTS				32
+
+/** @brief Maximum number of routes applications can register with http_app_register_route */
+#define HTTP_APP_MAX_ROUTES					16
+
+/** @brief Number of slots of the table registered routes are looked up in. A power of two, at least twice HTTP_APP_MAX_ROUTES */
+#define HTTP_APP_REGISTRY_SLOTS				32
+
+/** @brief Number of workers running async handlers, and number of async requests that can wait for one before new ones get 503 */
+#ifdef CONFIG_WIFI_MANAGER_HTTPD_ASYNC_QUEUE
+#define HTTP_APP_ASYNC_WORKERS				CONFIG_WIFI_MANAGER_HTTPD_ASYNC_WORKERS
+#define HTTP_APP_ASYNC_QUEUE_LENGTH			CONFIG_WIFI_MANAGER_HTTPD_ASYNC_QUEUE
+#else
+#define HTTP_APP_ASYNC_WORKERS				0
+#define HTTP_APP_ASYNC_QUEUE_LENGTH			1
+#endif
+
+/** @brief Longest time in ms http_app_stop waits for the async handlers still running. Past that the server is left running */
+#define HTTP_APP_ASYNC_STOP_TIMEOUT_MS		10000
+
+/** @brief Maximum number of /events streams open at once. Each one holds a socket of the http server */
+#ifdef CONFIG_WIFI_MANAGER_HTTPD_EVENT_STREAMS
+#define HTTP_APP_MAX_EVENT_STREAMS			CONFIG_WIFI_MANAGER_HTTPD_EVENT_STREAMS
+#else
+#define HTTP_APP_MAX_EVENT_STREAMS			0
+#endif
+
+/** @brief Number of POST /connect.json?wait= that can be held at once, and longest wait in seconds. They are held by the task writing the /events streams */
+#define HTTP_APP_MAX_CONNECT_WAITS			2
+#define HTTP_APP_CONNECT_WAIT_MAX			30
+
+/** @brief Number of events a stream can have pending. Past that the stream stops queuing and checks every part once its client catches up */
+#define HTTP_APP_EVENT_QUEUE_LENGTH			4
+
+/** @brief Period in ms at which open streams get a keepalive and are checked for missed changes */
+#define HTTP_APP_EVENT_PERIOD_MS			4000
+
+/** @brief Longest time in ms http_app_stop waits for the events task to release the streams. A pass in progress can be blocked
+ * on a stalled client for the send timeout of the server (5 s by default) */
+#define HTTP_APP_EVENTS_STOP_TIMEOUT_MS		10000
+
+
+/**
+ * @brief How the path of a registered route is matched against the path of a request. The query string is never part of the match.
+ */
+typedef enum http_app_match_t{
+	HTTP_APP_MATCH_EXACT = 0,		/* the path of the request is the path of the route */
+	HTTP_APP_MATCH_PREFIX = 1		/* the path of the request starts with the path of the route, which ends with '/'. The longest prefix wins */
+}http_app_match_t;
+
+/**
+ * @brief Parts of the state pushed on /events, named like the keys of the query string of /state.json.
+ */
+typedef enum http_app_event_t{
+	HTTP_APP_EVENT_WIFI = 0,		/* the wifi status changed */
+	HTTP_APP_EVENT_MQTT = 1,		/* the mqtt status changed */
+	HTTP_APP_EVENT_SCAN = 2,		/* a scan completed */
+	HTTP_APP_EVENT_COUNT = 3
+}http_app_event_t;
+
+/**
+ * @brief Counters of a registered route. Latencies are the time spent in its handler.
+ */
+typedef struct{
+	uint32_t hits;
+	uint32_t max_us;
+	uint64_t total_us;
+}http_app_route_stats_t;
+
+/**
+ * @brief Counter of a connectivity check of an OS, answered by the captive portal on its own.
+ */
+typedef struct{
+	const char *host;		/* NULL: the probe is recognised by its path on any host */
+	const char *path;
+	uint32_t hits;
+}http_app_probe_stats_t;
+
 
 /** 
  * @brief spawns the http server 
@@ -65,6 +186,65 @@ void http_app_stop();
  */
 esp_err_t http_app_set_handler_hook( httpd_method_t method,  esp_err_t (*handler)(httpd_req_t *r)  );
 
+/**
+ * @brief Same as http_app_set_handler_hook, but the hook runs on the async workers.
+ * @see http_app_register_async_route
+ */
+esp_err_t http_app_set_async_handler_hook( httpd_method_t method,  esp_err_t (*handler)(httpd_req_t *r)  );
+
+/**
+ * @brief Registers a handler for the requests of one method to a path, or to every path under a prefix.
+ * Registered routes are looked up in constant time, after the captive portal redirect of GET requests and before the pages of the wifi manager
+ * and the hooks of http_app_set_handler_hook. The handler finds user_ctx in req->user_ctx.
+ * @param path kept as is, not copied: it must stay valid until the route is unregistered. A string literal is fine.
+ * @note On the ESP8266 the server can't match wildcards: only HTTP_APP_MATCH_EXACT routes are supported.
+ * @return ESP_OK, ESP_ERR_INVALID_ARG if a prefix doesn't end with '/', ESP_ERR_INVALID_STATE if the route already exists,
+ * ESP_ERR_NO_MEM if HTTP_APP_MAX_ROUTES are registered or ESP_ERR_NOT_SUPPORTED.
+ */
+esp_err_t http_app_register_route(httpd_method_t method, const char *path, http_app_match_t match, esp_err_t (*handler)(httpd_req_t *r), void *user_ctx);
+
+/**
+ * @brief Same as http_app_register_route, but the handler runs on one of HTTP_APP_ASYNC_WORKERS workers instead of the http server task.
+ * Use it for handlers that take time, such as the ones reading a sensor or writing flash: the portal keeps answering meanwhile.
+ * When all the workers are busy and HTTP_APP_ASYNC_QUEUE_LENGTH requests wait for them, the route answers 503.
+ * Its latency counters measure the time spent in the handler, not in the queue.
+ * @note Without async support (esp-idf older than 5.1, ESP8266 or no workers) the handler runs on the server task.
+ */
+esp_err_t http_app_register_async_route(httpd_method_t method, const char *path, http_app_match_t match, esp_err_t (*handler)(httpd_req_t *r), void *user_ctx);
+
+/**
+ * @brief Unregisters a route registered with http_app_register_route or http_app_register_async_route.
+ * @return ESP_OK or ESP_ERR_NOT_FOUND.
+ */
+esp_err_t http_app_unregister_route(httpd_method_t method, const char *path, http_app_match_t match);
+
+/**
+ * @brief Copies the hit and latency counters of a registered route.
+ * @return ESP_OK or ESP_ERR_NOT_FOUND.
+ */
+esp_err_t http_app_get_route_stats(httpd_method_t method, const char *path, http_app_match_t match, http_app_route_stats_t *stats);
+
+/**
+ * @brief Copies the counters of the connectivity checks of the OSes (/generate_204, /hotspot-detect.html, /connecttest.txt...),
+ * which the captive portal answers from precomputed responses before any route, closing their connection.
+ * @return the number of probes known, of which the first max were copied.
+ */
+size_t http_app_get_probe_stats(http_app_probe_stats_t *stats, size_t max);
+
+/**
+ * @brief Tells the open /events streams that a part of the state changed. It only queues the event: it never blocks, and
+ * the json is rendered by the task writing the streams. Call it once the json buffer is unlocked.
+ */
+void http_app_notify(http_app_event_t event);
+
+/**
+ * @brief Reads the body of a request into buf and tokenizes it. Custom hooks can use it to take JSON bodies.
+ * Strings can then be looked up with json_object_get and read with json_token_string, which unescapes them in buf.
+ * @param buf receives the body. One byte is kept for a null terminator.
+ * @return the number of tokens, or a negative value if the body is empty, too large, not fully received or not valid JSON.
+ */
+int http_app_parse_json_body(httpd_req_t *req, char *buf, size_t buf_size, json_token_t *tokens, int num_tokens);
+
 
 #ifdef __cplusplus
 }
@@ -28,18 +28,107 @@ OTHER DEALINGS IN THE SOFTWARE.
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "json.h"
 
 
+/**
+ * @brief true for the characters that can't appear as is in a JSON string. The null terminator is included so that
+ * it also ends a run of clean characters.
+ */
+#define JSON_NEEDS_ESCAPE(c)	(((c) < 32) || ((c) == '\"') || ((c) == '\\'))
+
+/* @brief SWAR helpers on 32 bits words. A byte of the result has its high bit set if the matching byte of v is... */
+#define JSON_ONES				((uint32_t)0x01010101)
+#define JSON_HIGHS				((uint32_t)0x80808080)
+/* ...lower than n (n <= 128). Bytes >= 0x80 (UTF-8) are never flagged */
+#define JSON_HAS_LESS(v, n)		(((v) - JSON_ONES * (n)) & ~(v) & JSON_HIGHS)
+/* ...equal to 0 */
+#define JSON_HAS_ZERO(v)		JSON_HAS_LESS(v, 1)
+
+/**
+ * @brief length of the prefix of s that can be copied without escaping, stopping at the null terminator or at max_len.
+ * Four bytes are checked at a time once s is word aligned. Words are only read within max_len, which must not go past the
+ * object holding s: callers that don't know the length of a string measure it first.
+ */
+static inline size_t json_clean_run(const unsigned char *s, size_t max_len)
+{
+	size_t i = 0;
+
+	while (i < max_len && ((uintptr_t)(s + i) & (sizeof(uint32_t) - 1)))
+	{
+		if (JSON_NEEDS_ESCAPE(s[i]))
+		{
+			return i;
+		}
+		i++;
+	}
+
+	while (i + sizeof(uint32_t) <= max_len)
+	{
+		uint32_t v;
+		memcpy(&v, s + i, sizeof(v));
+		if (JSON_HAS_LESS(v, 32) | JSON_HAS_ZERO(v ^ (JSON_ONES * '\"')) | JSON_HAS_ZERO(v ^ (JSON_ONES * '\\')))
+		{
+			break;
+		}
+		i += sizeof(uint32_t);
+	}
+
+	while (i < max_len && !JSON_NEEDS_ESCAPE(s[i]))
+	{
+		i++;
+	}
+
+	return i;
+}
+
+/**
+ * @brief writes the escape sequence of c, which must satisfy JSON_NEEDS_ESCAPE and not be the null terminator.
+ * @return the length of the sequence: 2 or 6 for the \uXXXX form.
+ */
+static inline size_t json_escape_char(unsigned char c, char *output)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	output[0] = '\\';
+	switch (c)
+	{
+	case '\\':
+	case '\"':
+		output[1] = (char)c;
+		return 2;
+	case '\b':
+		output[1] = 'b';
+		return 2;
+	case '\f':
+		output[1] = 'f';
+		return 2;
+	case '\n':
+		output[1] = 'n';
+		return 2;
+	case '\r':
+		output[1] = 'r';
+		return 2;
+	case '\t':
+		output[1] = 't';
+		return 2;
+	default:
+		/* escape and print as unicode codepoint */
+		output[1] = 'u';
+		output[2] = '0';
+		output[3] = '0';
+		output[4] = hex[c >> 4];
+		output[5] = hex[c & 0x0f];
+		return 6;
+	}
+}
+
 bool json_print_string(const unsigned char *input, unsigned char *output_buffer)
 {
-	const unsigned char *input_pointer = NULL;
-	unsigned char *output = NULL;
 	unsigned char *output_pointer = NULL;
-	size_t output_length = 0;
-	/* numbers of additional characters needed for escaping */
-	size_t escape_characters = 0;
 
 	if (output_buffer == NULL)
 	{
@@ -49,95 +138,713 @@ bool json_print_string(const unsigned char *input, unsigned char *output_buffer)
 	/* empty string */
 	if (input == NULL)
 	{
-		//output = ensure(output_buffer, sizeof("\"\""), hooks);
-		if (output == NULL)
+		strcpy((char*)output_buffer, "\"\"");
+
+		return true;
+	}
+
+	/* the string is measured first so that the word scan never reads past its terminator. Clean runs are then copied
+	 * and special characters escaped in a single pass, without the output length cJSON computes to realloc its buffer. */
+	const unsigned char *end = input + strlen((const char*)input);
+	output_pointer = output_buffer;
+	*output_pointer++ = '\"';
+	while (input < end)
+	{
+		size_t run = json_clean_run(input, (size_t)(end - input));
+		memcpy(output_pointer, input, run);
+		output_pointer += run;
+		input += run;
+
+		/* special characters often come in a row: escape them all before going back to the word scan */
+		while (input < end && JSON_NEEDS_ESCAPE(*input))
 		{
-			return false;
+			output_pointer += json_escape_char(*input++, (char*)output_pointer);
+		}
+	}
+	*output_pointer++ = '\"';
+	*output_pointer = '\0';
+
+	return true;
+}
+
+
+/**
+ * @brief appends one character, keeping room for the null terminator. Nothing is written anymore after an overflow.
+ */
+static inline void json_writer_putc(json_writer_t *w, char c)
+{
+	if (!w->overflow && w->len + 1 < w->capacity)
+	{
+		w->buf[w->len++] = c;
+	}
+	else
+	{
+		w->overflow = true;
+	}
+}
+
+static void json_writer_put(json_writer_t *w, const char *str, size_t len)
+{
+	if (!w->overflow && w->len + len < w->capacity)
+	{
+		memcpy(w->buf + w->len, str, len);
+		w->len += len;
+	}
+	else
+	{
+		w->overflow = true;
+	}
+}
+
+/**
+ * @brief writes the comma separating this value from the previous one at the same level
+ */
+static void json_writer_separate(json_writer_t *w)
+{
+	if (w->need_comma)
+	{
+		json_writer_putc(w, ',');
+	}
+	w->need_comma = true;
+}
+
+void json_writer_init(json_writer_t *w, char *buf, size_t capacity)
+{
+	w->buf = buf;
+	w->capacity = capacity;
+	w->len = 0;
+	w->need_comma = false;
+	w->overflow = (capacity == 0);
+	if (capacity > 0)
+	{
+		buf[0] = '\0';
+	}
+}
+
+void json_writer_reset(json_writer_t *w)
+{
+	w->len = 0;
+	if (w->capacity > 0)
+	{
+		w->buf[0] = '\0';
+	}
+}
+
+void json_writer_begin_object(json_writer_t *w)
+{
+	json_writer_separate(w);
+	json_writer_putc(w, '{');
+	w->need_comma = false;
+}
+
+void json_writer_end_object(json_writer_t *w)
+{
+	json_writer_putc(w, '}');
+	w->need_comma = true;
+}
+
+void json_writer_begin_array(json_writer_t *w)
+{
+	json_writer_separate(w);
+	json_writer_putc(w, '[');
+	w->need_comma = false;
+}
+
+void json_writer_end_array(json_writer_t *w)
+{
+	json_writer_putc(w, ']');
+	w->need_comma = true;
+}
+
+void json_writer_key(json_writer_t *w, const char *key)
+{
+	json_writer_separate(w);
+	json_writer_putc(w, '\"');
+	json_writer_put(w, key, strlen(key));
+	json_writer_put(w, "\":", 2);
+	w->need_comma = false;
+}
+
+void json_writer_string_n(json_writer_t *w, const char *str, size_t max_len)
+{
+	const unsigned char *input = (const unsigned char*)(str ? str : "");
+	size_t i = 0;
+
+	json_writer_separate(w);
+	json_writer_putc(w, '\"');
+
+	while (!w->overflow)
+	{
+		size_t run = json_clean_run(input + i, max_len - i);
+		json_writer_put(w, (const char*)input + i, run);
+		i += run;
+
+		while (i < max_len && input[i] != '\0' && JSON_NEEDS_ESCAPE(input[i]))
+		{
+			char escaped[6];
+			json_writer_put(w, escaped, json_escape_char(input[i++], escaped));
+		}
+		if (i >= max_len || input[i] == '\0')
+		{
+			break;
+		}
+	}
+
+	json_writer_putc(w, '\"');
+}
+
+void json_writer_string(json_writer_t *w, const char *str)
+{
+	/* bounds the word scan of json_clean_run to the string */
+	json_writer_string_n(w, str, str ? strlen(str) : 0);
+}
+
+void json_writer_int(json_writer_t *w, int32_t value)
+{
+	/* digits are produced backwards, -2147483648 being the longest */
+	char digits[11];
+	size_t n = 0;
+	uint32_t u = value < 0 ? (uint32_t)0 - (uint32_t)value : (uint32_t)value;
+
+	json_writer_separate(w);
+	do
+	{
+		digits[n++] = (char)('0' + (u % 10));
+		u /= 10;
+	} while (u);
+
+	if (value < 0)
+	{
+		json_writer_putc(w, '-');
+	}
+	while (n)
+	{
+		json_writer_putc(w, digits[--n]);
+	}
+}
+
+void json_writer_bool(json_writer_t *w, bool value)
+{
+	json_writer_separate(w);
+	if (value)
+	{
+		json_writer_put(w, "true", 4);
+	}
+	else
+	{
+		json_writer_put(w, "false", 5);
+	}
+}
+
+void json_writer_raw(json_writer_t *w, const char *str)
+{
+	json_writer_put(w, str, strlen(str));
+}
+
+bool json_writer_finish(json_writer_t *w)
+{
+	if (w->capacity > 0)
+	{
+		w->buf[w->len] = '\0';
+	}
+	return !w->overflow;
+}
+
+
+/**
+ * @brief value of a hex digit validated by json_parse
+ */
+static unsigned int json_hex_value(char c)
+{
+	if (c <= '9')
+	{
+		return c - '0';
+	}
+	return (c | 0x20) - 'a' + 10;
+}
+
+static unsigned int json_parse_hex4(const char *p)
+{
+	return (json_hex_value(p[0]) << 12) | (json_hex_value(p[1]) << 8) | (json_hex_value(p[2]) << 4) | json_hex_value(p[3]);
+}
+
+/**
+ * @brief checks the 4 hex digits of a \u escape and, for a high surrogate, the \u escape of its low surrogate.
+ * \u0000 is refused since the unescaped string is null terminated. Lone surrogates have no UTF-8 encoding and are refused too.
+ * @param pos in: offset of the u, out: offset of the last hex digit read.
+ * @return 0, JSON_ERROR_INVAL or JSON_ERROR_PART.
+ */
+static int json_check_unicode_escape(const char *js, size_t len, size_t *pos)
+{
+	size_t p = *pos;
+
+	for (int h = 1; h <= 4; h++)
+	{
+		if (p + h >= len || js[p + h] == '\0')
+		{
+			return JSON_ERROR_PART;
+		}
+		if (!isxdigit((unsigned char)js[p + h]))
+		{
+			return JSON_ERROR_INVAL;
+		}
+	}
+	unsigned int codepoint = json_parse_hex4(js + p + 1);
+	p += 4;
+
+	if (codepoint == 0 || (codepoint >= 0xDC00 && codepoint <= 0xDFFF))
+	{
+		return JSON_ERROR_INVAL;
+	}
+	if (codepoint >= 0xD800 && codepoint <= 0xDBFF)
+	{
+		/* the low surrogate must follow as \uDC00 to \uDFFF */
+		for (int h = 1; h <= 6; h++)
+		{
+			if (p + h >= len || js[p + h] == '\0')
+			{
+				return JSON_ERROR_PART;
+			}
+			if (h == 1 ? js[p + h] != '\\' : h == 2 ? js[p + h] != 'u' : !isxdigit((unsigned char)js[p + h]))
+			{
+				return JSON_ERROR_INVAL;
+			}
+		}
+		unsigned int low = json_parse_hex4(js + p + 3);
+		if (low < 0xDC00 || low > 0xDFFF)
+		{
+			return JSON_ERROR_INVAL;
 		}
-		strcpy((char*)output, "\"\"");
+		p += 6;
+	}
+
+	*pos = p;
+	return 0;
+}
 
+/**
+ * @brief checks that a primitive is exactly true, false, null or a number as per RFC 8259
+ */
+static bool json_primitive_valid(const char *p, size_t n)
+{
+	if ((n == 4 && memcmp(p, "true", 4) == 0) || (n == 5 && memcmp(p, "false", 5) == 0) || (n == 4 && memcmp(p, "null", 4) == 0))
+	{
 		return true;
 	}
 
-	/* set "flag" to 1 if something needs to be escaped */
-	for (input_pointer = input; *input_pointer; input_pointer++)
+	const char *end = p + n;
+	if (p < end && *p == '-')
+	{
+		p++;
+	}
+	/* int: 0 or a non zero digit followed by digits */
+	if (p >= end || !isdigit((unsigned char)*p))
+	{
+		return false;
+	}
+	if (*p++ != '0')
+	{
+		while (p < end && isdigit((unsigned char)*p))
+		{
+			p++;
+		}
+	}
+	/* frac */
+	if (p < end && *p == '.')
+	{
+		p++;
+		if (p >= end || !isdigit((unsigned char)*p))
+		{
+			return false;
+		}
+		while (p < end && isdigit((unsigned char)*p))
+		{
+			p++;
+		}
+	}
+	/* exp */
+	if (p < end && (*p == 'e' || *p == 'E'))
 	{
-		if (strchr("\"\\\b\f\n\r\t", *input_pointer))
+		p++;
+		if (p < end && (*p == '+' || *p == '-'))
 		{
-			/* one character escape sequence */
-			escape_characters++;
+			p++;
 		}
-		else if (*input_pointer < 32)
+		if (p >= end || !isdigit((unsigned char)*p))
 		{
-			/* UTF-16 escape sequence uXXXX */
-			escape_characters += 5;
+			return false;
+		}
+		while (p < end && isdigit((unsigned char)*p))
+		{
+			p++;
 		}
 	}
-	output_length = (size_t)(input_pointer - input) + escape_characters;
 
-	/* in the original cJSON it is possible to realloc here in case output buffer is too small.
-	 * This is overkill for an embedded system. */
-	output = output_buffer;
+	return p == end;
+}
 
-	/* no characters have to be escaped */
-	if (escape_characters == 0)
+/**
+ * @brief attaches a new token to the current super token (the open container or the key awaiting its value)
+ */
+static json_token_t* json_new_token(json_token_t *tokens, int num_tokens, int *count, int super, json_type_t type, int start, int end)
+{
+	if (*count >= num_tokens)
 	{
-		output[0] = '\"';
-		memcpy(output + 1, input, output_length);
-		output[output_length + 1] = '\"';
-		output[output_length + 2] = '\0';
+		return NULL;
+	}
 
+	json_token_t *token = &tokens[(*count)++];
+	token->type = type;
+	token->start = start;
+	token->end = end;
+	token->size = 0;
+	token->parent = super;
+	token->unescaped = false;
+	if (super != -1)
+	{
+		tokens[super].size++;
+	}
+
+	return token;
+}
+
+/**
+ * @brief a scalar or a container can only go at the root, in an array or after a key
+ */
+static bool json_value_allowed(const json_token_t *tokens, int count, int super)
+{
+	if (super == -1)
+	{
+		/* a single root value */
+		return count == 0;
+	}
+	if (tokens[super].type == JSON_ARRAY)
+	{
 		return true;
 	}
+	/* key awaiting its value */
+	return tokens[super].type == JSON_STRING && tokens[super].size == 0;
+}
 
-	output[0] = '\"';
-	output_pointer = output + 1;
-	/* copy the string */
-	for (input_pointer = input; *input_pointer != '\0'; (void)input_pointer++, output_pointer++)
-	{
-		if ((*input_pointer > 31) && (*input_pointer != '\"') && (*input_pointer != '\\'))
-		{
-			/* normal character, copy */
-			*output_pointer = *input_pointer;
-		}
-		else
-		{
-			/* character needs to be escaped */
-			*output_pointer++ = '\\';
-			switch (*input_pointer)
-			{
-			case '\\':
-				*output_pointer = '\\';
-				break;
-			case '\"':
-				*output_pointer = '\"';
-				break;
-			case '\b':
-				*output_pointer = 'b';
-				break;
-			case '\f':
-				*output_pointer = 'f';
-				break;
-			case '\n':
-				*output_pointer = 'n';
-				break;
-			case '\r':
-				*output_pointer = 'r';
-				break;
-			case '\t':
-				*output_pointer = 't';
-				break;
-			default:
-				/* escape and print as unicode codepoint */
-				sprintf((char*)output_pointer, "u%04x", *input_pointer);
-				output_pointer += 4;
-				break;
-			}
-		}
-	}
-	output[output_length + 1] = '\"';
-	output[output_length + 2] = '\0';
+int json_parse(const char *js, size_t len, json_token_t *tokens, int num_tokens)
+{
+	int count = 0;
+	int super = -1;
+	/* a complete value was just read: only a comma or the end of its container may follow */
+	bool after_value = false;
+	/* a key was just read: only a colon may follow */
+	bool expect_colon = false;
+	size_t pos;
 
-	return true;
+	for (pos = 0; pos < len && js[pos] != '\0'; pos++)
+	{
+		char c = js[pos];
+		json_token_t *token;
+		int i;
+
+		switch (c)
+		{
+		case '{':
+		case '[':
+			if (after_value || expect_colon || !json_value_allowed(tokens, count, super))
+			{
+				return JSON_ERROR_INVAL;
+			}
+			token = json_new_token(tokens, num_tokens, &count, super, c == '{' ? JSON_OBJECT : JSON_ARRAY, (int)pos, -1);
+			if (token == NULL)
+			{
+				return JSON_ERROR_NOMEM;
+			}
+			super = count - 1;
+			break;
+
+		case '}':
+		case ']':
+			if (expect_colon)
+			{
+				return JSON_ERROR_INVAL;
+			}
+			/* close the innermost open container, going up from a key if needed */
+			i = super;
+			if (i != -1 && tokens[i].type == JSON_STRING)
+			{
+				/* a key without value is invalid */
+				if (tokens[i].size == 0)
+				{
+					return JSON_ERROR_INVAL;
+				}
+				i = tokens[i].parent;
+			}
+			if (i == -1 || tokens[i].type != (c == '}' ? JSON_OBJECT : JSON_ARRAY))
+			{
+				return JSON_ERROR_INVAL;
+			}
+			/* trailing comma */
+			if (!after_value && tokens[i].size > 0)
+			{
+				return JSON_ERROR_INVAL;
+			}
+			tokens[i].end = (int)pos + 1;
+			super = tokens[i].parent;
+			after_value = true;
+			break;
+
+		case '\"':
+		{
+			/* a string is a key when it is directly in an object */
+			bool key = super != -1 && tokens[super].type == JSON_OBJECT;
+			if (after_value || expect_colon || (!key && !json_value_allowed(tokens, count, super)))
+			{
+				return JSON_ERROR_INVAL;
+			}
+
+			size_t start = ++pos;
+			for (; pos < len && js[pos] != '\"'; pos++)
+			{
+				if ((unsigned char)js[pos] < 32)
+				{
+					return js[pos] == '\0' ? JSON_ERROR_PART : JSON_ERROR_INVAL;
+				}
+				if (js[pos] == '\\')
+				{
+					pos++;
+					if (pos >= len)
+					{
+						break;
+					}
+					if (js[pos] == 'u')
+					{
+						int err = json_check_unicode_escape(js, len, &pos);
+						if (err != 0)
+						{
+							return err;
+						}
+					}
+					else if (js[pos] == '\0' || !strchr("\"\\/bfnrt", js[pos]))
+					{
+						return JSON_ERROR_INVAL;
+					}
+				}
+			}
+			if (pos >= len)
+			{
+				return JSON_ERROR_PART;
+			}
+
+			token = json_new_token(tokens, num_tokens, &count, super, JSON_STRING, (int)start, (int)pos);
+			if (token == NULL)
+			{
+				return JSON_ERROR_NOMEM;
+			}
+			expect_colon = key;
+			after_value = !key;
+			break;
+		}
+
+		case ':':
+			if (!expect_colon)
+			{
+				return JSON_ERROR_INVAL;
+			}
+			/* the key is the super token of its value */
+			expect_colon = false;
+			super = count - 1;
+			break;
+
+		case ',':
+			if (!after_value)
+			{
+				return JSON_ERROR_INVAL;
+			}
+			after_value = false;
+			/* back from a key to its object */
+			if (super != -1 && tokens[super].type == JSON_STRING)
+			{
+				super = tokens[super].parent;
+			}
+			if (super == -1)
+			{
+				return JSON_ERROR_INVAL;
+			}
+			break;
+
+		case ' ':
+		case '\t':
+		case '\r':
+		case '\n':
+			break;
+
+		default:
+		{
+			/* number, true, false or null */
+			if (after_value || expect_colon || !(c == '-' || (c >= '0' && c <= '9') || c == 't' || c == 'f' || c == 'n') || !json_value_allowed(tokens, count, super))
+			{
+				return JSON_ERROR_INVAL;
+			}
+
+			size_t start = pos;
+			for (; pos < len && js[pos] != '\0' && !strchr(" \t\r\n,]}:", js[pos]); pos++)
+			{
+				if ((unsigned char)js[pos] < 32 || (unsigned char)js[pos] >= 127 || js[pos] == '\"' || js[pos] == '{' || js[pos] == '[')
+				{
+					return JSON_ERROR_INVAL;
+				}
+			}
+
+			if (!json_primitive_valid(js + start, pos - start))
+			{
+				/* "tru" or "-" cut by the end of the input may still be completed */
+				return pos >= len || js[pos] == '\0' ? JSON_ERROR_PART : JSON_ERROR_INVAL;
+			}
+
+			token = json_new_token(tokens, num_tokens, &count, super, JSON_PRIMITIVE, (int)start, (int)pos);
+			if (token == NULL)
+			{
+				return JSON_ERROR_NOMEM;
+			}
+			/* the delimiter is processed by the next iteration */
+			after_value = true;
+			pos--;
+			break;
+		}
+		}
+	}
+
+	/* unclosed containers */
+	for (int i = count - 1; i >= 0; i--)
+	{
+		if ((tokens[i].type == JSON_OBJECT || tokens[i].type == JSON_ARRAY) && tokens[i].end == -1)
+		{
+			return JSON_ERROR_PART;
+		}
+	}
+	/* dangling key */
+	if (expect_colon || (super != -1 && tokens[super].type == JSON_STRING && tokens[super].size == 0))
+	{
+		return JSON_ERROR_PART;
+	}
+
+	return count;
+}
+
+int json_object_get(const char *js, const json_token_t *tokens, int count, int object, const char *key)
+{
+	if (object < 0 || object >= count || tokens[object].type != JSON_OBJECT)
+	{
+		return -1;
+	}
+
+	size_t key_len = strlen(key);
+
+	/* members are keys whose parent is the object. Tokens of nested values are skipped over since their parent differs */
+	for (int i = object + 1; i < count - 1 && tokens[i].start < tokens[object].end; i++)
+	{
+		const json_token_t *t = &tokens[i];
+		if (t->parent == object && t->type == JSON_STRING && (size_t)(t->end - t->start) == key_len && memcmp(js + t->start, key, key_len) == 0)
+		{
+			return i + 1;
+		}
+	}
+
+	return -1;
 }
 
+char* json_token_string(char *js, json_token_t *token)
+{
+	if (token->type != JSON_STRING)
+	{
+		return NULL;
+	}
+	/* unescaping twice would decode the escapes produced by the first pass */
+	if (token->unescaped)
+	{
+		return js + token->start;
+	}
+
+	/* the unescaped string is never longer than the escaped one, so it can be written over it */
+	char *in = js + token->start;
+	char *end = js + token->end;
+	char *out = in;
+
+	while (in < end)
+	{
+		size_t run = json_clean_run((const unsigned char*)in, (size_t)(end - in));
+		/* only backslashes can be met in a validated string */
+		memmove(out, in, run);
+		out += run;
+		in += run;
+		if (in >= end)
+		{
+			break;
+		}
+
+		/* in points to a backslash */
+		in++;
+		switch (*in++)
+		{
+		case 'b':
+			*out++ = '\b';
+			break;
+		case 'f':
+			*out++ = '\f';
+			break;
+		case 'n':
+			*out++ = '\n';
+			break;
+		case 'r':
+			*out++ = '\r';
+			break;
+		case 't':
+			*out++ = '\t';
+			break;
+		case 'u':
+		{
+			unsigned int codepoint = json_parse_hex4(in);
+			in += 4;
+
+			/* surrogate pair, json_parse guarantees the low half follows */
+			if (codepoint >= 0xD800 && codepoint <= 0xDBFF)
+			{
+				unsigned int low = json_parse_hex4(in + 2);
+				codepoint = 0x10000 + (((codepoint & 0x3FF) << 10) | (low & 0x3FF));
+				in += 6;
+			}
+
+			/* UTF-8 */
+			if (codepoint < 0x80)
+			{
+				*out++ = (char)codepoint;
+			}
+			else if (codepoint < 0x800)
+			{
+				*out++ = (char)(0xC0 | (codepoint >> 6));
+				*out++ = (char)(0x80 | (codepoint & 0x3F));
+			}
+			else if (codepoint < 0x10000)
+			{
+				*out++ = (char)(0xE0 | (codepoint >> 12));
+				*out++ = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+				*out++ = (char)(0x80 | (codepoint & 0x3F));
+			}
+			else
+			{
+				*out++ = (char)(0xF0 | (codepoint >> 18));
+				*out++ = (char)(0x80 | ((codepoint >> 12) & 0x3F));
+				*out++ = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+				*out++ = (char)(0x80 | (codepoint & 0x3F));
+			}
+			break;
+		}
+		default:
+			/* quote, backslash and slash stand for themselves */
+			*out++ = in[-1];
+			break;
+		}
+	}
+
+	*out = '\0';
+	token->end = token->start + (int)(out - (js + token->start));
+	token->unescaped = true;
+
+	return js + token->start;
+}
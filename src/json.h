@@ -28,6 +28,10 @@ OTHER DEALINGS IN THE SOFTWARE.
 #ifndef JSON_H_INCLUDED
 #define JSON_H_INCLUDED
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -40,6 +44,124 @@ extern "C" {
  */
 bool json_print_string(const unsigned char *input, unsigned char *output_buffer);
 
+
+/**
+ * @brief Appends JSON to a fixed size buffer in a single pass.
+ * Every write is bounds checked against the capacity. Once something doesn't fit the writer stops writing and
+ * flags the overflow, which is reported by json_writer_finish. Commas between members and values are added automatically.
+ */
+typedef struct{
+	char *buf;
+	size_t capacity;
+	size_t len;			/* cursor: the next character is written at buf[len] */
+	bool need_comma;	/* a value was written at the current nesting level */
+	bool overflow;
+}json_writer_t;
+
+/**
+ * @brief Starts writing at the beginning of buf. The buffer is always kept null terminated.
+ */
+void json_writer_init(json_writer_t *w, char *buf, size_t capacity);
+
+/**
+ * @brief Empties the buffer, typically after it was sent as a chunk, but keeps the position in the document:
+ * the next value is still separated from the previous one. This is how a document larger than the buffer is streamed.
+ */
+void json_writer_reset(json_writer_t *w);
+
+void json_writer_begin_object(json_writer_t *w);
+void json_writer_end_object(json_writer_t *w);
+void json_writer_begin_array(json_writer_t *w);
+void json_writer_end_array(json_writer_t *w);
+
+/**
+ * @brief Writes the name of an object member. It must be followed by exactly one value.
+ * @param key written as is: it must not need escaping.
+ */
+void json_writer_key(json_writer_t *w, const char *key);
+
+/**
+ * @brief Writes an escaped string value. NULL is written as an empty string.
+ */
+void json_writer_string(json_writer_t *w, const char *str);
+
+/**
+ * @brief Same as json_writer_string for a buffer that may not be null terminated, such as a 32 characters SSID.
+ * It stops at max_len or at a null character, whichever comes first. The max_len bytes must all be readable.
+ */
+void json_writer_string_n(json_writer_t *w, const char *str, size_t max_len);
+
+void json_writer_int(json_writer_t *w, int32_t value);
+void json_writer_bool(json_writer_t *w, bool value);
+
+/**
+ * @brief Appends characters as is, such as the trailing new line of the json files served to the web app.
+ */
+void json_writer_raw(json_writer_t *w, const char *str);
+
+/**
+ * @brief Checks the result.
+ * @return false if something didn't fit. The buffer then holds a truncated, invalid JSON.
+ */
+bool json_writer_finish(json_writer_t *w);
+
+
+
+/**
+ * @brief Kinds of token produced by json_parse.
+ */
+typedef enum json_type_t{
+	JSON_UNDEFINED = 0,
+	JSON_OBJECT = 1,
+	JSON_ARRAY = 2,
+	JSON_STRING = 3,
+	JSON_PRIMITIVE = 4	/* number, true, false or null */
+}json_type_t;
+
+/**
+ * @brief Errors returned by json_parse.
+ */
+#define JSON_ERROR_NOMEM		-1	/* not enough tokens */
+#define JSON_ERROR_INVAL		-2	/* invalid character or structure */
+#define JSON_ERROR_PART			-3	/* the input ends in the middle of a value */
+
+/**
+ * @brief A value located in the parsed text. Nothing is copied: the token only holds offsets.
+ * For strings start and end exclude the quotes.
+ */
+typedef struct{
+	json_type_t type;
+	int start;		/* offset of the first character */
+	int end;		/* offset past the last character */
+	int size;		/* number of members of an object, elements of an array, 1 for an object key */
+	int parent;		/* index of the enclosing token: the object or array, or the key for a member value. -1 at the root */
+	bool unescaped;	/* set by json_token_string once the string was unescaped in place */
+}json_token_t;
+
+/**
+ * @brief Tokenizes a JSON text into a fixed array of tokens, in the manner of jsmn. Nothing is allocated.
+ * The first token is the root value. An object member is a string token (the key) directly followed by its value.
+ * Strings are checked for control characters, \u0000 and lone surrogates, primitives must be exactly true, false, null or a number.
+ * @param js the text. Parsing stops at len or at the first null character.
+ * @return the number of tokens used, or one of the JSON_ERROR_ codes.
+ * @see https://github.com/zserge/jsmn
+ */
+int json_parse(const char *js, size_t len, json_token_t *tokens, int num_tokens);
+
+/**
+ * @brief Looks up a member of an object.
+ * @param object index of the object token.
+ * @return the index of the value token, -1 if the object has no such member.
+ */
+int json_object_get(const char *js, const json_token_t *tokens, int count, int object, const char *key);
+
+/**
+ * @brief Unescapes a string token in place and null terminates it, overwriting its closing quote.
+ * The token is then marked as unescaped and pointed at the result: later calls return it as is.
+ * @return the string, NULL if the token is not a string.
+ */
+char* json_token_string(char *js, json_token_t *token);
+
 #ifdef __cplusplus
 }
 #endif
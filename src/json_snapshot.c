@@ -0,0 +1,241 @@
+/*
+Copyright (c) 2020 Marko Juhanne
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file json_snapshot.c
+@author Marko Juhanne
+@brief Double buffered json documents that can be sent without holding the lock of their writer.
+
+@see json_snapshot.h
+*/
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "sdkconfig.h"
+#include "esp_idf_version.h"
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+#include <esp_random.h>
+#else
+#include <esp_system.h>
+#endif
+#include "json_snapshot.h"
+
+#ifdef CONFIG_IDF_TARGET_ESP32
+#define ESP32
+#endif
+
+/* @brief last version published by any snapshot. 0 until the first publish seeds it */
+static uint32_t json_snapshot_generation = 0;
+
+
+/* @brief guards the reference counts and the published index of every snapshot. It is only held for a few instructions */
+#ifdef ESP32
+static portMUX_TYPE json_snapshot_mux = portMUX_INITIALIZER_UNLOCKED;
+#define JSON_SNAPSHOT_ENTER()		portENTER_CRITICAL(&json_snapshot_mux)
+#define JSON_SNAPSHOT_EXIT()		portEXIT_CRITICAL(&json_snapshot_mux)
+#else
+#define JSON_SNAPSHOT_ENTER()		portENTER_CRITICAL()
+#define JSON_SNAPSHOT_EXIT()		portEXIT_CRITICAL()
+#endif
+
+
+void json_snapshot_init(json_snapshot_t *s, char *storage, size_t capacity, size_t cbor_capacity){
+	/* each slot is its json buffer followed by its CBOR buffer */
+	for(int i=0; i<JSON_SNAPSHOT_SLOTS; i++){
+		s->slot[i].data = storage ? storage + i * (capacity + cbor_capacity) : NULL;
+		s->slot[i].cbor = storage && cbor_capacity ? (uint8_t*)s->slot[i].data + capacity : NULL;
+		s->slot[i].cbor_len = 0;
+		s->slot[i].refs = 0;
+		s->slot[i].generation = 0;
+	}
+	s->capacity = capacity;
+	s->cbor_capacity = cbor_capacity;
+	s->current = -1;
+}
+
+char* json_snapshot_begin_write(json_snapshot_t *s){
+
+	char *buf = NULL;
+
+	/* readers only ever pin the published buffer: a buffer that isn't published and has no reader left can't be pinned behind our back */
+	JSON_SNAPSHOT_ENTER();
+	for(int i=0; i<JSON_SNAPSHOT_SLOTS; i++){
+		if(i != s->current && s->slot[i].refs == 0 && s->slot[i].data){
+			buf = s->slot[i].data;
+			break;
+		}
+	}
+	JSON_SNAPSHOT_EXIT();
+
+	return buf;
+}
+
+uint8_t* json_snapshot_cbor_buffer(json_snapshot_t *s, const char *buf){
+	for(int i=0; i<JSON_SNAPSHOT_SLOTS; i++){
+		if(buf && s->slot[i].data == buf){
+			return s->slot[i].cbor;
+		}
+	}
+	return NULL;
+}
+
+void json_snapshot_publish(json_snapshot_t *s, char *buf, size_t cbor_len){
+
+	/* a random start keeps the ETags of a previous boot from matching */
+	uint32_t seed = json_snapshot_generation == 0 ? esp_random() : 0;
+
+	/* a document rendered again without any change keeps its version, so that clients polling it keep getting 304.
+	 * The published buffer can only be changed by writers, which are serialized: it can be read outside of the critical section.
+	 * Whole buffers are compared: stale bytes past the end of a document can only make equal documents look different, never the reverse. */
+	uint32_t unchanged = 0;
+	if(s->current >= 0){
+		const json_snapshot_slot_t *current = &s->slot[s->current];
+		if(current->data != buf && memcmp(current->data, buf, s->capacity) == 0 && current->cbor_len == cbor_len &&
+				(cbor_len == 0 || memcmp(current->cbor, json_snapshot_cbor_buffer(s, buf), cbor_len) == 0)){
+			unchanged = current->generation;
+		}
+	}
+
+	JSON_SNAPSHOT_ENTER();
+	if(json_snapshot_generation == 0){
+		json_snapshot_generation = seed;
+	}
+	if(unchanged == 0 && ++json_snapshot_generation == 0){
+		/* 0 means no version */
+		json_snapshot_generation = 1;
+	}
+	for(int i=0; i<JSON_SNAPSHOT_SLOTS; i++){
+		if(s->slot[i].data == buf){
+			s->slot[i].cbor_len = (uint16_t)cbor_len;
+			s->slot[i].generation = unchanged ? unchanged : json_snapshot_generation;
+			s->current = i;
+			break;
+		}
+	}
+	JSON_SNAPSHOT_EXIT();
+}
+
+const char* json_snapshot_pin(json_snapshot_t *s){
+
+	const char *data = NULL;
+
+	JSON_SNAPSHOT_ENTER();
+	if(s->current >= 0 && s->slot[s->current].data){
+		s->slot[s->current].refs++;
+		data = s->slot[s->current].data;
+	}
+	JSON_SNAPSHOT_EXIT();
+
+	return data;
+}
+
+const char* json_snapshot_get(json_snapshot_t *s){
+
+	const char *data = NULL;
+
+	JSON_SNAPSHOT_ENTER();
+	if(s->current >= 0){
+		data = s->slot[s->current].data;
+	}
+	JSON_SNAPSHOT_EXIT();
+
+	return data;
+}
+
+void json_snapshot_unpin(json_snapshot_t *s, const char *data){
+
+	if(data == NULL) return;
+
+	JSON_SNAPSHOT_ENTER();
+	for(int i=0; i<JSON_SNAPSHOT_SLOTS; i++){
+		if(s->slot[i].data == data && s->slot[i].refs > 0){
+			s->slot[i].refs--;
+			break;
+		}
+	}
+	JSON_SNAPSHOT_EXIT();
+}
+
+const uint8_t* json_snapshot_get_cbor(const json_snapshot_t *s, const char *data, size_t *len){
+	/* the slot can't be rewritten while data is pinned: no need for the critical section */
+	for(int i=0; i<JSON_SNAPSHOT_SLOTS; i++){
+		if(data && s->slot[i].data == data && s->slot[i].cbor && s->slot[i].cbor_len){
+			*len = s->slot[i].cbor_len;
+			return s->slot[i].cbor;
+		}
+	}
+	*len = 0;
+	return NULL;
+}
+
+uint32_t json_snapshot_get_generation(const json_snapshot_t *s, const char *data){
+	/* like the CBOR encoding, the version of a pinned buffer can't change */
+	for(int i=0; i<JSON_SNAPSHOT_SLOTS; i++){
+		if(data && s->slot[i].data == data){
+			return s->slot[i].generation;
+		}
+	}
+	return 0;
+}
+
+bool json_snapshot_owns(const json_snapshot_t *s, const char *data){
+	for(int i=0; i<JSON_SNAPSHOT_SLOTS; i++){
+		if(data && s->slot[i].data == data){
+			return true;
+		}
+	}
+	return false;
+}
+
+bool json_snapshot_retire(json_snapshot_t *s){
+
+	bool pinned;
+	TickType_t start = xTaskGetTickCount();
+
+	JSON_SNAPSHOT_ENTER();
+	s->current = -1;
+	JSON_SNAPSHOT_EXIT();
+
+	/* readers pinned the json before it was unpublished: they are done as soon as their send completes or times out */
+	for(;;){
+		pinned = false;
+		JSON_SNAPSHOT_ENTER();
+		for(int i=0; i<JSON_SNAPSHOT_SLOTS; i++){
+			pinned |= s->slot[i].refs > 0;
+		}
+		if(!pinned || xTaskGetTickCount() - start >= pdMS_TO_TICKS(JSON_SNAPSHOT_RETIRE_TIMEOUT_MS)){
+			/* from now on nothing can be written or pinned */
+			for(int i=0; i<JSON_SNAPSHOT_SLOTS; i++){
+				s->slot[i].data = NULL;
+			}
+		}
+		JSON_SNAPSHOT_EXIT();
+
+		if(s->slot[0].data == NULL){
+			return !pinned;
+		}
+		vTaskDelay(pdMS_TO_TICKS(10));
+	}
+}
@@ -0,0 +1,151 @@
+/*
+Copyright (c) 2020 Marko Juhanne
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file json_snapshot.h
+@author Marko Juhanne
+@brief Double buffered json documents that can be sent without holding the lock of their writer.
+
+A snapshot owns two buffers. The writer renders into the one nobody reads and publishes it;
+readers pin the published buffer, send it at their own pace and unpin it. A published buffer is
+never modified while it is pinned, so a slow client on a weak link never blocks the writer and
+the writer never makes a reader wait.
+
+Each version can carry a CBOR encoding of the same document next to the json text. Both are
+rendered together and pinned together, so every representation a client gets is of the same version.
+
+Pin and unpin only take a short critical section. Writers must be serialized by the caller, which
+is what the json mutex of the wifi manager and the mqtt manager already does.
+*/
+
+#ifndef JSON_SNAPSHOT_H_INCLUDED
+#define JSON_SNAPSHOT_H_INCLUDED
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** @brief Number of buffers of a snapshot: one published, one being rendered */
+#define JSON_SNAPSHOT_SLOTS					2
+
+/** @brief Bytes of storage needed by a snapshot of json documents up to capacity bytes and their CBOR encoding up to cbor_capacity bytes */
+#define JSON_SNAPSHOT_STORAGE_SIZE(capacity, cbor_capacity)		(JSON_SNAPSHOT_SLOTS * ((capacity) + (cbor_capacity)))
+
+/** @brief How long json_snapshot_retire waits for the last readers before giving up */
+#define JSON_SNAPSHOT_RETIRE_TIMEOUT_MS		10000
+
+
+typedef struct {
+	char *data;
+	uint8_t *cbor;			/* CBOR encoding of the same version, NULL if the snapshot has none */
+	uint16_t cbor_len;		/* 0 if the CBOR encoding didn't fit */
+	uint16_t refs;			/* number of readers currently sending this buffer */
+	uint32_t generation;	/* version published in this buffer */
+} json_snapshot_slot_t;
+
+typedef struct {
+	json_snapshot_slot_t slot[JSON_SNAPSHOT_SLOTS];
+	size_t capacity;		/* size in bytes of each json buffer */
+	size_t cbor_capacity;	/* size in bytes of each CBOR buffer */
+	int8_t current;			/* index of the published buffer, -1 if nothing is published */
+} json_snapshot_t;
+
+
+/**
+ * @brief Sets up a snapshot over storage, which must hold JSON_SNAPSHOT_STORAGE_SIZE(capacity, cbor_capacity) bytes. Nothing is published.
+ * @param cbor_capacity 0 if the documents have no CBOR encoding.
+ */
+void json_snapshot_init(json_snapshot_t *s, char *storage, size_t capacity, size_t cbor_capacity);
+
+/**
+ * @brief Returns a buffer of s->capacity bytes that is neither published nor pinned, to be filled then handed to json_snapshot_publish.
+ * @return NULL if the snapshot has no storage or if every buffer is still being sent. The published version stays valid.
+ * @note writers must be serialized by the caller.
+ */
+char* json_snapshot_begin_write(json_snapshot_t *s);
+
+/**
+ * @brief The buffer of s->cbor_capacity bytes receiving the CBOR encoding of the version being written in buf.
+ * @return NULL if the snapshot has no CBOR encoding.
+ */
+uint8_t* json_snapshot_cbor_buffer(json_snapshot_t *s, const char *buf);
+
+/**
+ * @brief Makes buf, returned by json_snapshot_begin_write, the version new readers get.
+ * The previously published buffer is reused once its last reader unpins it.
+ * @param cbor_len number of bytes written in the CBOR buffer of buf. 0 if there is none.
+ */
+void json_snapshot_publish(json_snapshot_t *s, char *buf, size_t cbor_len);
+
+/**
+ * @brief Pins the published version: it stays valid and unchanged until json_snapshot_unpin. Never blocks.
+ * @return the nul terminated json, or NULL if nothing is published.
+ */
+const char* json_snapshot_pin(json_snapshot_t *s);
+
+/**
+ * @brief The published version without pinning it. It stays valid as long as the caller keeps writers out, eg. by holding their lock.
+ * @return NULL if nothing is published.
+ */
+const char* json_snapshot_get(json_snapshot_t *s);
+
+/**
+ * @brief Releases a version returned by json_snapshot_pin. NULL is ignored.
+ */
+void json_snapshot_unpin(json_snapshot_t *s, const char *data);
+
+/**
+ * @brief CBOR encoding of a version returned by json_snapshot_pin or json_snapshot_get. It shares the pin of the json.
+ * @return NULL if the version has no CBOR encoding.
+ */
+const uint8_t* json_snapshot_get_cbor(const json_snapshot_t *s, const char *data, size_t *len);
+
+/**
+ * @brief Version of a document returned by json_snapshot_pin or json_snapshot_get, for use as an ETag.
+ * Every publish of every snapshot takes a new number from a counter that starts at a random value at boot,
+ * so a version is never reused by another document, another version or another boot.
+ * @return 0 if data isn't a buffer of s.
+ */
+uint32_t json_snapshot_get_generation(const json_snapshot_t *s, const char *data);
+
+/**
+ * @brief true if data is one of the buffers of s
+ */
+bool json_snapshot_owns(const json_snapshot_t *s, const char *data);
+
+/**
+ * @brief Unpublishes the snapshot and waits for its readers to unpin it, so that its storage can be freed.
+ * Pins fail from now on until json_snapshot_init is called again.
+ * @return false if a reader still holds a buffer after JSON_SNAPSHOT_RETIRE_TIMEOUT_MS: the storage must not be freed.
+ */
+bool json_snapshot_retire(json_snapshot_t *s);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JSON_SNAPSHOT_H_INCLUDED */
@@ -0,0 +1,139 @@
+/*
+Copyright (c) 2020 Marko Juhanne
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file mem_governor.c
+@author Marko Juhanne
+@brief Watches the heap and degrades the wifi manager gracefully when memory runs low.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/timers.h>
+#include <esp_system.h>
+#include <esp_wifi.h>
+#include <esp_log.h>
+
+#include "wifi_manager.h"
+#include "mem_governor.h"
+
+#ifdef ESP32
+#include <esp_heap_caps.h>
+#endif
+
+
+/* @brief tag used for ESP serial console messages */
+static const char TAG[] = "mem_governor";
+
+/* @brief software timer sampling the heap */
+static TimerHandle_t mem_governor_timer = NULL;
+
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+static StaticTimer_t mem_governor_timer_buffer;
+#endif
+
+/* @brief current pressure level. Written by the timer task only, read by everyone. */
+static volatile mem_pressure_level_t mem_governor_level = MEM_PRESSURE_NONE;
+
+
+/**
+ * @brief watermark of a given level: level 1 starts at the low watermark, the last level at the critical one
+ * and the levels in between are evenly spread.
+ */
+static size_t mem_governor_watermark(size_t low, size_t critical, int level){
+	const int last = MEM_PRESSURE_LEVEL_COUNT - 1;
+	if(critical >= low){
+		return low;
+	}
+	return low - ((low - critical) * (level - 1)) / (last - 1);
+}
+
+/**
+ * @brief maps a measured value to a pressure level. Leaving a level requires to recover MEM_GOVERNOR_HYSTERESIS
+ * bytes above its watermark.
+ */
+static mem_pressure_level_t mem_governor_level_for(size_t value, size_t low, size_t critical, mem_pressure_level_t current){
+	mem_pressure_level_t level = MEM_PRESSURE_NONE;
+	for(int l = MEM_PRESSURE_SHRINK_SCAN; l < MEM_PRESSURE_LEVEL_COUNT; l++){
+		size_t watermark = mem_governor_watermark(low, critical, l);
+		if(l <= current){
+			watermark += MEM_GOVERNOR_HYSTERESIS;
+		}
+		if(value < watermark){
+			level = (mem_pressure_level_t)l;
+		}
+	}
+	return level;
+}
+
+bool mem_governor_evaluate(){
+
+	size_t free_heap, largest_block;
+#ifdef ESP32
+	free_heap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+	largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+#else
+	free_heap = esp_get_free_heap_size();
+	largest_block = free_heap;
+#endif
+
+	mem_pressure_level_t current = mem_governor_level;
+	mem_pressure_level_t by_free = mem_governor_level_for(free_heap, MEM_GOVERNOR_FREE_HEAP_LOW, MEM_GOVERNOR_FREE_HEAP_CRITICAL, current);
+	mem_pressure_level_t by_block = mem_governor_level_for(largest_block, MEM_GOVERNOR_LARGEST_BLOCK_LOW, MEM_GOVERNOR_LARGEST_BLOCK_CRITICAL, current);
+	mem_pressure_level_t level = by_free > by_block ? by_free : by_block;
+
+	if(level != current){
+		ESP_LOGW(TAG, "memory pressure level %d -> %d (free heap: %d, largest block: %d)", current, level, (int)free_heap, (int)largest_block);
+		mem_governor_level = level;
+		return true;
+	}
+
+	return false;
+}
+
+mem_pressure_level_t mem_governor_get_level(){
+	return mem_governor_level;
+}
+
+static void mem_governor_timer_cb( TimerHandle_t xTimer ){
+	if(mem_governor_evaluate()){
+		wifi_manager_send_message(WM_EVENT_MEMORY_PRESSURE, (void*)mem_governor_level);
+	}
+}
+
+void mem_governor_start(){
+	if(MEM_GOVERNOR_PERIOD > 0 && mem_governor_timer == NULL){
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+		mem_governor_timer = xTimerCreateStatic( NULL, pdMS_TO_TICKS(MEM_GOVERNOR_PERIOD), pdTRUE, ( void * ) 0, mem_governor_timer_cb, &mem_governor_timer_buffer);
+#else
+		mem_governor_timer = xTimerCreate( NULL, pdMS_TO_TICKS(MEM_GOVERNOR_PERIOD), pdTRUE, ( void * ) 0, mem_governor_timer_cb);
+#endif
+		xTimerStart( mem_governor_timer, (TickType_t)0 );
+	}
+}
+
+void mem_governor_stop(){
+	if(mem_governor_timer){
+		xTimerDelete( mem_governor_timer, (TickType_t)0 );
+		mem_governor_timer = NULL;
+	}
+	mem_governor_level = MEM_PRESSURE_NONE;
+}
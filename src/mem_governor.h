@@ -0,0 +1,123 @@
+/*
+Copyright (c) 2020 Marko Juhanne
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file mem_governor.h
+@author Marko Juhanne
+@brief Watches the heap and degrades the wifi manager gracefully when memory runs low.
+
+The governor samples the free heap and the largest free block periodically and maps them to
+a pressure level. Each level sheds a bit more load than the previous one:
+1. the wifi scan table is shrunk
+2. new HTTP sessions are refused
+3. wifi scans are paused
+4. the MQTT outbox is capped
+
+Level changes are posted to the wifi_manager as WM_EVENT_MEMORY_PRESSURE so that applications can react too.
+*/
+
+#ifndef MEM_GOVERNOR_H_INCLUDED
+#define MEM_GOVERNOR_H_INCLUDED
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#ifdef CONFIG_WIFI_MANAGER_MEM_GOVERNOR
+
+/** @brief Time (in ms) between two samples of the heap */
+#define MEM_GOVERNOR_PERIOD						CONFIG_WIFI_MANAGER_MEM_GOVERNOR_PERIOD
+
+/** @brief Free heap (in bytes) under which the first pressure level is entered */
+#define MEM_GOVERNOR_FREE_HEAP_LOW				CONFIG_WIFI_MANAGER_MEM_GOVERNOR_FREE_HEAP_LOW
+
+/** @brief Free heap (in bytes) under which the last pressure level is entered */
+#define MEM_GOVERNOR_FREE_HEAP_CRITICAL			CONFIG_WIFI_MANAGER_MEM_GOVERNOR_FREE_HEAP_CRITICAL
+
+/** @brief Largest free block (in bytes) under which the first pressure level is entered */
+#define MEM_GOVERNOR_LARGEST_BLOCK_LOW			CONFIG_WIFI_MANAGER_MEM_GOVERNOR_LARGEST_BLOCK_LOW
+
+/** @brief Largest free block (in bytes) under which the last pressure level is entered */
+#define MEM_GOVERNOR_LARGEST_BLOCK_CRITICAL		CONFIG_WIFI_MANAGER_MEM_GOVERNOR_LARGEST_BLOCK_CRITICAL
+
+#else
+
+/* governor disabled in menuconfig: mem_governor_start does nothing and the level stays at MEM_PRESSURE_NONE */
+#define MEM_GOVERNOR_PERIOD						0
+#define MEM_GOVERNOR_FREE_HEAP_LOW				0
+#define MEM_GOVERNOR_FREE_HEAP_CRITICAL			0
+#define MEM_GOVERNOR_LARGEST_BLOCK_LOW			0
+#define MEM_GOVERNOR_LARGEST_BLOCK_CRITICAL		0
+
+#endif
+
+/**
+ * @brief Number of bytes the heap has to recover above a watermark before the level goes down again.
+ * This avoids flip-flopping between two levels when the heap hovers around a watermark.
+ */
+#define MEM_GOVERNOR_HYSTERESIS					1024
+
+
+/**
+ * @brief Memory pressure levels. Each level includes the measures of the levels below it.
+ */
+typedef enum mem_pressure_level_t {
+	MEM_PRESSURE_NONE = 0,
+	MEM_PRESSURE_SHRINK_SCAN = 1,		/* the scan records are reallocated for fewer access points */
+	MEM_PRESSURE_REFUSE_SESSIONS = 2,	/* new HTTP sessions are refused */
+	MEM_PRESSURE_PAUSE_SCAN = 3,		/* scan requests are ignored */
+	MEM_PRESSURE_CAP_MQTT = 4,			/* MQTT publishes that would grow the outbox are refused */
+	MEM_PRESSURE_LEVEL_COUNT = 5
+}mem_pressure_level_t;
+
+
+/**
+ * @brief Starts sampling the heap. Calling it while the governor already runs does nothing.
+ */
+void mem_governor_start();
+
+/**
+ * @brief Stops sampling the heap and goes back to MEM_PRESSURE_NONE.
+ */
+void mem_governor_stop();
+
+/**
+ * @brief Samples the heap now and updates the pressure level.
+ * @return true if the level changed.
+ */
+bool mem_governor_evaluate();
+
+/**
+ * @brief Current pressure level. This is a cheap read that can be called from any task.
+ */
+mem_pressure_level_t mem_governor_get_level();
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MEM_GOVERNOR_H_INCLUDED */
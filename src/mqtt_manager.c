@@ -16,9 +16,15 @@
 
 #include "esp_wifi.h"
 #include "esp_log.h"
+#include "esp_idf_version.h"
 
 #include "wifi_manager.h"
 #include "mqtt_manager.h"
+#include "http_app.h"
+#include "mem_governor.h"
+#include "json.h"
+#include "json_snapshot.h"
+#include "cbor.h"
 
 static const char *TAG = "mqtt_manager";
 
@@ -59,9 +65,32 @@ TaskHandle_t task_mqtt_manager;
 /* @brief Array of callback function pointers */
 static void (**cb_ptr_arr)(void*) = NULL;
 
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+/* @brief backing storage of every RTOS object and buffer of the mqtt manager: nothing is taken from the heap */
+static StaticQueue_t mqtt_manager_queue_buffer;
+static uint8_t mqtt_manager_queue_storage[MQTT_MANAGER_QUEUE_LENGTH * sizeof(mqtt_queue_message)];
+static StaticEventGroup_t mqtt_conn_event_group_buffer;
+static StaticSemaphore_t mqtt_manager_json_mutex_buffer;
+static StaticTimer_t mqtt_manager_retry_timer_buffer;
+static StaticTask_t task_mqtt_manager_buffer;
+static StackType_t task_mqtt_manager_stack[MQTT_MANAGER_TASK_STACK_SIZE / sizeof(StackType_t)];
+static char mqtt_info_json_buffer[JSON_SNAPSHOT_STORAGE_SIZE(JSON_MQTT_INFO_SIZE, CBOR_MQTT_INFO_SIZE)];
+static void (*cb_ptr_arr_buffer[MM_MESSAGE_CODE_COUNT])(void*);
+#endif
+
 
 char *mqtt_info_json = NULL;
 
+/* @brief the mqtt status json, double buffered over mqtt_info_json so that the http server sends it without holding the json mutex */
+static json_snapshot_t mqtt_info_snapshot;
+
+/* @brief state the mqtt status json has to show. It is only rendered into mqtt_info_json when read. Protected by the json mutex. */
+static bool mqtt_info_json_dirty = true;
+static bool mqtt_info_json_set = false;		/* false: the json is cleared to {} */
+static mqtt_update_reason_code_t mqtt_info_json_reason;
+static char mqtt_info_json_error[MAX_ERROR_STRING_LEN];
+static uint32_t mqtt_info_json_generation = 0;
+
 
 void mqtt_manager_subscribe( const char * topic ) {
 	ESP_LOGI(TAG,"Subscribe to %s", topic);
@@ -74,6 +103,14 @@ void mqtt_manager_unsubscribe( const char * topic ) {
 }
 
 int mqtt_manager_publish(  const char *topic, const char *data, int len, int qos, int retain ) {
+#if defined(CONFIG_WIFI_MANAGER_MEM_GOVERNOR) && ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 3, 0)
+	/* messages with qos > 0 are kept in the outbox until acknowledged: cap it when memory runs low */
+	if(qos > 0 && mem_governor_get_level() >= MEM_PRESSURE_CAP_MQTT &&
+		esp_mqtt_client_get_outbox_size(mqtt_client) > MQTT_MANAGER_OUTBOX_CAP){
+		ESP_LOGW(TAG, "Publish to %s refused: outbox capped under memory pressure", topic);
+		return -1;
+	}
+#endif
     return esp_mqtt_client_publish(mqtt_client, topic, data, len, qos, retain);   
 }
 
@@ -250,34 +287,127 @@ void mqtt_manager_unlock_json_buffer(){
 }
 
 void mqtt_manager_clear_json(){
-	strcpy(mqtt_info_json, "{}\n");
+	mqtt_info_json_set = false;
+	mqtt_info_json_dirty = true;
+	mqtt_info_json_generation++;
+}
+
+/**
+ * @brief Renders the mqtt status from the state recorded by mqtt_manager_generate_json: the json into buf, of JSON_MQTT_INFO_SIZE bytes,
+ * and its CBOR encoding into cbor, of CBOR_MQTT_INFO_SIZE bytes, unless it is NULL.
+ * @note to be called with the json buffer locked.
+ * @return the length of the CBOR encoding.
+ */
+static size_t mqtt_manager_render_json(char *buf, uint8_t *cbor){
+
+	if(!mqtt_info_json_set){
+		strcpy(buf, "{}\n");
+		if(cbor){
+			/* empty map */
+			cbor[0] = 0xa0;
+			return 1;
+		}
+		return 0;
+	}
+
+	json_writer_t w;
+	json_writer_init(&w, buf, JSON_MQTT_INFO_SIZE);
+	json_writer_begin_object(&w);
+	json_writer_key(&w, "uri");
+	json_writer_string(&w, mqtt_config.uri);
+	json_writer_key(&w, "urc");
+	json_writer_int(&w, (int32_t)mqtt_info_json_reason);
+	json_writer_key(&w, "error");
+	json_writer_string(&w, mqtt_info_json_error);
+	json_writer_end_object(&w);
+	json_writer_raw(&w, "\n");
+
+	if(!json_writer_finish(&w)){
+		ESP_LOGE(TAG, "mqtt json does not fit in %d bytes", JSON_MQTT_INFO_SIZE);
+		strcpy(buf, "{}\n");
+	}
+	ESP_LOGD(TAG,"json %s", buf);
+
+	if(cbor == NULL){
+		return 0;
+	}
+
+	cbor_writer_t c;
+	cbor_writer_init(&c, cbor, CBOR_MQTT_INFO_SIZE);
+	cbor_writer_map(&c, 3);
+	cbor_writer_text(&c, "uri");
+	cbor_writer_text_n(&c, mqtt_config.uri, sizeof(mqtt_config.uri));
+	cbor_writer_text(&c, "urc");
+	cbor_writer_int(&c, (int32_t)mqtt_info_json_reason);
+	cbor_writer_text(&c, "error");
+	cbor_writer_text(&c, mqtt_info_json_error);
+
+	size_t len = cbor_writer_finish(&c);
+	if(len == 0){
+		ESP_LOGE(TAG, "mqtt cbor does not fit in %d bytes", CBOR_MQTT_INFO_SIZE);
+	}
+	return len;
+}
+
+/**
+ * @brief Renders the status json and its CBOR encoding into the free buffer of the snapshot and publishes it, if the status changed since it was last rendered.
+ * When both buffers are still being sent the json stays dirty and the next reader tries again.
+ * @note to be called with the json buffer locked.
+ */
+static void mqtt_manager_refresh_json(){
+	if(mqtt_info_json_dirty){
+		char *buf = json_snapshot_begin_write(&mqtt_info_snapshot);
+		if(buf){
+			size_t cbor_len = mqtt_manager_render_json(buf, json_snapshot_cbor_buffer(&mqtt_info_snapshot, buf));
+			json_snapshot_publish(&mqtt_info_snapshot, buf, cbor_len);
+			mqtt_info_json_dirty = false;
+		}
+	}
 }
 
 char* mqtt_manager_get_info_json() {
-	return mqtt_info_json;
+	/* nothing is rendered until someone actually reads the status: headless devices never pay for it */
+	mqtt_manager_refresh_json();
+	return (char*)json_snapshot_get(&mqtt_info_snapshot);
 }
 
-void mqtt_manager_generate_json(mqtt_update_reason_code_t update_reason_code, const char * error_string){
-	if (mqtt_manager_lock_json_buffer( portMAX_DELAY )) {
+const char* mqtt_manager_pin_info_json(){
+	/* the json mutex is only held while rendering, never while the json is sent. If it is busy the previous status is served */
+	if(mqtt_info_json_dirty && mqtt_manager_lock_json_buffer(( TickType_t ) 10)){
+		mqtt_manager_refresh_json();
+		mqtt_manager_unlock_json_buffer();
+	}
+	return json_snapshot_pin(&mqtt_info_snapshot);
+}
 
-		const char *json_format = "{\"uri\":\"%s\",\"urc\":%d, \"error\":\"%s\"}\n";
-		const char empty_str[1] = "";
-		const char * error_str;
+const uint8_t* mqtt_manager_get_pinned_info_cbor(const char *json, size_t *len){
+	return json_snapshot_get_cbor(&mqtt_info_snapshot, json, len);
+}
 
-		if (error_string)
-			error_str = error_string; 
-		else
-			error_str = empty_str;
+void mqtt_manager_unpin_info_json(const char *json){
+	json_snapshot_unpin(&mqtt_info_snapshot, json);
+}
 
-		memset(mqtt_info_json, 0x00, JSON_MQTT_INFO_SIZE);
+uint32_t mqtt_manager_get_pinned_info_version(const char *json){
+	return json_snapshot_get_generation(&mqtt_info_snapshot, json);
+}
 
-		snprintf( mqtt_info_json, JSON_MQTT_INFO_SIZE, json_format,
-				mqtt_config.uri,
-				(int)update_reason_code,
-				error_str);
-		ESP_LOGI(TAG,"json %s", mqtt_info_json);
+uint32_t mqtt_manager_get_info_generation(){
+	return mqtt_info_json_generation;
+}
+
+void mqtt_manager_generate_json(mqtt_update_reason_code_t update_reason_code, const char * error_string){
+	if (mqtt_manager_lock_json_buffer( portMAX_DELAY )) {
+
+		/* the error string is copied: the caller's buffer is reused by the next error */
+		mqtt_info_json_set = true;
+		mqtt_info_json_reason = update_reason_code;
+		snprintf(mqtt_info_json_error, sizeof(mqtt_info_json_error), "%s", error_string ? error_string : "");
+		mqtt_info_json_dirty = true;
+		mqtt_info_json_generation++;
 
 		mqtt_manager_unlock_json_buffer();
+		http_app_notify(HTTP_APP_EVENT_MQTT);
 	}
 }
 
@@ -354,7 +484,7 @@ static esp_err_t mqtt_event_handler_cb(esp_mqtt_event_handle_t event)
     switch (event->event_id) {
         case MQTT_EVENT_CONNECTED:
             ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
-			ESP_LOGW(TAG," Heap: %d", esp_get_free_heap_size());
+			ESP_LOGD(TAG," Heap: %d (pressure level %d)", esp_get_free_heap_size(), mem_governor_get_level());
 			mqtt_manager_send_message( MM_EVENT_MQTT_CONNECTED, NULL );
             break;
         case MQTT_EVENT_DISCONNECTED:
@@ -419,7 +549,7 @@ static esp_err_t mqtt_event_handler_cb(esp_mqtt_event_handle_t event)
 #endif
         default:
             ESP_LOGI(TAG, "Other event id:%d", event->event_id);
-			ESP_LOGW(TAG," Heap: %d", esp_get_free_heap_size());
+			ESP_LOGD(TAG," Heap: %d (pressure level %d)", esp_get_free_heap_size(), mem_governor_get_level());
             break;
     }
 
@@ -490,7 +620,7 @@ void mqtt_manager_task( void * pvParameters ) {
 	for(;;){
 		xStatus = xQueueReceive( mqtt_manager_queue, &msg, portMAX_DELAY );
 
-		ESP_LOGW(TAG," Heap: %d", esp_get_free_heap_size());
+		ESP_LOGD(TAG," Heap: %d (pressure level %d)", esp_get_free_heap_size(), mem_governor_get_level());
 
 		if( xStatus == pdPASS ){
 			switch(msg.code){
@@ -572,7 +702,7 @@ void mqtt_manager_task( void * pvParameters ) {
 				            	#ifdef ESP32
 									esp_mqtt_client_register_event(mqtt_client, ESP_EVENT_ANY_ID, mqtt_event_handler, mqtt_client);
 								#endif
-								ESP_LOGW(TAG," Heap: %d", esp_get_free_heap_size());
+								ESP_LOGD(TAG," Heap: %d (pressure level %d)", esp_get_free_heap_size(), mem_governor_get_level());
 					            ESP_LOGI(TAG,"Starting MQTT client ..");
 				                if (esp_mqtt_client_start(mqtt_client) != ESP_OK) {
 					                snprintf(mqtt_error_string, MAX_ERROR_STRING_LEN, "Could not start MQTT client!");
@@ -689,11 +819,20 @@ void mqtt_manager_start() {
 	ESP_LOGI(TAG,"MQTT manager start");
 	//esp_log_level_set("httpd_parse", ESP_LOG_DEBUG);
 
-	mqtt_manager_queue = xQueueCreate( 3, sizeof( mqtt_queue_message) );
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+	mqtt_manager_queue = xQueueCreateStatic( MQTT_MANAGER_QUEUE_LENGTH, sizeof( mqtt_queue_message), mqtt_manager_queue_storage, &mqtt_manager_queue_buffer );
+	mqtt_conn_event_group = xEventGroupCreateStatic( &mqtt_conn_event_group_buffer );
+
+	mqtt_manager_json_mutex = xSemaphoreCreateMutexStatic( &mqtt_manager_json_mutex_buffer );
+	mqtt_info_json = mqtt_info_json_buffer;
+#else
+	mqtt_manager_queue = xQueueCreate( MQTT_MANAGER_QUEUE_LENGTH, sizeof( mqtt_queue_message) );
 	mqtt_conn_event_group = xEventGroupCreate();
 
 	mqtt_manager_json_mutex = xSemaphoreCreateMutex();
-	mqtt_info_json = (char*)malloc(sizeof(char) * JSON_MQTT_INFO_SIZE);
+	mqtt_info_json = (char*)malloc(sizeof(char) * JSON_SNAPSHOT_STORAGE_SIZE(JSON_MQTT_INFO_SIZE, CBOR_MQTT_INFO_SIZE));
+#endif
+	json_snapshot_init(&mqtt_info_snapshot, mqtt_info_json, JSON_MQTT_INFO_SIZE, CBOR_MQTT_INFO_SIZE);
 	mqtt_manager_clear_json();
 
 	if (mqtt_manager_fetch_config()) {
@@ -710,14 +849,21 @@ void mqtt_manager_start() {
 	}
 
 	/* create timer for to keep track of retries */
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+	mqtt_manager_retry_timer = xTimerCreateStatic( NULL, pdMS_TO_TICKS(MQTT_MANAGER_RETRY_TIMER), pdFALSE, ( void * ) 0, mqtt_manager_timer_retry_cb, &mqtt_manager_retry_timer_buffer);
+	cb_ptr_arr = cb_ptr_arr_buffer;
+#else
 	mqtt_manager_retry_timer = xTimerCreate( NULL, pdMS_TO_TICKS(MQTT_MANAGER_RETRY_TIMER), pdFALSE, ( void * ) 0, mqtt_manager_timer_retry_cb);
-
-
 	cb_ptr_arr = malloc(sizeof(void (*)(void*)) * MM_MESSAGE_CODE_COUNT);
+#endif
 	for(int i=0; i<MM_MESSAGE_CODE_COUNT; i++){
 		cb_ptr_arr[i] = NULL;
 	}
 
     ESP_LOGI(TAG,"Create MQTT manager task..");
-	xTaskCreate(&mqtt_manager_task, "task_mqtt_manager", 4096, NULL, MQTT_MANAGER_TASK_PRIORITY, &task_mqtt_manager);
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+	task_mqtt_manager = wifi_manager_create_task(WM_TASK_MQTT_MANAGER, &mqtt_manager_task, "task_mqtt_manager", NULL, task_mqtt_manager_stack, &task_mqtt_manager_buffer);
+#else
+	task_mqtt_manager = wifi_manager_create_task(WM_TASK_MQTT_MANAGER, &mqtt_manager_task, "task_mqtt_manager", NULL, NULL, NULL);
+#endif
 }
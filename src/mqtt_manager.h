@@ -30,11 +30,24 @@ SOFTWARE.
 #define MAX_MQTT_PWD_SIZE 32
 */
 #include "mqtt_config.h"
+#include "cbor.h"
 
 #define MQTT_MANAGER_TASK_PRIORITY			CONFIG_MQTT_MANAGER_TASK_PRIORITY
 
+/** @brief Core the mqtt_manager task is pinned to. -1 means no affinity */
+#define MQTT_MANAGER_TASK_CORE				CONFIG_MQTT_MANAGER_TASK_CORE
+
+/** @brief Stack size (in bytes) of the mqtt_manager task */
+#define MQTT_MANAGER_TASK_STACK_SIZE		CONFIG_MQTT_MANAGER_TASK_STACK_SIZE
+
+/** @brief Number of messages the mqtt_manager queue can hold */
+#define MQTT_MANAGER_QUEUE_LENGTH			3
+
 #define MQTT_MANAGER_RETRY_TIMER			CONFIG_MQTT_MANAGER_RETRY_TIMER
 
+/** @brief Outbox size (in bytes) above which qos > 0 publishes are refused under heavy memory pressure. @see mem_governor.h */
+#define MQTT_MANAGER_OUTBOX_CAP				CONFIG_MQTT_MANAGER_OUTBOX_CAP
+
 
 /**
  * @brief Defines the maximum length in bytes of a JSON representation of the MQTT information
@@ -52,6 +65,12 @@ SOFTWARE.
 // TODO
 #define JSON_MQTT_INFO_SIZE 					256
 
+/**
+ * @brief Defines the maximum length in bytes of the CBOR representation of the MQTT status, 0 if CBOR is disabled.
+ * map header 1, "uri" 4 + 3 + MQTT_MAX_HOST_LEN, "urc" 4 + 1, "error" 6 + 2 + 63 (the error string is truncated to 63 characters).
+ */
+#define CBOR_MQTT_INFO_SIZE					(CBOR_ENABLED ? 84 + MQTT_MAX_HOST_LEN : 0)
+
 
 /**
  * @brief simplified reason codes for a MQTT connection status update
@@ -150,8 +169,41 @@ void mqtt_manager_set_password(const char * pwd);
 bool mqtt_manager_fetch_config();
 esp_err_t mqtt_manager_save_config();
 
+/**
+ * @brief Returns the mqtt status json, rendering it first if the status changed since the last read.
+ * @note to be called with the json buffer locked, see mqtt_manager_lock_json_buffer.
+ */
 char* mqtt_manager_get_info_json();
 
+/**
+ * @brief Pins the latest mqtt status json so that it can be sent without holding the json mutex.
+ * The mutex is only taken briefly to render a newer status; if it is busy the previous status is returned.
+ * @return NULL if no status exists yet, otherwise a json to release with mqtt_manager_unpin_info_json.
+ */
+const char* mqtt_manager_pin_info_json();
+
+/**
+ * @brief CBOR encoding of a json pinned by mqtt_manager_pin_info_json. It stays valid until the json is unpinned.
+ * @return NULL if CBOR is disabled or the encoding didn't fit.
+ */
+const uint8_t* mqtt_manager_get_pinned_info_cbor(const char *json, size_t *len);
+
+/**
+ * @brief Releases a json returned by mqtt_manager_pin_info_json. NULL is ignored.
+ */
+void mqtt_manager_unpin_info_json(const char *json);
+
+/**
+ * @brief Version of a json pinned by mqtt_manager_pin_info_json, never the same for two different documents.
+ * @return 0 for NULL.
+ */
+uint32_t mqtt_manager_get_pinned_info_version(const char *json);
+
+/**
+ * @brief Number of changes of the mqtt status since boot. It changes whenever the status json would.
+ */
+uint32_t mqtt_manager_get_info_generation();
+
 void mqtt_manager_start();
 
 
@@ -31,15 +31,24 @@ SOFTWARE.
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
 #include <esp_err.h>
+#include "sdkconfig.h"
 #include "nvs_sync.h"
 
 
 static SemaphoreHandle_t nvs_sync_mutex = NULL;
 
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+static StaticSemaphore_t nvs_sync_mutex_buffer;
+#endif
+
 esp_err_t nvs_sync_create(){
     if(nvs_sync_mutex == NULL){
 
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+        nvs_sync_mutex = xSemaphoreCreateMutexStatic(&nvs_sync_mutex_buffer);
+#else
         nvs_sync_mutex = xSemaphoreCreateMutex();
+#endif
 
 		if(nvs_sync_mutex){
 			return ESP_OK;
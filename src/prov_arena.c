@@ -0,0 +1,195 @@
+/*
+Copyright (c) 2020 Marko Juhanne
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file prov_arena.c
+@author Marko Juhanne
+@brief Bump allocator holding every buffer that only the provisioning portal needs.
+
+@see prov_arena.h
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <esp_log.h>
+
+#include "prov_arena.h"
+
+
+/* @brief tag used for ESP serial console messages */
+static const char TAG[] = "prov_arena";
+
+/**
+ * @brief header in front of every arena block. It only holds the size of the block, which is
+ * what's needed to roll the arena back when the last block is freed.
+ */
+typedef struct {
+	size_t size;
+} __attribute__((aligned(PROV_ARENA_ALIGN))) prov_arena_header_t;
+
+static uint8_t *arena = NULL;
+
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+/* @brief backing store of the arena. "Destroying" the arena only marks it unused */
+static uint8_t arena_storage[PROV_ARENA_SIZE > 0 ? PROV_ARENA_SIZE : 1] __attribute__((aligned(PROV_ARENA_ALIGN)));
+static StaticSemaphore_t arena_mutex_buffer;
+#endif
+static size_t arena_used = 0;
+static size_t arena_peak = 0;
+static size_t arena_fallbacks = 0;
+
+/* @brief the http server and the wifi manager both allocate from the arena */
+static SemaphoreHandle_t arena_mutex = NULL;
+
+
+static size_t prov_arena_round_up(size_t size){
+	return (size + PROV_ARENA_ALIGN - 1) & ~(size_t)(PROV_ARENA_ALIGN - 1);
+}
+
+bool prov_arena_create(){
+
+	if(PROV_ARENA_SIZE == 0){
+		return false;
+	}
+
+	if(arena_mutex == NULL){
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+		arena_mutex = xSemaphoreCreateMutexStatic(&arena_mutex_buffer);
+#else
+		arena_mutex = xSemaphoreCreateMutex();
+#endif
+		if(arena_mutex == NULL){
+			return false;
+		}
+	}
+
+	xSemaphoreTake(arena_mutex, portMAX_DELAY);
+	if(arena == NULL){
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+		arena = arena_storage;
+#else
+		arena = (uint8_t*)malloc(PROV_ARENA_SIZE);
+#endif
+		arena_used = 0;
+		arena_peak = 0;
+		arena_fallbacks = 0;
+		if(arena){
+			ESP_LOGI(TAG, "created (%d bytes)", PROV_ARENA_SIZE);
+		}
+		else{
+			ESP_LOGW(TAG, "could not allocate %d bytes: portal buffers will come from the heap", PROV_ARENA_SIZE);
+		}
+	}
+	bool ret = (arena != NULL);
+	xSemaphoreGive(arena_mutex);
+
+	return ret;
+}
+
+void prov_arena_destroy(){
+
+	if(arena_mutex == NULL){
+		return;
+	}
+
+	xSemaphoreTake(arena_mutex, portMAX_DELAY);
+	if(arena){
+#ifndef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+		free(arena);
+#endif
+		arena = NULL;
+		ESP_LOGI(TAG, "released. Peak usage: %d/%d bytes, %d heap fallbacks", (int)arena_peak, PROV_ARENA_SIZE, (int)arena_fallbacks);
+	}
+	arena_used = 0;
+	xSemaphoreGive(arena_mutex);
+}
+
+void* prov_arena_alloc(size_t size){
+
+	void *ret = NULL;
+
+	if(arena_mutex){
+		xSemaphoreTake(arena_mutex, portMAX_DELAY);
+		if(arena){
+			size_t needed = sizeof(prov_arena_header_t) + prov_arena_round_up(size);
+			if(arena_used + needed <= PROV_ARENA_SIZE){
+				prov_arena_header_t *header = (prov_arena_header_t*)(arena + arena_used);
+				header->size = needed;
+				ret = (void*)(header + 1);
+				arena_used += needed;
+				if(arena_used > arena_peak){
+					arena_peak = arena_used;
+				}
+			}
+			else{
+				arena_fallbacks++;
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+				ESP_LOGW(TAG, "arena full: %d bytes taken from the heap. Increase the arena size", (int)size);
+#endif
+			}
+		}
+		xSemaphoreGive(arena_mutex);
+	}
+
+	if(ret == NULL){
+		ret = malloc(size);
+	}
+
+	return ret;
+}
+
+void prov_arena_free(void *ptr){
+
+	if(ptr == NULL){
+		return;
+	}
+
+	if(arena_mutex){
+		xSemaphoreTake(arena_mutex, portMAX_DELAY);
+		if(arena && (uint8_t*)ptr >= arena && (uint8_t*)ptr < arena + PROV_ARENA_SIZE){
+			prov_arena_header_t *header = (prov_arena_header_t*)ptr - 1;
+			/* last block allocated: roll the arena back. Anything else waits for prov_arena_destroy */
+			if((uint8_t*)header + header->size == arena + arena_used){
+				arena_used -= header->size;
+			}
+			xSemaphoreGive(arena_mutex);
+			return;
+		}
+		xSemaphoreGive(arena_mutex);
+	}
+
+	free(ptr);
+}
+
+bool prov_arena_owns(const void *ptr){
+	/* no lock: the arena is only created and destroyed by the wifi manager task */
+	return arena && (const uint8_t*)ptr >= arena && (const uint8_t*)ptr < arena + PROV_ARENA_SIZE;
+}
+
+bool prov_arena_is_active(){
+	return arena != NULL;
+}
+
+size_t prov_arena_get_peak(){
+	return arena_peak;
+}
@@ -0,0 +1,105 @@
+/*
+Copyright (c) 2020 Marko Juhanne
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file prov_arena.h
+@author Marko Juhanne
+@brief Bump allocator holding every buffer that only the provisioning portal needs.
+
+The arena is created when the access point starts and destroyed when it stops, which hands a
+single contiguous block back to the heap instead of many small ones scattered around.
+Blocks are carved out sequentially; freeing the most recent block rolls the arena back so that
+short lived allocations (eg. one per HTTP request) don't eat it up.
+
+When the arena doesn't exist or is full, allocations fall back to the heap. prov_arena_free
+recognizes such blocks and hands them to free(), so callers never need to know where a block lives.
+*/
+
+#ifndef PROV_ARENA_H_INCLUDED
+#define PROV_ARENA_H_INCLUDED
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** @brief Size (in bytes) of the provisioning arena. 0 disables it and every allocation goes to the heap. */
+#ifdef CONFIG_WIFI_MANAGER_PROV_ARENA_SIZE
+#define PROV_ARENA_SIZE						CONFIG_WIFI_MANAGER_PROV_ARENA_SIZE
+#else
+#define PROV_ARENA_SIZE						0
+#endif
+
+/** @brief Alignment of every block returned by the arena */
+#define PROV_ARENA_ALIGN					8
+
+
+/**
+ * @brief Allocates the arena. Calling it while the arena exists does nothing.
+ * @return true if the arena exists after the call.
+ */
+bool prov_arena_create();
+
+/**
+ * @brief Releases the arena in one go and logs its peak usage.
+ * @warning every block carved from the arena becomes invalid. Owners must have dropped their pointers before.
+ */
+void prov_arena_destroy();
+
+/**
+ * @brief Allocates size bytes from the arena, or from the heap if the arena doesn't exist or is full.
+ * @return the block or NULL if neither the arena nor the heap could provide it.
+ */
+void* prov_arena_alloc(size_t size);
+
+/**
+ * @brief Releases a block returned by prov_arena_alloc.
+ * Heap blocks are freed. Arena blocks are reclaimed if they are the last ones allocated, otherwise
+ * their space is reclaimed when the arena is destroyed. NULL is ignored.
+ */
+void prov_arena_free(void *ptr);
+
+/**
+ * @brief true if ptr points inside the current arena
+ */
+bool prov_arena_owns(const void *ptr);
+
+/**
+ * @brief true if the arena currently exists
+ */
+bool prov_arena_is_active();
+
+/**
+ * @brief Highest number of bytes used in the arena since it was created
+ */
+size_t prov_arena_get_peak();
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PROV_ARENA_H_INCLUDED */
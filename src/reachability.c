@@ -0,0 +1,386 @@
+/*
+Copyright (c) 2020 Marko Juhanne
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file reachability.c
+@author Marko Juhanne
+@brief Checks that the network the STA joined actually reaches the outside world.
+
+@see reachability.h
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <esp_wifi.h>
+#include <esp_log.h>
+#include <lwip/err.h>
+#include <lwip/sockets.h>
+#include <lwip/netdb.h>
+
+#include "wifi_manager.h"
+#include "reachability.h"
+
+
+/* @brief tag used for ESP serial console messages */
+static const char TAG[] = "reachability";
+
+/* @brief probe task, created the first time the probe is started and then kept waiting for the next start */
+static TaskHandle_t task_reachability = NULL;
+
+/* @brief protects the target and the last result */
+static SemaphoreHandle_t reachability_mutex = NULL;
+
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+static StaticSemaphore_t reachability_mutex_buffer;
+static StackType_t task_reachability_stack[REACHABILITY_TASK_STACK_SIZE / sizeof(StackType_t)];
+static StaticTask_t task_reachability_buffer;
+#endif
+
+/* @brief bumped by every start and stop: a probe that finishes with a different run number is stale and dropped */
+static volatile uint32_t reachability_run = 0;
+
+/* @brief true between reachability_start and reachability_stop */
+static volatile bool reachability_armed = false;
+
+static reachability_mode_t reachability_mode = REACHABILITY_MODE;
+static char reachability_host[REACHABILITY_HOST_SIZE] = REACHABILITY_HOST;
+static uint16_t reachability_port = REACHABILITY_PORT;
+static char reachability_path[REACHABILITY_PATH_SIZE] = REACHABILITY_PATH;
+
+static reachability_result_t reachability_result = { false, -1, -1, -1 };
+
+
+static void reachability_create_mutex(){
+	if(reachability_mutex == NULL){
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+		reachability_mutex = xSemaphoreCreateMutexStatic(&reachability_mutex_buffer);
+#else
+		reachability_mutex = xSemaphoreCreateMutex();
+#endif
+	}
+}
+
+static void reachability_reset_result(reachability_result_t *result){
+	result->ok = false;
+	result->dns_ms = -1;
+	result->tcp_ms = -1;
+	result->ttfb_ms = -1;
+}
+
+/**
+ * @brief elapsed ms since a time returned by esp_timer_get_time
+ */
+static int32_t reachability_ms_since(int64_t start){
+	return (int32_t)((esp_timer_get_time() - start) / 1000);
+}
+
+/**
+ * @brief waits until the socket is readable or writable, without going over the deadline of the probe.
+ * @return true if the socket is ready.
+ */
+static bool reachability_wait(int s, bool write, int64_t deadline){
+	int64_t left = deadline - esp_timer_get_time();
+	if(left <= 0){
+		return false;
+	}
+
+	struct timeval tv;
+	tv.tv_sec = left / 1000000;
+	tv.tv_usec = left % 1000000;
+
+	fd_set fds;
+	FD_ZERO(&fds);
+	FD_SET(s, &fds);
+
+	return select(s + 1, write ? NULL : &fds, write ? &fds : NULL, NULL, &tv) > 0;
+}
+
+/**
+ * @brief runs one probe against the current target and fills the result.
+ */
+static void reachability_probe(reachability_result_t *result){
+
+	reachability_mode_t mode;
+	char host[REACHABILITY_HOST_SIZE];
+	char path[REACHABILITY_PATH_SIZE];
+	char port[6];
+
+	xSemaphoreTake(reachability_mutex, portMAX_DELAY);
+	mode = reachability_mode;
+	strcpy(host, reachability_host);
+	strcpy(path, reachability_path);
+	snprintf(port, sizeof(port), "%u", (unsigned)reachability_port);
+	xSemaphoreGive(reachability_mutex);
+
+	reachability_reset_result(result);
+
+	int64_t start = esp_timer_get_time();
+	int64_t deadline = start + (int64_t)REACHABILITY_TIMEOUT * 1000;
+
+	/* DNS. lwip applies its own timeout to the resolution */
+	struct addrinfo hints;
+	struct addrinfo *res = NULL;
+	memset(&hints, 0x00, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if(getaddrinfo(host, port, &hints, &res) != 0 || res == NULL){
+		ESP_LOGW(TAG, "could not resolve %s", host);
+		return;
+	}
+	result->dns_ms = reachability_ms_since(start);
+
+	/* TCP handshake, non blocking so that it can't outlive the probe timeout */
+	int s = socket(res->ai_family, res->ai_socktype, 0);
+	if(s < 0){
+		ESP_LOGE(TAG, "could not create socket");
+		freeaddrinfo(res);
+		return;
+	}
+	fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+
+	int64_t connect_start = esp_timer_get_time();
+	int ret = connect(s, res->ai_addr, res->ai_addrlen);
+	freeaddrinfo(res);
+
+	if(ret < 0 && errno != EINPROGRESS){
+		ESP_LOGW(TAG, "connect to %s:%s failed: errno %d", host, port, errno);
+		close(s);
+		return;
+	}
+	if(ret < 0){
+		int err = 0;
+		socklen_t err_len = sizeof(err);
+		if(!reachability_wait(s, true, deadline) || getsockopt(s, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0 || err != 0){
+			ESP_LOGW(TAG, "connect to %s:%s failed or timed out", host, port);
+			close(s);
+			return;
+		}
+	}
+	result->tcp_ms = reachability_ms_since(connect_start);
+
+	if(mode == REACHABILITY_MODE_TCP){
+		result->ok = true;
+		close(s);
+		return;
+	}
+
+	/* HTTP: the request is tiny and fits in the send buffer of a fresh connection */
+	char buf[REACHABILITY_HOST_SIZE + REACHABILITY_PATH_SIZE + 64];
+	int len = snprintf(buf, sizeof(buf), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n", path, host);
+	int64_t request_start = esp_timer_get_time();
+	if(send(s, buf, len, 0) != len){
+		ESP_LOGW(TAG, "could not send request to %s", host);
+		close(s);
+		return;
+	}
+
+	/* status line: "HTTP/1.1 204 ..." */
+	int received = 0;
+	while(received < 12 && reachability_wait(s, false, deadline)){
+		int r = recv(s, buf + received, 12 - received, 0);
+		if(r <= 0){
+			break;
+		}
+		if(received == 0){
+			result->ttfb_ms = reachability_ms_since(request_start);
+		}
+		received += r;
+	}
+	close(s);
+
+	if(received == 12 && strncmp(buf, "HTTP/1.", 7) == 0 && buf[9] == '2'){
+		result->ok = true;
+	}
+	else{
+		ESP_LOGW(TAG, "no 2xx answer from %s%s", host, path);
+	}
+}
+
+static void reachability_task(void *pvParameters){
+
+	/* run number of the last probe that passed: a start notification left pending while probing must not probe again */
+	uint32_t passed_run = reachability_run - 1;
+
+	for(;;){
+		/* wait for reachability_start */
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+		while(reachability_armed && reachability_run != passed_run){
+			uint32_t run = reachability_run;
+			reachability_result_t result;
+
+			reachability_probe(&result);
+
+			ESP_LOGI(TAG, "probe %s: dns %d ms, tcp %d ms, ttfb %d ms", result.ok ? "passed" : "failed",
+					(int)result.dns_ms, (int)result.tcp_ms, (int)result.ttfb_ms);
+
+			/* the connection may have been lost, or a new one made, while probing */
+			bool stale;
+			xSemaphoreTake(reachability_mutex, portMAX_DELAY);
+			stale = (run != reachability_run);
+			if(!stale){
+				reachability_result = result;
+			}
+			xSemaphoreGive(reachability_mutex);
+
+			if(stale){
+				continue;
+			}
+
+			wifi_manager_send_message(WM_EVENT_STA_REACHABILITY, NULL);
+
+			if(result.ok){
+				passed_run = run;
+				break;
+			}
+
+			/* retry later unless started again or stopped in the meantime */
+			ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(REACHABILITY_RETRY));
+		}
+	}
+
+	vTaskDelete( NULL );
+}
+
+void reachability_set_target(reachability_mode_t mode, const char *host, uint16_t port, const char *path){
+
+	reachability_create_mutex();
+
+	xSemaphoreTake(reachability_mutex, portMAX_DELAY);
+	reachability_mode = mode;
+	if(host){
+		snprintf(reachability_host, sizeof(reachability_host), "%s", host);
+	}
+	reachability_port = port;
+	if(path){
+		snprintf(reachability_path, sizeof(reachability_path), "%s", path);
+	}
+	xSemaphoreGive(reachability_mutex);
+}
+
+void reachability_start(){
+
+	if(!REACHABILITY_PROBE_ENABLED){
+		return;
+	}
+
+	reachability_create_mutex();
+
+	if(task_reachability == NULL){
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+		task_reachability = wifi_manager_create_task(WM_TASK_REACHABILITY, &reachability_task, "reachability", NULL, task_reachability_stack, &task_reachability_buffer);
+#else
+		task_reachability = wifi_manager_create_task(WM_TASK_REACHABILITY, &reachability_task, "reachability", NULL, NULL, NULL);
+#endif
+		if(task_reachability == NULL){
+			ESP_LOGE(TAG, "could not create the probe task");
+			return;
+		}
+	}
+
+	xSemaphoreTake(reachability_mutex, portMAX_DELAY);
+	reachability_run++;
+	reachability_reset_result(&reachability_result);
+	reachability_armed = true;
+	xSemaphoreGive(reachability_mutex);
+
+	xTaskNotifyGive(task_reachability);
+}
+
+void reachability_stop(){
+
+	if(reachability_mutex == NULL){
+		return;
+	}
+
+	xSemaphoreTake(reachability_mutex, portMAX_DELAY);
+	reachability_run++;
+	reachability_reset_result(&reachability_result);
+	reachability_armed = false;
+	xSemaphoreGive(reachability_mutex);
+
+	/* cut short the wait before a retry */
+	if(task_reachability){
+		xTaskNotifyGive(task_reachability);
+	}
+}
+
+void reachability_get_result(reachability_result_t *result){
+
+	if(reachability_mutex == NULL){
+		reachability_reset_result(result);
+		return;
+	}
+
+	xSemaphoreTake(reachability_mutex, portMAX_DELAY);
+	*result = reachability_result;
+	xSemaphoreGive(reachability_mutex);
+}
+
+void reachability_write_json(json_writer_t *w){
+
+	if(!REACHABILITY_PROBE_ENABLED){
+		return;
+	}
+
+	reachability_result_t result;
+	reachability_get_result(&result);
+
+	json_writer_key(w, "reach");
+	json_writer_begin_object(w);
+	json_writer_key(w, "ok");
+	json_writer_int(w, result.ok ? 1 : 0);
+	json_writer_key(w, "dns");
+	json_writer_int(w, result.dns_ms);
+	json_writer_key(w, "tcp");
+	json_writer_int(w, result.tcp_ms);
+	json_writer_key(w, "ttfb");
+	json_writer_int(w, result.ttfb_ms);
+	json_writer_end_object(w);
+}
+
+void reachability_write_cbor(cbor_writer_t *w){
+
+	if(!REACHABILITY_PROBE_ENABLED){
+		return;
+	}
+
+	reachability_result_t result;
+	reachability_get_result(&result);
+
+	cbor_writer_text(w, "reach");
+	cbor_writer_map(w, 4);
+	cbor_writer_text(w, "ok");
+	cbor_writer_int(w, result.ok ? 1 : 0);
+	cbor_writer_text(w, "dns");
+	cbor_writer_int(w, result.dns_ms);
+	cbor_writer_text(w, "tcp");
+	cbor_writer_int(w, result.tcp_ms);
+	cbor_writer_text(w, "ttfb");
+	cbor_writer_int(w, result.ttfb_ms);
+}
@@ -0,0 +1,165 @@
+/*
+Copyright (c) 2020 Marko Juhanne
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+@file reachability.h
+@author Marko Juhanne
+@brief Checks that the network the STA joined actually reaches the outside world.
+
+Getting an IP from DHCP only proves the access point is alive. Once GOT_IP is received the probe
+resolves a target host, opens a TCP connection to it and, in HTTP mode, sends a GET and waits for a 2xx answer.
+Each step is timed so that the status json can show where time is spent (DNS, TCP handshake, first byte).
+
+The result is posted to the wifi_manager as WM_EVENT_STA_REACHABILITY. The access point is only shut down once the probe passed.
+A failed probe is retried until it passes or the connection is lost.
+*/
+
+#ifndef REACHABILITY_H_INCLUDED
+#define REACHABILITY_H_INCLUDED
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#include "json.h"
+#include "cbor.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#ifdef CONFIG_WIFI_MANAGER_REACHABILITY_PROBE
+
+#define REACHABILITY_PROBE_ENABLED				1
+
+/** @brief Host probed once an IP is received. Can be changed at runtime with reachability_set_target */
+#define REACHABILITY_HOST						CONFIG_WIFI_MANAGER_REACHABILITY_HOST
+
+/** @brief TCP port of the probed host */
+#define REACHABILITY_PORT						CONFIG_WIFI_MANAGER_REACHABILITY_PORT
+
+/** @brief Time (in ms) a single probe is allowed to take before it is considered failed */
+#define REACHABILITY_TIMEOUT					CONFIG_WIFI_MANAGER_REACHABILITY_TIMEOUT
+
+/** @brief Time (in ms) to wait before a failed probe is tried again */
+#define REACHABILITY_RETRY						CONFIG_WIFI_MANAGER_REACHABILITY_RETRY
+
+#ifdef CONFIG_WIFI_MANAGER_REACHABILITY_MODE_HTTP
+#define REACHABILITY_MODE						REACHABILITY_MODE_HTTP
+/** @brief Path requested in HTTP mode */
+#define REACHABILITY_PATH						CONFIG_WIFI_MANAGER_REACHABILITY_PATH
+#else
+#define REACHABILITY_MODE						REACHABILITY_MODE_TCP
+#define REACHABILITY_PATH						"/"
+#endif
+
+#else
+
+/* probe disabled in menuconfig: the AP shutdown is armed as soon as an IP is received */
+#define REACHABILITY_PROBE_ENABLED				0
+#define REACHABILITY_HOST						""
+#define REACHABILITY_PORT						80
+#define REACHABILITY_TIMEOUT					5000
+#define REACHABILITY_RETRY						10000
+#define REACHABILITY_MODE						REACHABILITY_MODE_TCP
+#define REACHABILITY_PATH						"/"
+
+#endif
+
+/** @brief Maximum length of the probed host name, including the null terminator */
+#define REACHABILITY_HOST_SIZE					64
+
+/** @brief Maximum length of the probed path, including the null terminator */
+#define REACHABILITY_PATH_SIZE					64
+
+/** @brief Priority of the probe task. It is mostly waiting on the network and should stay below the wifi_manager. */
+#define REACHABILITY_TASK_PRIORITY				1
+
+/** @brief Stack size of the probe task. getaddrinfo needs a fair amount of it. */
+#define REACHABILITY_TASK_STACK_SIZE			3072
+
+/**
+ * @brief Defines the maximum length in bytes of the reachability member of the status json.
+ * example: ,"reach":{"ok":1,"dns":-1,"tcp":-1,"ttfb":-1}, 3 x 11 characters for the numbers at worst.
+ */
+#define JSON_REACHABILITY_SIZE					80
+
+/**
+ * @brief Defines the maximum length in bytes of the reachability pair of the status CBOR: "reach", a map of 4 short keys and 4 integers.
+ */
+#define CBOR_REACHABILITY_SIZE					(6 + 1 + 3 + 4 + 4 + 5 + 4 * CBOR_INT_MAX_SIZE)
+
+
+typedef enum reachability_mode_t {
+	REACHABILITY_MODE_TCP = 0,		/* the probe passes once the TCP connection is established */
+	REACHABILITY_MODE_HTTP = 1		/* the probe passes once a 2xx status line is received */
+}reachability_mode_t;
+
+/**
+ * @brief Outcome of the last probe. Durations are in ms, -1 when the step was not reached.
+ */
+typedef struct{
+	bool ok;
+	int32_t dns_ms;		/* name resolution */
+	int32_t tcp_ms;		/* TCP handshake */
+	int32_t ttfb_ms;	/* from the request being sent to the first byte of the answer (HTTP mode only) */
+}reachability_result_t;
+
+
+/**
+ * @brief Changes the probed target. Takes effect on the next probe.
+ * @param path only used in HTTP mode. NULL keeps the current one.
+ */
+void reachability_set_target(reachability_mode_t mode, const char *host, uint16_t port, const char *path);
+
+/**
+ * @brief Resets the last result and starts probing. A probe already running is restarted.
+ * Does nothing if the probe is disabled in menuconfig.
+ */
+void reachability_start();
+
+/**
+ * @brief Cancels the probe and resets the last result. A probe in flight finishes in the background but its result is dropped.
+ */
+void reachability_stop();
+
+/**
+ * @brief Copies the result of the last probe.
+ */
+void reachability_get_result(reachability_result_t *result);
+
+/**
+ * @brief Writes the "reach" member of the status json. Nothing is written if the probe is disabled.
+ */
+void reachability_write_json(json_writer_t *w);
+
+/**
+ * @brief Writes the "reach" pair of the status CBOR, which counts as one pair of the enclosing map. Nothing is written if the probe is disabled.
+ */
+void reachability_write_cbor(cbor_writer_t *w);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* REACHABILITY_H_INCLUDED */
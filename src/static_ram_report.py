@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2020 Marko Juhanne
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+#
+#
+# Prints the static RAM (data + bss) taken by each module of the component, from
+# the Berkeley output of the toolchain's size run on the component archive.
+# Objects of the same module (wifi_manager.c.obj, wifi_manager.o) are summed.
+#
+# usage: static_ram_report.py SIZE_TOOL ARCHIVE
+
+import os
+import subprocess
+import sys
+
+
+def module_name(filename):
+    """dns_server.c.obj (ex libesp32-wifi-manager.a) -> dns_server"""
+    return os.path.basename(filename.split(" (ex ")[0]).split(".")[0]
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit("usage: static_ram_report.py SIZE_TOOL ARCHIVE")
+    size_tool, archive = sys.argv[1:]
+
+    output = subprocess.run([size_tool, "-B", archive], check=True, stdout=subprocess.PIPE, universal_newlines=True).stdout
+
+    modules = {}
+    for line in output.splitlines()[1:]:
+        fields = line.split(None, 5)
+        if len(fields) < 6:
+            continue
+        data, bss = int(fields[1]), int(fields[2])
+        name = module_name(fields[5])
+        total = modules.setdefault(name, [0, 0])
+        total[0] += data
+        total[1] += bss
+
+    print("%-20s %8s %8s %8s" % ("module", "data", "bss", "ram"))
+    for name, (data, bss) in sorted(modules.items(), key=lambda m: -sum(m[1])):
+        print("%-20s %8d %8d %8d" % (name, data, bss, data + bss))
+    data = sum(m[0] for m in modules.values())
+    bss = sum(m[1] for m in modules.values())
+    print("%-20s %8d %8d %8d" % ("total", data, bss, data + bss))
+
+
+if __name__ == "__main__":
+    main()
@@ -37,6 +37,8 @@ Contains the freeRTOS task and all necessary support
 #include <stdbool.h>
 #include <stdint.h>
 #include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_idf_version.h"
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
 #include <freertos/task.h>
@@ -58,9 +60,14 @@ Contains the freeRTOS task and all necessary support
 
 
 #include "json.h"
+#include "json_snapshot.h"
+#include "cbor.h"
 #include "dns_server.h"
 #include "nvs_sync.h"
+#include "mem_governor.h"
+#include "prov_arena.h"
 #include "wifi_manager.h"
+#include "mqtt_manager.h"
 
 
 
@@ -78,15 +85,75 @@ TimerHandle_t wifi_manager_shutdown_ap_timer = NULL;
 SemaphoreHandle_t wifi_manager_json_mutex = NULL;
 SemaphoreHandle_t wifi_manager_sta_ip_mutex = NULL;
 char *wifi_manager_sta_ip = NULL;
+
+/* @brief numeric copy of the STA IP, in the byte order of ip4_addr_t. A 32 bit aligned word: it is read without the sta ip mutex */
+static volatile uint32_t wifi_manager_sta_ip_addr = 0;
 uint16_t ap_num = MAX_AP_NUM;
 wifi_ap_record_t *accessp_records;
-char *accessp_json = NULL;
+/* @brief number of records accessp_records can hold: MAX_AP_NUM, or MAX_AP_NUM_UNDER_PRESSURE under memory pressure */
+static uint16_t accessp_records_capacity = 0;
+char *accessp_list = NULL;
 char *ip_info_json = NULL;
 wifi_config_t* wifi_manager_config_sta = NULL;
 
+/* @brief what the portal is served, double buffered over accessp_list and ip_info_json so that it is sent without holding the json mutex.
+ * The access points are kept as records and streamed as json or CBOR by the http server. */
+static json_snapshot_t accessp_snapshot;
+static json_snapshot_t ip_info_snapshot;
+
+/* @brief true when the scan results changed since they were last copied to accessp_snapshot. Protected by the json mutex. */
+static bool accessp_list_dirty = true;
+
+/* @brief the lists of access points replaced by a newer scan, with the version they were published as, so that clients holding one of them
+ * can be sent only what changed. A ring allocated with the scan buffers, next is the entry overwritten next. Protected by the json mutex. */
+typedef struct{
+	uint32_t version;
+	wifi_manager_ap_list_t list;
+}wifi_manager_ap_history_t;
+static wifi_manager_ap_history_t *accessp_history = NULL;
+static uint8_t accessp_history_next = 0;
+
+/* @brief state the status json has to show. It is only rendered into ip_info_json when read. Protected by the json mutex. */
+static bool ip_info_json_dirty = true;
+static bool ip_info_json_connected = false;		/* false: the json is cleared to {} */
+static update_reason_code_t ip_info_json_reason = UPDATE_CONNECTION_OK;
+static uint32_t ip_info_json_generation = 0;
+
+/* @brief connection attempts requested with wifi_manager_connect_async, and the outcome of the last one resolved */
+static uint32_t connect_attempts_requested = 0;
+static wifi_manager_connect_result_t connect_result = { 0, UPDATE_CONNECTION_OK, 0 };
+#ifdef ESP32
+static portMUX_TYPE connect_result_mux = portMUX_INITIALIZER_UNLOCKED;
+#define CONNECT_RESULT_ENTER()		portENTER_CRITICAL(&connect_result_mux)
+#define CONNECT_RESULT_EXIT()		portEXIT_CRITICAL(&connect_result_mux)
+#else
+#define CONNECT_RESULT_ENTER()		portENTER_CRITICAL()
+#define CONNECT_RESULT_EXIT()		portEXIT_CRITICAL()
+#endif
+
 /* @brief Array of callback function pointers */
 static void (**cb_ptr_arr)(void*) = NULL;
 
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+/* @brief backing storage of every RTOS object and buffer of the wifi manager: nothing is taken from the heap */
+static StaticQueue_t wifi_manager_queue_buffer;
+static uint8_t wifi_manager_queue_storage[WIFI_MANAGER_QUEUE_LENGTH * sizeof(queue_message)];
+static StaticSemaphore_t wifi_manager_json_mutex_buffer;
+static StaticSemaphore_t wifi_manager_sta_ip_mutex_buffer;
+static StaticEventGroup_t wifi_manager_event_group_buffer;
+static StaticTimer_t wifi_manager_retry_timer_buffer;
+static StaticTimer_t wifi_manager_shutdown_ap_timer_buffer;
+static StaticTask_t task_wifi_manager_buffer;
+static StackType_t task_wifi_manager_stack[WIFI_MANAGER_TASK_STACK_SIZE / sizeof(StackType_t)];
+static StaticTask_t task_config_loader_buffer;
+static StackType_t task_config_loader_stack[WIFI_MANAGER_CONFIG_LOADER_STACK_SIZE / sizeof(StackType_t)];
+static char ip_info_json_buffer[JSON_SNAPSHOT_STORAGE_SIZE(JSON_IP_INFO_SIZE, CBOR_IP_INFO_SIZE)];
+static wifi_config_t wifi_manager_config_sta_buffer;
+static void (*cb_ptr_arr_buffer[WM_MESSAGE_CODE_COUNT])(void*);
+static char wifi_manager_sta_ip_buffer[IP4ADDR_STRLEN_MAX];
+static char ap_ssid_buffer[MAX_SSID_SIZE+1+7]; /* extra space for possible MAC address */
+#endif
+
 /* @brief tag used for ESP serial console messages */
 static const char TAG[] = "wifi_manager";
 
@@ -148,6 +215,18 @@ const int WIFI_MANAGER_REQUEST_DISCONNECT_BIT = BIT8;
 /* @brief When set, Our AP is shutdown when target AP is connected and after timer period is elapsed */
 const int WIFI_MANAGER_AUTO_AP_SHUTDOWN = BIT9;
 
+/* @brief Set by the boot config loader once the saved STA config has been read from NVS */
+const int WIFI_MANAGER_STA_CONFIG_LOADED_BIT = BIT10;
+
+/* @brief Set by the boot config loader if a saved STA config was found in NVS */
+const int WIFI_MANAGER_STA_CONFIG_FOUND_BIT = BIT11;
+
+/* @brief When set, esp_wifi_connect is issued straight from the WIFI_EVENT_STA_START event */
+const int WIFI_MANAGER_CONNECT_ON_STA_START_BIT = BIT12;
+
+/* @brief Set once the reachability probe passed on the current connection. Always set right after GOT_IP when the probe is disabled. */
+const int WIFI_MANAGER_STA_REACHABLE_BIT = BIT13;
+
 /* @brief When set, Our AP is started when maximum STA reconnect failures is reached */
 bool auto_ap_start_after_failure;
 
@@ -161,6 +240,162 @@ char * ap_ssid = NULL;
    since it might not be created yet */
 bool wifi_manager_started = false;
 
+/* @brief esp_timer timestamps of each boot stage. 0 means the stage was not reached yet */
+static int64_t boot_stage_time[WM_BOOT_STAGE_COUNT];
+
+/* @brief true once the setup deferred until the first IP has been done */
+static bool boot_deferred_setup_done = false;
+
+static void wifi_manager_boot_stage_reached(wifi_manager_boot_stage_t stage){
+	if(boot_stage_time[stage] == 0){
+		boot_stage_time[stage] = esp_timer_get_time();
+	}
+}
+
+int64_t wifi_manager_get_boot_stage_time(wifi_manager_boot_stage_t stage){
+	if(stage >= WM_BOOT_STAGE_COUNT || boot_stage_time[stage] == 0){
+		return -1;
+	}
+	return boot_stage_time[stage] - boot_stage_time[WM_BOOT_STAGE_START];
+}
+
+static void wifi_manager_log_boot_report(){
+	static const char *stage_names[WM_BOOT_STAGE_COUNT] = {
+		"start", "netif init", "driver init", "config loaded", "wifi started", "sta connect", "got ip", "deferred setup"
+	};
+	int64_t previous = 0;
+
+	ESP_LOGI(TAG, "boot pipeline timing report (ms since start / ms since previous stage):");
+	for(int i=1; i<WM_BOOT_STAGE_COUNT; i++){
+		int64_t t = wifi_manager_get_boot_stage_time(i);
+		if(t >= 0){
+			ESP_LOGI(TAG, "  %-15s %6lld / %6lld", stage_names[i], t / 1000, (t - previous) / 1000);
+			previous = t;
+		}
+		else{
+			ESP_LOGI(TAG, "  %-15s skipped", stage_names[i]);
+		}
+	}
+}
+
+/* @brief current placement of each configurable task */
+static wifi_manager_task_config_t task_configs[WM_TASK_COUNT] = {
+	[WM_TASK_WIFI_MANAGER] = { WIFI_MANAGER_TASK_PRIORITY, WIFI_MANAGER_TASK_STACK_SIZE, WIFI_MANAGER_TASK_CORE },
+	[WM_TASK_DNS_SERVER] = { WIFI_MANAGER_DNS_TASK_PRIORITY, WIFI_MANAGER_DNS_TASK_STACK_SIZE, WIFI_MANAGER_DNS_TASK_CORE },
+	[WM_TASK_HTTPD] = { WIFI_MANAGER_HTTPD_TASK_PRIORITY, WIFI_MANAGER_HTTPD_TASK_STACK_SIZE, WIFI_MANAGER_HTTPD_TASK_CORE },
+	[WM_TASK_MQTT_MANAGER] = { MQTT_MANAGER_TASK_PRIORITY, MQTT_MANAGER_TASK_STACK_SIZE, MQTT_MANAGER_TASK_CORE },
+	[WM_TASK_REACHABILITY] = { REACHABILITY_TASK_PRIORITY, REACHABILITY_TASK_STACK_SIZE, WIFI_MANAGER_TASK_CORE },
+	[WM_TASK_HTTPD_WORKER] = { WIFI_MANAGER_HTTPD_WORKER_PRIORITY, WIFI_MANAGER_HTTPD_WORKER_STACK_SIZE, WIFI_MANAGER_HTTPD_TASK_CORE },
+	[WM_TASK_HTTPD_EVENTS] = { WIFI_MANAGER_HTTPD_WORKER_PRIORITY, WIFI_MANAGER_HTTPD_EVENTS_STACK_SIZE, WIFI_MANAGER_HTTPD_TASK_CORE },
+};
+
+void wifi_manager_set_task_config(wifi_manager_task_t task, const wifi_manager_task_config_t *config){
+	if(task >= WM_TASK_COUNT || config == NULL){
+		return;
+	}
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+	/* static stacks are sized at compile time */
+	if(task != WM_TASK_HTTPD && config->stack_size != task_configs[task].stack_size){
+		ESP_LOGW(TAG, "task %d: stack size can't be changed in static allocation mode", task);
+		uint32_t stack_size = task_configs[task].stack_size;
+		task_configs[task] = *config;
+		task_configs[task].stack_size = stack_size;
+		return;
+	}
+#endif
+	task_configs[task] = *config;
+}
+
+wifi_manager_task_config_t wifi_manager_get_task_config(wifi_manager_task_t task){
+	if(task >= WM_TASK_COUNT){
+		task = WM_TASK_WIFI_MANAGER;
+	}
+	return task_configs[task];
+}
+
+TaskHandle_t wifi_manager_create_task(wifi_manager_task_t task, TaskFunction_t fn, const char *name, void *param, StackType_t *stack, StaticTask_t *tcb){
+
+	TaskHandle_t handle = NULL;
+	wifi_manager_task_config_t config = wifi_manager_get_task_config(task);
+
+	ESP_LOGI(TAG, "creating task %s: priority %d, stack %d, core %d", name, (int)config.priority, (int)config.stack_size, config.core_id);
+
+#ifdef ESP32
+	BaseType_t core_id = config.core_id < 0 ? tskNO_AFFINITY : (BaseType_t)config.core_id;
+#if configSUPPORT_STATIC_ALLOCATION
+	if(stack && tcb){
+		return xTaskCreateStaticPinnedToCore(fn, name, config.stack_size, param, config.priority, stack, tcb, core_id);
+	}
+#endif
+	xTaskCreatePinnedToCore(fn, name, config.stack_size, param, config.priority, &handle, core_id);
+#else
+#if configSUPPORT_STATIC_ALLOCATION
+	if(stack && tcb){
+		return xTaskCreateStatic(fn, name, config.stack_size, param, config.priority, stack, tcb);
+	}
+#endif
+	xTaskCreate(fn, name, config.stack_size, param, config.priority, &handle);
+#endif
+
+	return handle;
+}
+
+/**
+ * @brief Any of the event params copied out of the event loop for the wifi_manager task
+ */
+typedef union {
+	wifi_event_sta_scan_done_t scan_done;
+	wifi_event_sta_disconnected_t disconnected;
+	ip_event_got_ip_t got_ip;
+} wifi_manager_event_param_t;
+
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+/* @brief fixed pool of event params. Free slots are kept in a queue, which makes the pool safe to use from the event loop and the wifi_manager task alike */
+static wifi_manager_event_param_t event_param_pool[WIFI_MANAGER_EVENT_PARAM_POOL_SIZE];
+static QueueHandle_t event_param_free_list = NULL;
+static StaticQueue_t event_param_free_list_buffer;
+static uint8_t event_param_free_list_storage[WIFI_MANAGER_EVENT_PARAM_POOL_SIZE * sizeof(void*)];
+#endif
+
+/**
+ * @brief Allocates the param of an event posted to the wifi_manager queue. It must be released with wifi_manager_event_param_free once processed.
+ */
+static void* wifi_manager_event_param_alloc(){
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+	void *param = NULL;
+	xQueueReceive(event_param_free_list, &param, portMAX_DELAY);
+	return param;
+#else
+	return malloc(sizeof(wifi_manager_event_param_t));
+#endif
+}
+
+static void wifi_manager_event_param_free(void *param){
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+	if(param){
+		xQueueSend(event_param_free_list, &param, portMAX_DELAY);
+	}
+#else
+	free(param);
+#endif
+}
+
+/**
+ * @brief Short lived task reading the saved STA config while the wifi_manager task brings up the driver.
+ */
+static void wifi_manager_boot_config_loader( void * pvParameters ){
+
+	EventBits_t bits = WIFI_MANAGER_STA_CONFIG_LOADED_BIT;
+
+	if(wifi_manager_fetch_wifi_sta_config()){
+		bits |= WIFI_MANAGER_STA_CONFIG_FOUND_BIT;
+	}
+	wifi_manager_boot_stage_reached(WM_BOOT_STAGE_CONFIG_LOADED);
+	xEventGroupSetBits(wifi_manager_event_group, bits);
+
+	vTaskDelete( NULL );
+}
+
 
 bool wifi_manager_is_started() {
 	return wifi_manager_started;
@@ -189,6 +424,20 @@ void wifi_manager_timer_shutdown_ap_cb( TimerHandle_t xTimer){
 	wifi_manager_send_message(WM_ORDER_STOP_AP, NULL);
 }
 
+int32_t wifi_manager_get_ap_shutdown_remaining(){
+
+	if(wifi_manager_shutdown_ap_timer == NULL || xTimerIsTimerActive(wifi_manager_shutdown_ap_timer) == pdFALSE){
+		return -1;
+	}
+
+	/* an expiry time already passed is a shutdown under way */
+	int32_t left = (int32_t)(xTimerGetExpiryTime(wifi_manager_shutdown_ap_timer) - xTaskGetTickCount());
+	if(left < 0){
+		left = 0;
+	}
+	return (left * portTICK_PERIOD_MS + 999) / 1000;
+}
+
 void wifi_manager_scan_async(){
 	wifi_manager_send_message(WM_ORDER_START_WIFI_SCAN, NULL);
 }
@@ -202,6 +451,10 @@ void wifi_manager_start( const char * ssid, bool append_ssid_with_mac ){
 
 	wifi_manager_started = false;
 
+	memset(boot_stage_time, 0x00, sizeof(boot_stage_time));
+	boot_deferred_setup_done = false;
+	wifi_manager_boot_stage_reached(WM_BOOT_STAGE_START);
+
 	/* disable the default wifi logging */
 	esp_log_level_set("wifi", ESP_LOG_NONE);
 
@@ -210,29 +463,54 @@ void wifi_manager_start( const char * ssid, bool append_ssid_with_mac ){
 	ESP_ERROR_CHECK(nvs_sync_create()); /* semaphore for thread synchronization on NVS memory */
 
 	/* memory allocation */
-	wifi_manager_queue = xQueueCreate( 3, sizeof( queue_message) );
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+	wifi_manager_queue = xQueueCreateStatic( WIFI_MANAGER_QUEUE_LENGTH, sizeof( queue_message), wifi_manager_queue_storage, &wifi_manager_queue_buffer );
+	wifi_manager_json_mutex = xSemaphoreCreateMutexStatic( &wifi_manager_json_mutex_buffer );
+	ip_info_json = ip_info_json_buffer;
+	wifi_manager_config_sta = &wifi_manager_config_sta_buffer;
+	cb_ptr_arr = cb_ptr_arr_buffer;
+	wifi_manager_sta_ip_mutex = xSemaphoreCreateMutexStatic( &wifi_manager_sta_ip_mutex_buffer );
+	wifi_manager_sta_ip = wifi_manager_sta_ip_buffer;
+	wifi_manager_event_group = xEventGroupCreateStatic( &wifi_manager_event_group_buffer );
+	event_param_free_list = xQueueCreateStatic( WIFI_MANAGER_EVENT_PARAM_POOL_SIZE, sizeof(void*), event_param_free_list_storage, &event_param_free_list_buffer );
+	for(int i=0; i<WIFI_MANAGER_EVENT_PARAM_POOL_SIZE; i++){
+		void *param = &event_param_pool[i];
+		xQueueSend(event_param_free_list, &param, 0);
+	}
+#else
+	wifi_manager_queue = xQueueCreate( WIFI_MANAGER_QUEUE_LENGTH, sizeof( queue_message) );
 	wifi_manager_json_mutex = xSemaphoreCreateMutex();
-	accessp_records = (wifi_ap_record_t*)malloc(sizeof(wifi_ap_record_t) * MAX_AP_NUM);
-	accessp_json = (char*)malloc(MAX_AP_NUM * JSON_ONE_APP_SIZE + 4); /* 4 bytes for json encapsulation of "[\n" and "]\0" */
-	wifi_manager_clear_access_points_json();
-	ip_info_json = (char*)malloc(sizeof(char) * JSON_IP_INFO_SIZE);
-	wifi_manager_clear_ip_info_json();
+	ip_info_json = (char*)malloc(sizeof(char) * JSON_SNAPSHOT_STORAGE_SIZE(JSON_IP_INFO_SIZE, CBOR_IP_INFO_SIZE));
 	wifi_manager_config_sta = (wifi_config_t*)malloc(sizeof(wifi_config_t));
+	cb_ptr_arr = malloc(sizeof(void (*)(void*)) * WM_MESSAGE_CODE_COUNT);
+	wifi_manager_sta_ip_mutex = xSemaphoreCreateMutex();
+	wifi_manager_sta_ip = (char*)malloc(sizeof(char) * IP4ADDR_STRLEN_MAX);
+	wifi_manager_event_group = xEventGroupCreate();
+#endif
+	/* accessp_records and accessp_list are allocated on the first scan or when the access point starts. See wifi_manager_alloc_scan_buffers */
+	json_snapshot_init(&accessp_snapshot, NULL, sizeof(wifi_manager_ap_list_t), 0);
+	json_snapshot_init(&ip_info_snapshot, ip_info_json, JSON_IP_INFO_SIZE, CBOR_IP_INFO_SIZE);
+	wifi_manager_clear_ip_info_json();
 	memset(wifi_manager_config_sta, 0x00, sizeof(wifi_config_t));
 #ifdef ESP32
 	memset(&wifi_settings.sta_static_ip_config, 0x00, sizeof(esp_netif_ip_info_t));
 #else
 	memset(&wifi_settings.sta_static_ip_config, 0x00, sizeof(tcpip_adapter_ip_info_t));
 #endif
-	cb_ptr_arr = malloc(sizeof(void (*)(void*)) * WM_MESSAGE_CODE_COUNT);
 	for(int i=0; i<WM_MESSAGE_CODE_COUNT; i++){
 		cb_ptr_arr[i] = NULL;
 	}
-	wifi_manager_sta_ip_mutex = xSemaphoreCreateMutex();
-	wifi_manager_sta_ip = (char*)malloc(sizeof(char) * IP4ADDR_STRLEN_MAX);
 	wifi_manager_safe_update_sta_ip_string((uint32_t)0);
-	wifi_manager_event_group = xEventGroupCreate();
 
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+	/* the name is truncated to what an access point can broadcast anyway */
+	ap_ssid = ap_ssid_buffer;
+	strncpy(ap_ssid, ssid ? ssid : (char*)wifi_settings.ap_ssid, MAX_SSID_SIZE);
+	ap_ssid[MAX_SSID_SIZE] = '\0';
+	if (ssid) {
+		strncpy((char*)wifi_settings.ap_ssid, ssid, MAX_SSID_SIZE);
+	}
+#else
 	if (ssid)  {
 		ap_ssid = (char*)malloc(strlen(ssid)+1+7); // extra space for possible MAC address
 		strcpy(ap_ssid, ssid);
@@ -240,7 +518,9 @@ void wifi_manager_start( const char * ssid, bool append_ssid_with_mac ){
 	} else {
 		// use default
 		ap_ssid = (char*)malloc(strlen((char*)wifi_settings.ap_ssid)+1+7); // extra space for possible MAC address
+		strcpy(ap_ssid, (char*)wifi_settings.ap_ssid);
 	}
+#endif
 	ap_ssid_mac = append_ssid_with_mac;
 
 	// by default start AP after max STA connect retries have reached 
@@ -249,14 +529,30 @@ void wifi_manager_start( const char * ssid, bool append_ssid_with_mac ){
 	// by default shutdown AP after STA connected and timer period is elapsed
 	xEventGroupSetBits(wifi_manager_event_group, WIFI_MANAGER_AUTO_AP_SHUTDOWN);
 
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+	wifi_manager_retry_timer = xTimerCreateStatic( NULL, pdMS_TO_TICKS(WIFI_MANAGER_RETRY_TIMER), pdFALSE, ( void * ) 0, wifi_manager_timer_retry_cb, &wifi_manager_retry_timer_buffer);
+	wifi_manager_shutdown_ap_timer = xTimerCreateStatic( NULL, pdMS_TO_TICKS(WIFI_MANAGER_SHUTDOWN_AP_TIMER), pdFALSE, ( void * ) 0, wifi_manager_timer_shutdown_ap_cb, &wifi_manager_shutdown_ap_timer_buffer);
+	xTaskCreateStatic(&wifi_manager_boot_config_loader, "wm_config_loader", WIFI_MANAGER_CONFIG_LOADER_STACK_SIZE, NULL, WIFI_MANAGER_TASK_PRIORITY, task_config_loader_stack, &task_config_loader_buffer);
+#else
 	/* create timer for to keep track of retries */
 	wifi_manager_retry_timer = xTimerCreate( NULL, pdMS_TO_TICKS(WIFI_MANAGER_RETRY_TIMER), pdFALSE, ( void * ) 0, wifi_manager_timer_retry_cb);
 
 	/* create timer for to keep track of AP shutdown */
 	wifi_manager_shutdown_ap_timer = xTimerCreate( NULL, pdMS_TO_TICKS(WIFI_MANAGER_SHUTDOWN_AP_TIMER), pdFALSE, ( void * ) 0, wifi_manager_timer_shutdown_ap_cb);
 
+	/* read the saved STA config in parallel with the driver initialization done by the wifi manager task */
+	xTaskCreate(&wifi_manager_boot_config_loader, "wm_config_loader", WIFI_MANAGER_CONFIG_LOADER_STACK_SIZE, NULL, WIFI_MANAGER_TASK_PRIORITY, NULL);
+#endif
+
+	/* watch the heap and shed load when it runs low */
+	mem_governor_start();
+
 	/* start wifi manager task */
-	xTaskCreate(&wifi_manager, "wifi_manager", 4096, NULL, WIFI_MANAGER_TASK_PRIORITY, &task_wifi_manager);
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+	task_wifi_manager = wifi_manager_create_task(WM_TASK_WIFI_MANAGER, &wifi_manager, "wifi_manager", NULL, task_wifi_manager_stack, &task_wifi_manager_buffer);
+#else
+	task_wifi_manager = wifi_manager_create_task(WM_TASK_WIFI_MANAGER, &wifi_manager, "wifi_manager", NULL, NULL, NULL);
+#endif
 }
 
 esp_err_t wifi_manager_save_sta_config(){
@@ -372,20 +668,23 @@ bool wifi_manager_fetch_wifi_sta_config(){
 		}
 
 		if(wifi_manager_config_sta == NULL){
+#ifdef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
+			wifi_manager_config_sta = &wifi_manager_config_sta_buffer;
+#else
 			wifi_manager_config_sta = (wifi_config_t*)malloc(sizeof(wifi_config_t));
+#endif
 		}
 		memset(wifi_manager_config_sta, 0x00, sizeof(wifi_config_t));
 
-		/* allocate buffer */
-		size_t sz = sizeof(wifi_settings);
-		uint8_t *buff = (uint8_t*)malloc(sizeof(uint8_t) * sz);
-		memset(buff, 0x00, sizeof(sz));
+		/* buffer big enough for the largest blob. It's small enough to live on the stack */
+		size_t sz;
+		uint8_t buff[sizeof(wifi_settings)];
+		memset(buff, 0x00, sizeof(buff));
 
 		/* ssid */
 		sz = sizeof(wifi_manager_config_sta->sta.ssid);
 		esp_err = nvs_get_blob(handle, "ssid", buff, &sz);
 		if(esp_err != ESP_OK){
-			free(buff);
 			nvs_sync_unlock();
 			return false;
 		}
@@ -395,7 +694,6 @@ bool wifi_manager_fetch_wifi_sta_config(){
 		sz = sizeof(wifi_manager_config_sta->sta.password);
 		esp_err = nvs_get_blob(handle, "password", buff, &sz);
 		if(esp_err != ESP_OK){
-			free(buff);
 			nvs_sync_unlock();
 			return false;
 		}
@@ -405,7 +703,6 @@ bool wifi_manager_fetch_wifi_sta_config(){
 		sz = sizeof(wifi_settings);
 		esp_err = nvs_get_blob(handle, "settings", buff, &sz);
 		if(esp_err != ESP_OK){
-			free(buff);
 			nvs_sync_unlock();
 			return false;
 		}
@@ -414,7 +711,6 @@ bool wifi_manager_fetch_wifi_sta_config(){
 		// restore AP name
 	    strncpy((char*)wifi_settings.ap_ssid, ap_ssid, MAX_SSID_SIZE );
 
-		free(buff);
 		nvs_close(handle);
 		nvs_sync_unlock();
 
@@ -441,31 +737,41 @@ bool wifi_manager_fetch_wifi_sta_config(){
 
 
 void wifi_manager_clear_ip_info_json(){
-	strcpy(ip_info_json, "{}\n");
+	ip_info_json_connected = false;
+	ip_info_json_dirty = true;
+	ip_info_json_generation++;
 }
 
 
 void wifi_manager_generate_ip_info_json(update_reason_code_t update_reason_code){
+	ip_info_json_connected = true;
+	ip_info_json_reason = update_reason_code;
+	ip_info_json_dirty = true;
+	ip_info_json_generation++;
+}
 
-	wifi_config_t *config = wifi_manager_get_wifi_sta_config();
-	if(config){
+uint32_t wifi_manager_get_ip_info_generation(){
+	return ip_info_json_generation;
+}
 
-		const char *ip_info_json_format = ",\"ip\":\"%s\",\"netmask\":\"%s\",\"gw\":\"%s\",\"urc\":%d}\n";
+/**
+ * @brief Renders the status from the state recorded by wifi_manager_generate_ip_info_json: the json into buf, of JSON_IP_INFO_SIZE bytes,
+ * and its CBOR encoding into cbor, of CBOR_IP_INFO_SIZE bytes, unless it is NULL.
+ * @note to be called with the json buffer locked.
+ * @return the length of the CBOR encoding.
+ */
+static size_t wifi_manager_render_ip_info_json(char *buf, uint8_t *cbor){
 
-		memset(ip_info_json, 0x00, JSON_IP_INFO_SIZE);
+	update_reason_code_t update_reason_code = ip_info_json_reason;
+	wifi_config_t *config = wifi_manager_get_wifi_sta_config();
+	if(ip_info_json_connected && config){
 
-		/* to avoid declaring a new buffer we copy the data directly into the buffer at its correct address */
-		strcpy(ip_info_json, "{\"ssid\":");
-		json_print_string(config->sta.ssid,  (unsigned char*)(ip_info_json+strlen(ip_info_json)) );
+		/* without a connection the reason code alone tells the front end why this was updated */
+		char ip[IP4ADDR_STRLEN_MAX] = "0"; /* note: IP4ADDR_STRLEN_MAX is defined in lwip */
+		char gw[IP4ADDR_STRLEN_MAX] = "0";
+		char netmask[IP4ADDR_STRLEN_MAX] = "0";
 
-		size_t ip_info_json_len = strlen(ip_info_json);
-		size_t remaining = JSON_IP_INFO_SIZE - ip_info_json_len;
 		if(update_reason_code == UPDATE_CONNECTION_OK){
-			/* rest of the information is copied after the ssid */
-
-			char ip[IP4ADDR_STRLEN_MAX]; /* note: IP4ADDR_STRLEN_MAX is defined in lwip */
-			char gw[IP4ADDR_STRLEN_MAX];
-			char netmask[IP4ADDR_STRLEN_MAX];
 #ifdef ESP32
 			esp_netif_ip_info_t ip_info;
 			ESP_ERROR_CHECK(esp_netif_get_ip_info(esp_netif_sta, &ip_info));
@@ -484,61 +790,273 @@ void wifi_manager_generate_ip_info_json(update_reason_code_t update_reason_code)
 			str = ip4addr_ntoa(&ip_info.netmask);
 			strcpy(netmask, str);
 #endif
+		}
 
-			snprintf( (ip_info_json + ip_info_json_len), remaining, ip_info_json_format,
-					ip,
-					netmask,
-					gw,
-					(int)update_reason_code);
+		json_writer_t w;
+		json_writer_init(&w, buf, JSON_IP_INFO_SIZE);
+		json_writer_begin_object(&w);
+		json_writer_key(&w, "ssid");
+		json_writer_string_n(&w, (const char*)config->sta.ssid, sizeof(config->sta.ssid));
+		json_writer_key(&w, "ip");
+		json_writer_string(&w, ip);
+		json_writer_key(&w, "netmask");
+		json_writer_string(&w, netmask);
+		json_writer_key(&w, "gw");
+		json_writer_string(&w, gw);
+		json_writer_key(&w, "urc");
+		json_writer_int(&w, (int32_t)update_reason_code);
+		if(update_reason_code == UPDATE_CONNECTION_OK){
+			/* latency breakdown of the reachability probe, nothing if the probe is disabled */
+			reachability_write_json(&w);
 		}
-		else{
-			/* notify in the json output the reason code why this was updated without a connection */
-			snprintf( (ip_info_json + ip_info_json_len), remaining, ip_info_json_format,
-								"0",
-								"0",
-								"0",
-								(int)update_reason_code);
+		json_writer_end_object(&w);
+		json_writer_raw(&w, "\n");
+
+		if(!json_writer_finish(&w)){
+			ESP_LOGE(TAG, "ip info json does not fit in %d bytes", JSON_IP_INFO_SIZE);
+			strcpy(buf, "{}\n");
+		}
+
+		if(cbor){
+			/* same members in the same order */
+			bool reach = REACHABILITY_PROBE_ENABLED && update_reason_code == UPDATE_CONNECTION_OK;
+			cbor_writer_t c;
+			cbor_writer_init(&c, cbor, CBOR_IP_INFO_SIZE);
+			cbor_writer_map(&c, reach ? 6 : 5);
+			cbor_writer_text(&c, "ssid");
+			cbor_writer_text_n(&c, (const char*)config->sta.ssid, sizeof(config->sta.ssid));
+			cbor_writer_text(&c, "ip");
+			cbor_writer_text(&c, ip);
+			cbor_writer_text(&c, "netmask");
+			cbor_writer_text(&c, netmask);
+			cbor_writer_text(&c, "gw");
+			cbor_writer_text(&c, gw);
+			cbor_writer_text(&c, "urc");
+			cbor_writer_int(&c, (int32_t)update_reason_code);
+			if(reach){
+				reachability_write_cbor(&c);
+			}
+			size_t len = cbor_writer_finish(&c);
+			if(len == 0){
+				ESP_LOGE(TAG, "ip info cbor does not fit in %d bytes", CBOR_IP_INFO_SIZE);
+			}
+			return len;
 		}
 	}
 	else{
-		wifi_manager_clear_ip_info_json();
+		strcpy(buf, "{}\n");
+		if(cbor){
+			/* empty map */
+			cbor[0] = 0xa0;
+			return 1;
+		}
 	}
 
+	return 0;
+}
+
 
+/**
+ * @brief Makes sure the scan buffers exist. They come from the provisioning arena while the access point runs, from the heap otherwise.
+ * @note to be called from the wifi_manager task with the json buffer locked.
+ * @return true if both buffers are available.
+ */
+static bool wifi_manager_alloc_scan_buffers(){
+	uint16_t capacity = mem_governor_get_level() >= MEM_PRESSURE_SHRINK_SCAN ? MAX_AP_NUM_UNDER_PRESSURE : MAX_AP_NUM;
+
+	/* a heap block of the wrong size is swapped for one of the right size. An arena block is kept as is: its space only comes back when the arena is destroyed */
+	if(accessp_records != NULL && accessp_records_capacity != capacity && !prov_arena_owns(accessp_records)){
+		wifi_ap_record_t *resized = (wifi_ap_record_t*)prov_arena_alloc(sizeof(wifi_ap_record_t) * capacity);
+		if(resized){
+			if(ap_num > capacity){
+				ap_num = capacity;
+				accessp_list_dirty = true;
+			}
+			memcpy(resized, accessp_records, sizeof(wifi_ap_record_t) * ap_num);
+			prov_arena_free(accessp_records);
+			accessp_records = resized;
+			accessp_records_capacity = capacity;
+		}
+	}
+	if(accessp_records == NULL){
+		accessp_records = (wifi_ap_record_t*)prov_arena_alloc(sizeof(wifi_ap_record_t) * capacity);
+		accessp_records_capacity = accessp_records ? capacity : 0;
+	}
+	if(accessp_list == NULL){
+		accessp_list = (char*)prov_arena_alloc(JSON_SNAPSHOT_STORAGE_SIZE(sizeof(wifi_manager_ap_list_t), 0));
+		json_snapshot_init(&accessp_snapshot, accessp_list, sizeof(wifi_manager_ap_list_t), 0);
+		wifi_manager_clear_access_points_json();
+	}
+	/* optional: without it clients get the full list every time */
+	if(accessp_history == NULL && accessp_list != NULL){
+		accessp_history = (wifi_manager_ap_history_t*)prov_arena_alloc(sizeof(wifi_manager_ap_history_t) * WIFI_MANAGER_AP_HISTORY_LENGTH);
+		if(accessp_history){
+			memset(accessp_history, 0x00, sizeof(wifi_manager_ap_history_t) * WIFI_MANAGER_AP_HISTORY_LENGTH);
+		}
+		accessp_history_next = 0;
+	}
+	return accessp_records != NULL && accessp_list != NULL;
 }
 
+/**
+ * @brief Releases the scan buffers, in reverse order of allocation so that the provisioning arena can roll back.
+ * The access points json is only freed once the http server is done sending it.
+ * @note to be called from the wifi_manager task with the json buffer locked.
+ * @return false if the access points json was still being sent and had to be leaked: the provisioning arena must then not be destroyed.
+ */
+static bool wifi_manager_release_scan_buffers(){
+	bool released = true;
+
+	prov_arena_free(accessp_history);
+	accessp_history = NULL;
+	if(json_snapshot_retire(&accessp_snapshot)){
+		prov_arena_free(accessp_list);
+	}
+	else{
+		/* a client that stalls past the send timeout of the http server: losing the block beats a use after free */
+		ESP_LOGE(TAG, "access points still being sent, leaking them");
+		released = false;
+	}
+	accessp_list = NULL;
+	prov_arena_free(accessp_records);
+	accessp_records = NULL;
+	accessp_records_capacity = 0;
+
+	return released;
+}
+
+/**
+ * @brief Gives the provisioning arena back to the heap, unless a block of it is still in use.
+ * It is then kept until the access point stops again: prov_arena_create reuses it meanwhile, past the leaked block.
+ */
+static void wifi_manager_destroy_arena(bool released){
+	if(released){
+		prov_arena_destroy();
+	}
+	else{
+		ESP_LOGE(TAG, "keeping the provisioning arena: a block of it is still being sent");
+	}
+}
 
 void wifi_manager_clear_access_points_json(){
-	strcpy(accessp_json, "[]\n");
+	ap_num = 0;
+	accessp_list_dirty = true;
 }
 void wifi_manager_generate_acess_points_json(){
+	accessp_list_dirty = true;
+}
+
+/**
+ * @brief Copies the access points kept by the last scan into buf, a wifi_manager_ap_list_t. Only what the portal shows is kept.
+ * @note to be called with the json buffer locked.
+ * @return 0: the list has no CBOR encoding, it is streamed from the copy like the json.
+ */
+static size_t wifi_manager_copy_access_points(char *buf, uint8_t *cbor){
+
+	wifi_manager_ap_list_t *list = (wifi_manager_ap_list_t*)buf;
+
+	/* the list about to be replaced goes into the history. A publish of the same list keeps its version: it is only kept once */
+	const wifi_manager_ap_list_t *published = (const wifi_manager_ap_list_t*)json_snapshot_get(&accessp_snapshot);
+	uint32_t version = json_snapshot_get_generation(&accessp_snapshot, (const char*)published);
+	uint8_t newest = (accessp_history_next + WIFI_MANAGER_AP_HISTORY_LENGTH - 1) % WIFI_MANAGER_AP_HISTORY_LENGTH;
+	if(accessp_history && version != 0 && accessp_history[newest].version != version){
+		accessp_history[accessp_history_next].version = version;
+		memcpy(&accessp_history[accessp_history_next].list, published, sizeof(wifi_manager_ap_list_t));
+		accessp_history_next = (accessp_history_next + 1) % WIFI_MANAGER_AP_HISTORY_LENGTH;
+	}
 
-	strcpy(accessp_json, "[");
+	list->count = ap_num;
+	for(int i=0; i<ap_num;i++){
 
+		wifi_ap_record_t *ap = &accessp_records[i];
 
-	const char oneap_str[] = ",\"chan\":%d,\"rssi\":%d,\"auth\":%d}%c\n";
+		memcpy(list->ap[i].ssid, ap->ssid, sizeof(list->ap[i].ssid));
+		list->ap[i].primary = ap->primary;
+		list->ap[i].rssi = ap->rssi;
+		list->ap[i].authmode = (uint8_t)ap->authmode;
+	}
 
-	/* stack buffer to hold on to one AP until it's copied over to accessp_json */
-	char one_ap[JSON_ONE_APP_SIZE];
-	for(int i=0; i<ap_num;i++){
+	return 0;
+}
+
+/**
+ * @brief Renders a json and its CBOR encoding into the free buffer of its snapshot and publishes them, if its state changed since it was last rendered.
+ * When every buffer is still being sent the json stays dirty and the next reader tries again.
+ * @note to be called with the json buffer locked.
+ */
+static void wifi_manager_refresh_json(json_snapshot_t *snapshot, bool *dirty, size_t (*render)(char*, uint8_t*)){
+	if(*dirty){
+		char *buf = json_snapshot_begin_write(snapshot);
+		if(buf){
+			size_t cbor_len = render(buf, json_snapshot_cbor_buffer(snapshot, buf));
+			json_snapshot_publish(snapshot, buf, cbor_len);
+			*dirty = false;
+		}
+	}
+}
+
+/**
+ * @brief Pins the latest version of a json. The json mutex is only held while rendering, never while the json is sent;
+ * if it can't be taken quickly, the version published before is served.
+ */
+static const char* wifi_manager_pin_json(json_snapshot_t *snapshot, bool *dirty, size_t (*render)(char*, uint8_t*)){
+	if(*dirty && wifi_manager_lock_json_buffer(( TickType_t ) 10)){
+		wifi_manager_refresh_json(snapshot, dirty, render);
+		wifi_manager_unlock_json_buffer();
+	}
+	return json_snapshot_pin(snapshot);
+}
 
-		wifi_ap_record_t ap = accessp_records[i];
+const wifi_manager_ap_list_t* wifi_manager_pin_ap_list(){
+	return (const wifi_manager_ap_list_t*)wifi_manager_pin_json(&accessp_snapshot, &accessp_list_dirty, wifi_manager_copy_access_points);
+}
 
-		/* ssid needs to be json escaped. To save on heap memory it's directly printed at the correct address */
-		strcat(accessp_json, "{\"ssid\":");
-		json_print_string( (unsigned char*)ap.ssid,  (unsigned char*)(accessp_json+strlen(accessp_json)) );
+void wifi_manager_unpin_ap_list(const wifi_manager_ap_list_t *list){
+	json_snapshot_unpin(&accessp_snapshot, (const char*)list);
+}
 
-		/* print the rest of the json for this access point: no more string to escape */
-		snprintf(one_ap, (size_t)JSON_ONE_APP_SIZE, oneap_str,
-				ap.primary,
-				ap.rssi,
-				ap.authmode,
-				i==ap_num-1?']':',');
+const char* wifi_manager_pin_ip_info_json(){
+	return wifi_manager_pin_json(&ip_info_snapshot, &ip_info_json_dirty, wifi_manager_render_ip_info_json);
+}
 
-		/* add it to the list */
-		strcat(accessp_json, one_ap);
+const uint8_t* wifi_manager_get_pinned_cbor(const char *json, size_t *len){
+	return json_snapshot_get_cbor(&ip_info_snapshot, json, len);
+}
+
+void wifi_manager_unpin_json(const char *json){
+	json_snapshot_unpin(&ip_info_snapshot, json);
+}
+
+uint32_t wifi_manager_get_ap_list_version(const wifi_manager_ap_list_t *list){
+	return json_snapshot_get_generation(&accessp_snapshot, (const char*)list);
+}
+
+bool wifi_manager_get_ap_list_since(uint32_t version, wifi_manager_ap_list_t *list){
+
+	bool found = false;
+
+	if(version == 0 || !wifi_manager_lock_json_buffer(( TickType_t ) 10)){
+		return false;
 	}
 
+	const wifi_manager_ap_list_t *published = (const wifi_manager_ap_list_t*)json_snapshot_get(&accessp_snapshot);
+	if(published && json_snapshot_get_generation(&accessp_snapshot, (const char*)published) == version){
+		memcpy(list, published, sizeof(wifi_manager_ap_list_t));
+		found = true;
+	}
+	for(int i=0; accessp_history && !found && i<WIFI_MANAGER_AP_HISTORY_LENGTH; i++){
+		if(accessp_history[i].version == version){
+			memcpy(list, &accessp_history[i].list, sizeof(wifi_manager_ap_list_t));
+			found = true;
+		}
+	}
+
+	wifi_manager_unlock_json_buffer();
+	return found;
+}
+
+uint32_t wifi_manager_get_pinned_version(const char *json){
+	return json_snapshot_get_generation(&ip_info_snapshot, json);
 }
 
 
@@ -563,6 +1081,8 @@ void wifi_manager_unlock_sta_ip_string(){
 
 void wifi_manager_safe_update_sta_ip_string(uint32_t ip){
 
+	wifi_manager_sta_ip_addr = ip;
+
 	if(wifi_manager_lock_sta_ip_string(portMAX_DELAY)){
 
 		char * str_ip;
@@ -578,6 +1098,10 @@ void wifi_manager_safe_update_sta_ip_string(uint32_t ip){
 	}
 }
 
+uint32_t wifi_manager_get_sta_ip(){
+	return wifi_manager_sta_ip_addr;
+}
+
 char* wifi_manager_get_sta_ip_string(){
 	return wifi_manager_sta_ip;
 }
@@ -601,9 +1125,6 @@ void wifi_manager_unlock_json_buffer(){
 	xSemaphoreGive( wifi_manager_json_mutex );
 }
 
-char* wifi_manager_get_ap_list_json(){
-	return accessp_json;
-}
 
 struct wifi_settings_t * wifi_manager_get_wifi_settings() {
 	return &wifi_settings;
@@ -641,7 +1162,7 @@ static void wifi_manager_event_handler(void* arg, esp_event_base_t event_base, i
 		case WIFI_EVENT_SCAN_DONE:
 			ESP_LOGD(TAG, "WIFI_EVENT_SCAN_DONE");
 	    	xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_SCAN_BIT);
-			wifi_event_sta_scan_done_t* event_sta_scan_done = (wifi_event_sta_scan_done_t*)malloc(sizeof(wifi_event_sta_scan_done_t));
+			wifi_event_sta_scan_done_t* event_sta_scan_done = (wifi_event_sta_scan_done_t*)wifi_manager_event_param_alloc();
 			*event_sta_scan_done = *((wifi_event_sta_scan_done_t*)event_data);
 	    	wifi_manager_send_message(WM_EVENT_SCAN_DONE, event_sta_scan_done);
 			break;
@@ -651,6 +1172,20 @@ static void wifi_manager_event_handler(void* arg, esp_event_base_t event_base, i
 		 * Generally, the application event callback needs to call esp_wifi_connect() to connect to the configured AP. */
 		case WIFI_EVENT_STA_START:
 			ESP_LOGI(TAG, "WIFI_EVENT_STA_START");
+
+			/* a saved config was loaded during boot: connect right away instead of waiting for the main loop */
+			if(xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_CONNECT_ON_STA_START_BIT) & WIFI_MANAGER_CONNECT_ON_STA_START_BIT){
+				esp_err_t res = esp_wifi_connect();
+				wifi_manager_boot_stage_reached(WM_BOOT_STAGE_STA_CONNECT);
+				if(res != ESP_OK){
+					ESP_LOGE(TAG,"esp_wifi_connect failed %d", res - ESP_ERR_WIFI_BASE);
+
+					/* let the disconnect code handle the internal error */
+					wifi_event_sta_disconnected_t* wifi_event_sta_disconnected = (wifi_event_sta_disconnected_t*)wifi_manager_event_param_alloc();
+					wifi_event_sta_disconnected->reason = 1; // UNSPECIFIED;
+					wifi_manager_send_message(WM_EVENT_STA_DISCONNECTED, (void*)wifi_event_sta_disconnected);
+				}
+			}
 			break;
 
 		/* If esp_wifi_stop() returns ESP_OK and the current Wi-Fi mode is Station or AP+Station, then this event will arise.
@@ -717,7 +1252,7 @@ static void wifi_manager_event_handler(void* arg, esp_event_base_t event_base, i
 		case WIFI_EVENT_STA_DISCONNECTED:
 			ESP_LOGI(TAG, "WIFI_EVENT_STA_DISCONNECTED");
 
-			wifi_event_sta_disconnected_t* wifi_event_sta_disconnected = (wifi_event_sta_disconnected_t*)malloc(sizeof(wifi_event_sta_disconnected_t));
+			wifi_event_sta_disconnected_t* wifi_event_sta_disconnected = (wifi_event_sta_disconnected_t*)wifi_manager_event_param_alloc();
 			*wifi_event_sta_disconnected =  *( (wifi_event_sta_disconnected_t*)event_data );
 
 			/* if a DISCONNECT message is posted while a scan is in progress this scan will NEVER end, causing scan to never work again. For this reason SCAN_BIT is cleared too */
@@ -790,7 +1325,7 @@ static void wifi_manager_event_handler(void* arg, esp_event_base_t event_base, i
 		case IP_EVENT_STA_GOT_IP:
 			ESP_LOGI(TAG, "IP_EVENT_STA_GOT_IP");
 	        xEventGroupSetBits(wifi_manager_event_group, WIFI_MANAGER_WIFI_CONNECTED_BIT);
-	        ip_event_got_ip_t* ip_event_got_ip = (ip_event_got_ip_t*)malloc(sizeof(ip_event_got_ip_t));
+	        ip_event_got_ip_t* ip_event_got_ip = (ip_event_got_ip_t*)wifi_manager_event_param_alloc();
 			*ip_event_got_ip =  *( (ip_event_got_ip_t*)event_data );
 	        wifi_manager_send_message(WM_EVENT_STA_GOT_IP, (void*)(ip_event_got_ip) );
 			break;
@@ -840,7 +1375,9 @@ void wifi_manager_erase_config() {
 }
 
 
-void wifi_manager_connect_async(){
+uint32_t wifi_manager_connect_async(){
+	uint32_t attempt;
+
 	/* in order to avoid a false positive on the front end app we need to quickly flush the ip json
 	 * There'se a risk the front end sees an IP or a password error when in fact
 	 * it's a remnant from a previous connection
@@ -849,7 +1386,33 @@ void wifi_manager_connect_async(){
 		wifi_manager_clear_ip_info_json();
 		wifi_manager_unlock_json_buffer();
 	}
+
+	CONNECT_RESULT_ENTER();
+	attempt = ++connect_attempts_requested;
+	CONNECT_RESULT_EXIT();
+
 	wifi_manager_send_message(WM_ORDER_CONNECT_STA, (void*)CONNECTION_REQUEST_USER);
+	return attempt;
+}
+
+wifi_manager_connect_result_t wifi_manager_get_connect_result(){
+	wifi_manager_connect_result_t result;
+	CONNECT_RESULT_ENTER();
+	result = connect_result;
+	CONNECT_RESULT_EXIT();
+	return result;
+}
+
+/**
+ * @brief Records the outcome of the user requested connection attempts. Attempts requested meanwhile resolve with the same one:
+ * the wifi_manager only ever tries the latest config.
+ */
+static void wifi_manager_resolve_connect_attempts(update_reason_code_t urc, uint8_t reason){
+	CONNECT_RESULT_ENTER();
+	connect_result.attempt = connect_attempts_requested;
+	connect_result.urc = urc;
+	connect_result.reason = reason;
+	CONNECT_RESULT_EXIT();
 }
 
 void wifi_manager_start_ap_shutdown() {
@@ -869,7 +1432,9 @@ void wifi_manager_set_auto_ap_shutdown( bool enable ) {
 	ESP_LOGI(TAG,"Set AP auto shutdown to %s", enable ? "enabled" : "disabled");
 	if (enable) {
 		xEventGroupSetBits(wifi_manager_event_group, WIFI_MANAGER_AUTO_AP_SHUTDOWN);
-		if(xEventGroupGetBits(wifi_manager_event_group) & WIFI_MANAGER_AP_STARTED_BIT) {
+		/* the shutdown is armed later by the reachability probe if it didn't pass yet */
+		EventBits_t uxBits = xEventGroupGetBits(wifi_manager_event_group);
+		if( (uxBits & WIFI_MANAGER_AP_STARTED_BIT) && (!REACHABILITY_PROBE_ENABLED || (uxBits & WIFI_MANAGER_STA_REACHABLE_BIT)) ) {
 			wifi_manager_start_ap_shutdown();
 		}
 
@@ -888,7 +1453,9 @@ void wifi_manager_set_auto_ap_start_after_failure( bool enable ) {
 
 
 char* wifi_manager_get_ip_info_json(){
-	return ip_info_json;
+	/* nothing is rendered until someone actually reads the status: headless devices never pay for it */
+	wifi_manager_refresh_json(&ip_info_snapshot, &ip_info_json_dirty, wifi_manager_render_ip_info_json);
+	return (char*)json_snapshot_get(&ip_info_snapshot);
 }
 
 
@@ -897,19 +1464,27 @@ void wifi_manager_destroy(){
 	vTaskDelete(task_wifi_manager);
 	task_wifi_manager = NULL;
 
+	mem_governor_stop();
+	reachability_stop();
+
 	/* heap buffers */
-	free(accessp_records);
-	accessp_records = NULL;
-	free(accessp_json);
-	accessp_json = NULL;
+	wifi_manager_destroy_arena(wifi_manager_release_scan_buffers());
+	if(!json_snapshot_retire(&ip_info_snapshot)){
+		ESP_LOGE(TAG, "status json still being sent, leaking it");
+		ip_info_json = NULL;
+	}
+#ifndef CONFIG_WIFI_MANAGER_STATIC_ALLOCATION
 	free(ip_info_json);
-	ip_info_json = NULL;
 	free(wifi_manager_sta_ip);
+	free(wifi_manager_config_sta);
+	free(cb_ptr_arr);
+	free(ap_ssid);
+#endif
+	ip_info_json = NULL;
 	wifi_manager_sta_ip = NULL;
-	if(wifi_manager_config_sta){
-		free(wifi_manager_config_sta);
-		wifi_manager_config_sta = NULL;
-	}
+	wifi_manager_config_sta = NULL;
+	cb_ptr_arr = NULL;
+	ap_ssid = NULL;
 
 	/* RTOS objects */
 	vSemaphoreDelete(wifi_manager_json_mutex);
@@ -991,6 +1566,13 @@ BaseType_t wifi_manager_send_message(message_code_t code, void *param){
 	return xQueueSend( wifi_manager_queue, &msg, portMAX_DELAY);
 }
 
+BaseType_t wifi_manager_try_send_message(message_code_t code, void *param){
+	queue_message msg;
+	msg.code = code;
+	msg.param = param;
+	return xQueueSend( wifi_manager_queue, &msg, 0);
+}
+
 
 void wifi_manager_set_callback(message_code_t message_code, void (*func_ptr)(void*) ){
 
@@ -1017,6 +1599,7 @@ void wifi_manager( void * pvParameters ){
 	BaseType_t xStatus;
 	EventBits_t uxBits;
 	uint8_t	retries = 0;
+	uint32_t notified_ip_info_generation = 0;
 
 
 	/* initialize the tcp stack */
@@ -1033,12 +1616,14 @@ void wifi_manager( void * pvParameters ){
 	esp_netif_sta = esp_netif_create_default_wifi_sta();
 	esp_netif_ap = esp_netif_create_default_wifi_ap();
 #endif
+	wifi_manager_boot_stage_reached(WM_BOOT_STAGE_NETIF_INIT);
 
 
 	/* default wifi config */
 	wifi_init_config_t wifi_init_config = WIFI_INIT_CONFIG_DEFAULT();
 	ESP_ERROR_CHECK(esp_wifi_init(&wifi_init_config));
 	ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
+	wifi_manager_boot_stage_reached(WM_BOOT_STAGE_DRIVER_INIT);
 
 	/* event handler for the connection */
 #ifdef ESP32
@@ -1051,6 +1636,9 @@ void wifi_manager( void * pvParameters ){
     ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_manager_event_handler, NULL));
 #endif
 
+	/* the AP settings below may come from NVS: wait for the boot config loader to be done */
+	uxBits = xEventGroupWaitBits(wifi_manager_event_group, WIFI_MANAGER_STA_CONFIG_LOADED_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+
 
 	/* SoftAP - Wifi Access Point configuration setup */
 	wifi_config_t ap_config = {
@@ -1084,6 +1672,11 @@ void wifi_manager( void * pvParameters ){
 	inet_pton(AF_INET, DEFAULT_AP_GATEWAY, &ap_ip_info.gw);
 	inet_pton(AF_INET, DEFAULT_AP_NETMASK, &ap_ip_info.netmask);
 	ESP_ERROR_CHECK(esp_netif_set_ip_info(esp_netif_ap, &ap_ip_info));
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 2, 0)
+	/* DHCP option 114 (RFC 8910): clients that support it get the captive portal API of http_app instead of probing */
+	static char captive_api_url[] = HTTP_APP_CAPTIVE_API_URL;
+	esp_netif_dhcps_option(esp_netif_ap, ESP_NETIF_OP_SET, ESP_NETIF_CAPTIVEPORTAL_URI, captive_api_url, strlen(captive_api_url));
+#endif
 	ESP_ERROR_CHECK(esp_netif_dhcps_start(esp_netif_ap));
 #else
 	tcpip_adapter_dhcps_stop(TCPIP_ADAPTER_IF_AP);
@@ -1119,10 +1712,15 @@ void wifi_manager( void * pvParameters ){
 
 	/* by default the mode is STA because wifi_manager will not start the access point unless it has to! */
 	ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-	ESP_ERROR_CHECK(esp_wifi_start());
 
-	/* start http server */
-	http_app_start(true);
+	/* if a saved config was found, the connection is issued as soon as the STA starts.
+	 * The http server is not needed to get an IP: it is started once connected or when the AP is started. */
+	if(uxBits & WIFI_MANAGER_STA_CONFIG_FOUND_BIT){
+		ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, wifi_manager_get_wifi_sta_config()));
+		xEventGroupSetBits(wifi_manager_event_group, WIFI_MANAGER_REQUEST_RESTORE_STA_BIT | WIFI_MANAGER_CONNECT_ON_STA_START_BIT);
+	}
+	ESP_ERROR_CHECK(esp_wifi_start());
+	wifi_manager_boot_stage_reached(WM_BOOT_STAGE_WIFI_STARTED);
 
 	/* wifi scanner config */
 	wifi_scan_config_t scan_config = {
@@ -1155,34 +1753,45 @@ void wifi_manager( void * pvParameters ){
 				wifi_event_sta_scan_done_t *evt_scan_done = (wifi_event_sta_scan_done_t*)msg.param;
 				/* only check for AP if the scan is succesful */
 				if(evt_scan_done->status == 0){
-					/* As input param, it stores max AP number ap_records can hold. As output param, it receives the actual AP number this API returns.
-					* As a consequence, ap_num MUST be reset to MAX_AP_NUM at every scan */
-					ap_num = MAX_AP_NUM;
-					ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&ap_num, accessp_records));
-					/* make sure the http server isn't trying to access the list while it gets refreshed */
+					/* make sure the http server isn't trying to render the list while it gets refreshed */
 					if(wifi_manager_lock_json_buffer( pdMS_TO_TICKS(1000) )){
-						/* Will remove the duplicate SSIDs from the list and update ap_num */
-						wifi_manager_filter_unique(accessp_records, &ap_num);
-						wifi_manager_generate_acess_points_json();
+						if(wifi_manager_alloc_scan_buffers()){
+							/* As input param, it stores max AP number ap_records can hold. As output param, it receives the actual AP number this API returns.
+							* As a consequence, ap_num MUST be reset to the capacity of the records at every scan.
+							* Under memory pressure the records were shrunk: only the strongest part of the list is kept. */
+							ap_num = accessp_records_capacity;
+							ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&ap_num, accessp_records));
+							/* Will remove the duplicate SSIDs from the list and update ap_num */
+							wifi_manager_filter_unique(accessp_records, &ap_num);
+							wifi_manager_generate_acess_points_json();
+						}
+						else{
+							ESP_LOGE(TAG, "could not allocate the scan buffers");
+						}
 						wifi_manager_unlock_json_buffer();
 					}
 					else{
 						ESP_LOGE(TAG, "could not get access to json mutex in wifi_scan");
 					}
+					http_app_notify(HTTP_APP_EVENT_SCAN);
 				}
 
 				/* callback */
 				if(cb_ptr_arr[msg.code]) (*cb_ptr_arr[msg.code])( msg.param );
-				free(evt_scan_done);
+				wifi_manager_event_param_free(evt_scan_done);
 				}
 				break;
 
 			case WM_ORDER_START_WIFI_SCAN:
 				ESP_LOGD(TAG, "MESSAGE: ORDER_START_WIFI_SCAN");
 
-				/* if a scan is already in progress this message is simply ignored thanks to the WIFI_MANAGER_SCAN_BIT uxBit */
+				/* if a scan is already in progress this message is simply ignored thanks to the WIFI_MANAGER_SCAN_BIT uxBit.
+				 * Scans are also paused when memory runs low: the last scan results are kept. */
 				uxBits = xEventGroupGetBits(wifi_manager_event_group);
-				if (! (uxBits & WIFI_MANAGER_SCAN_BIT) ){
+				if (mem_governor_get_level() >= MEM_PRESSURE_PAUSE_SCAN){
+					ESP_LOGD(TAG, "Scan paused because of memory pressure");
+				}
+				else if (! (uxBits & WIFI_MANAGER_SCAN_BIT) ){
 					if (! (uxBits & ( WIFI_MANAGER_REQUEST_STA_CONNECT_BIT | WIFI_MANAGER_REQUEST_RESTORE_STA_BIT) ) ) {
 						esp_err_t res = esp_wifi_scan_start(&scan_config, false);
 						if (res==ESP_OK) {
@@ -1207,7 +1816,20 @@ void wifi_manager( void * pvParameters ){
 
 			case WM_ORDER_LOAD_AND_RESTORE_STA:
 				ESP_LOGI(TAG, "MESSAGE: ORDER_LOAD_AND_RESTORE_STA");
-				if(wifi_manager_fetch_wifi_sta_config()){
+
+				/* at boot the config was already loaded in parallel with the driver init and the connection issued on STA start */
+				uxBits = xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_STA_CONFIG_LOADED_BIT | WIFI_MANAGER_STA_CONFIG_FOUND_BIT);
+				if(uxBits & WIFI_MANAGER_STA_CONFIG_LOADED_BIT){
+					if(uxBits & WIFI_MANAGER_STA_CONFIG_FOUND_BIT){
+						ESP_LOGI(TAG, "Saved wifi found on startup. Connection already issued.");
+					}
+					else{
+						/* no wifi saved: start soft AP! This is what should happen during a first run */
+						ESP_LOGI(TAG, "No saved wifi found on startup. Starting access point.");
+						wifi_manager_send_message(WM_ORDER_START_AP, NULL);
+					}
+				}
+				else if(wifi_manager_fetch_wifi_sta_config()){
 					ESP_LOGI(TAG, "Saved wifi found on startup. Will attempt to connect.");
 					wifi_manager_send_message(WM_ORDER_CONNECT_STA, (void*)CONNECTION_REQUEST_RESTORE_CONNECTION);
 				}
@@ -1251,7 +1873,7 @@ void wifi_manager( void * pvParameters ){
 						ESP_LOGE(TAG,"esp_wifi_connect failed %d", res - ESP_ERR_WIFI_BASE);
 
 						// let the disconnect code handle the internal error
-						wifi_event_sta_disconnected_t* wifi_event_sta_disconnected = (wifi_event_sta_disconnected_t*)malloc(sizeof(wifi_event_sta_disconnected_t));
+						wifi_event_sta_disconnected_t* wifi_event_sta_disconnected = (wifi_event_sta_disconnected_t*)wifi_manager_event_param_alloc();
 						wifi_event_sta_disconnected->reason = 1; // UNSPECIFIED;
 
 						wifi_manager_send_message(WM_EVENT_STA_DISCONNECTED, (void*)wifi_event_sta_disconnected);
@@ -1322,6 +1944,10 @@ void wifi_manager( void * pvParameters ){
 				/* reset saved sta IP */
 				wifi_manager_safe_update_sta_ip_string((uint32_t)0);
 
+				/* whatever the probe found out is about the connection that was just lost */
+				reachability_stop();
+				xEventGroupClearBits(wifi_manager_event_group, WIFI_MANAGER_STA_REACHABLE_BIT);
+
 				/* if there was a timer on to stop the AP, well now it's time to cancel that since connection was lost! */
 				if(xTimerIsTimerActive(wifi_manager_shutdown_ap_timer) == pdTRUE ){
 					xTimerStop( wifi_manager_shutdown_ap_timer, (TickType_t)0 );
@@ -1337,6 +1963,7 @@ void wifi_manager( void * pvParameters ){
 						wifi_manager_generate_ip_info_json( UPDATE_FAILED_ATTEMPT );
 						wifi_manager_unlock_json_buffer();
 					}
+					wifi_manager_resolve_connect_attempts(UPDATE_FAILED_ATTEMPT, wifi_event_sta_disconnected->reason);
 
 				}
 				else if (uxBits & WIFI_MANAGER_REQUEST_DISCONNECT_BIT){
@@ -1386,7 +2013,7 @@ void wifi_manager( void * pvParameters ){
 
 				/* callback */
 				if(cb_ptr_arr[msg.code]) (*cb_ptr_arr[msg.code])( msg.param );
-				free(wifi_event_sta_disconnected);
+				wifi_manager_event_param_free(wifi_event_sta_disconnected);
 
 				break;
 
@@ -1395,6 +2022,18 @@ void wifi_manager( void * pvParameters ){
 
 				ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_APSTA));
 
+				/* from now on the portal-only buffers come from the provisioning arena. Scan buffers living on the heap are moved there. */
+				if(prov_arena_create()){
+					if(wifi_manager_lock_json_buffer( portMAX_DELAY )){
+						if(accessp_list && !prov_arena_owns(accessp_list)){
+							wifi_manager_release_scan_buffers();
+						}
+						wifi_manager_alloc_scan_buffers();
+						wifi_manager_unlock_json_buffer();
+					}
+					else { abort(); }
+				}
+
 				/* restart HTTP daemon */
 				http_app_stop();
 				http_app_start(true);
@@ -1427,6 +2066,15 @@ void wifi_manager( void * pvParameters ){
 					/* stop HTTP daemon */
 					http_app_stop();
 
+					/* nothing portal related runs anymore: give the arena back to the heap in one go */
+					bool released;
+					if(wifi_manager_lock_json_buffer( portMAX_DELAY )){
+						released = wifi_manager_release_scan_buffers();
+						wifi_manager_unlock_json_buffer();
+					}
+					else { abort(); }
+					wifi_manager_destroy_arena(released);
+
 					/* callback */
 					if(cb_ptr_arr[msg.code]) (*cb_ptr_arr[msg.code])(NULL);
 				}
@@ -1463,23 +2111,96 @@ void wifi_manager( void * pvParameters ){
 				}
 				else { abort(); }
 
+				if(uxBits & WIFI_MANAGER_REQUEST_STA_CONNECT_BIT){
+					wifi_manager_resolve_connect_attempts(UPDATE_CONNECTION_OK, 0);
+				}
+
 				/* bring down DNS hijack */
 				dns_server_stop();
 
+				/* first IP since boot: run the setup that was deferred to get connected faster */
+				if(!boot_deferred_setup_done){
+					wifi_manager_boot_stage_reached(WM_BOOT_STAGE_GOT_IP);
+					http_app_start(true);
+					boot_deferred_setup_done = true;
+					wifi_manager_boot_stage_reached(WM_BOOT_STAGE_DEFERRED_DONE);
+					wifi_manager_log_boot_report();
+				}
+
 				/* start the timer that will eventually shutdown the access point if auto shutdown is enabled
 				 * We check first that it's actually running because in case of a boot and restore connection
 				 * the AP is not even started to begin with.
+				 * With the reachability probe enabled the timer is only started once the probe passed (WM_EVENT_STA_REACHABILITY).
 				 */
-				if ( (uxBits & WIFI_MANAGER_AP_STARTED_BIT) && (uxBits & WIFI_MANAGER_AUTO_AP_SHUTDOWN) ) {
-					wifi_manager_start_ap_shutdown();
+				if(REACHABILITY_PROBE_ENABLED){
+					reachability_start();
+				}
+				else{
+					xEventGroupSetBits(wifi_manager_event_group, WIFI_MANAGER_STA_REACHABLE_BIT);
+					if ( (uxBits & WIFI_MANAGER_AP_STARTED_BIT) && (uxBits & WIFI_MANAGER_AUTO_AP_SHUTDOWN) ) {
+						wifi_manager_start_ap_shutdown();
+					}
 				}
 
 				/* callback and free memory allocated for the void* param */
 				if(cb_ptr_arr[msg.code]) (*cb_ptr_arr[msg.code])( msg.param );
-				free(ip_event_got_ip);
+				wifi_manager_event_param_free(ip_event_got_ip);
+
+				break;
+
+			case WM_EVENT_MEMORY_PRESSURE:
+				ESP_LOGI(TAG, "MESSAGE: EVENT_MEMORY_PRESSURE level %d", (int)msg.param);
+
+				/* a scan still running might have been started before the pressure went up: stop it so its results are not fetched */
+				uxBits = xEventGroupGetBits(wifi_manager_event_group);
+				if( ((mem_pressure_level_t)msg.param >= MEM_PRESSURE_PAUSE_SCAN) && (uxBits & WIFI_MANAGER_SCAN_BIT) ){
+					esp_wifi_scan_stop();
+				}
+
+				/* the scan records follow the level now rather than at the next scan */
+				if(accessp_records && wifi_manager_lock_json_buffer( pdMS_TO_TICKS(1000) )){
+					wifi_manager_alloc_scan_buffers();
+					wifi_manager_unlock_json_buffer();
+				}
+
+				/* callback */
+				if(cb_ptr_arr[msg.code]) (*cb_ptr_arr[msg.code])( msg.param );
 
 				break;
 
+			case WM_EVENT_STA_REACHABILITY:{
+				reachability_result_t result;
+				reachability_get_result(&result);
+				ESP_LOGI(TAG, "MESSAGE: EVENT_STA_REACHABILITY %s", result.ok ? "reachable" : "unreachable");
+
+				uxBits = xEventGroupGetBits(wifi_manager_event_group);
+
+				/* a result posted before the connection was lost has been reset by reachability_stop */
+				if(uxBits & WIFI_MANAGER_WIFI_CONNECTED_BIT){
+
+					/* refresh the status json with the latency breakdown */
+					if(wifi_manager_lock_json_buffer( portMAX_DELAY )){
+						wifi_manager_generate_ip_info_json( UPDATE_CONNECTION_OK );
+						wifi_manager_unlock_json_buffer();
+					}
+					else { abort(); }
+
+					if(result.ok && !(uxBits & WIFI_MANAGER_STA_REACHABLE_BIT)){
+						xEventGroupSetBits(wifi_manager_event_group, WIFI_MANAGER_STA_REACHABLE_BIT);
+
+						/* the network is really usable: the access point can go */
+						if ( (uxBits & WIFI_MANAGER_AP_STARTED_BIT) && (uxBits & WIFI_MANAGER_AUTO_AP_SHUTDOWN) ) {
+							wifi_manager_start_ap_shutdown();
+						}
+					}
+				}
+
+				/* callback */
+				if(cb_ptr_arr[msg.code]) (*cb_ptr_arr[msg.code])( NULL );
+
+				break;
+			}
+
 			case WM_ORDER_DISCONNECT_STA:
 				ESP_LOGI(TAG, "MESSAGE: ORDER_DISCONNECT_STA");
 
@@ -1498,6 +2219,12 @@ void wifi_manager( void * pvParameters ){
 				break;
 
 			} /* end of switch/case */
+
+			/* the json buffer is unlocked again: the event streams of the http server can render what this message changed */
+			if(ip_info_json_generation != notified_ip_info_generation){
+				notified_ip_info_generation = ip_info_json_generation;
+				http_app_notify(HTTP_APP_EVENT_WIFI);
+			}
 		} /* end of if status=pdPASS */
 	} /* end of for loop */
 
@@ -35,6 +35,9 @@ Contains the freeRTOS task and all necessary support
 #include <stdbool.h>
 
 #include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "reachability.h"
 #ifdef CONFIG_IDF_TARGET_ESP32
 #define ESP32
 #endif
@@ -71,6 +74,18 @@ extern "C" {
  */
 #define MAX_AP_NUM 							15
 
+/**
+ * @brief Defines the number of access points kept from a scan when the memory governor asks to shrink the scan table.
+ * @see mem_governor.h
+ */
+#define MAX_AP_NUM_UNDER_PRESSURE			5
+
+/**
+ * @brief Defines the number of access point lists kept after they are replaced by a newer scan, so that the http server can send
+ * a client that has one of them only what changed since. Each one takes sizeof(wifi_manager_ap_list_t) from the provisioning arena.
+ */
+#define WIFI_MANAGER_AP_HISTORY_LENGTH		3
+
 
 /**
  * @brief Defines the maximum number of failed retries allowed before the WiFi manager starts its own access point.
@@ -94,13 +109,51 @@ extern "C" {
 
 /** @brief Defines the task priority of the wifi_manager.
  *
- * Tasks spawn by the manager will have a priority of WIFI_MANAGER_TASK_PRIORITY-1.
- * For this particular reason, minimum task priority is 1. It it highly not recommended to set
- * it to 1 though as the sub-tasks will now have a priority of 0 which is the priority
- * of freeRTOS' idle task.
+ * The DNS and http servers spawned by the manager have their own priorities, see WIFI_MANAGER_DNS_TASK_PRIORITY
+ * and WIFI_MANAGER_HTTPD_TASK_PRIORITY. All of them can be changed at runtime with wifi_manager_set_task_config.
  */
 #define WIFI_MANAGER_TASK_PRIORITY			CONFIG_WIFI_MANAGER_TASK_PRIORITY
 
+/** @brief Core the wifi_manager task is pinned to. -1 means no affinity */
+#define WIFI_MANAGER_TASK_CORE				CONFIG_WIFI_MANAGER_TASK_CORE
+
+/** @brief Stack size (in bytes) of the wifi_manager task */
+#define WIFI_MANAGER_TASK_STACK_SIZE		CONFIG_WIFI_MANAGER_TASK_STACK_SIZE
+
+/** @brief Task priority, core and stack size of the captive portal DNS server */
+#define WIFI_MANAGER_DNS_TASK_PRIORITY		CONFIG_WIFI_MANAGER_DNS_TASK_PRIORITY
+#define WIFI_MANAGER_DNS_TASK_CORE			CONFIG_WIFI_MANAGER_DNS_TASK_CORE
+#define WIFI_MANAGER_DNS_TASK_STACK_SIZE	CONFIG_WIFI_MANAGER_DNS_TASK_STACK_SIZE
+
+/** @brief Task priority, core and stack size of the http server */
+#define WIFI_MANAGER_HTTPD_TASK_PRIORITY	CONFIG_WIFI_MANAGER_HTTPD_TASK_PRIORITY
+#define WIFI_MANAGER_HTTPD_TASK_CORE		CONFIG_WIFI_MANAGER_HTTPD_TASK_CORE
+#define WIFI_MANAGER_HTTPD_TASK_STACK_SIZE	CONFIG_WIFI_MANAGER_HTTPD_TASK_STACK_SIZE
+
+/** @brief Task priority and stack size of the workers running async http handlers. They share the core of the http server */
+#ifdef CONFIG_WIFI_MANAGER_HTTPD_WORKER_PRIORITY
+#define WIFI_MANAGER_HTTPD_WORKER_PRIORITY	CONFIG_WIFI_MANAGER_HTTPD_WORKER_PRIORITY
+#define WIFI_MANAGER_HTTPD_WORKER_STACK_SIZE	CONFIG_WIFI_MANAGER_HTTPD_WORKER_STACK_SIZE
+#else
+#define WIFI_MANAGER_HTTPD_WORKER_PRIORITY	4
+#define WIFI_MANAGER_HTTPD_WORKER_STACK_SIZE	4096
+#endif
+
+/** @brief Stack size (in bytes) of the task writing the event streams of the http server. It shares the priority and core of the workers */
+#define WIFI_MANAGER_HTTPD_EVENTS_STACK_SIZE	3072
+
+/** @brief Stack size (in bytes) of the short lived task reading the saved config at boot */
+#define WIFI_MANAGER_CONFIG_LOADER_STACK_SIZE	3072
+
+/** @brief Number of messages the wifi_manager queue can hold */
+#define WIFI_MANAGER_QUEUE_LENGTH			3
+
+/**
+ * @brief Number of event params (scan done, disconnected, got ip) that can be in flight at the same time in static allocation mode.
+ * One per queue slot, plus one being processed, one blocked on a full queue and one posted by the wifi_manager task itself.
+ */
+#define WIFI_MANAGER_EVENT_PARAM_POOL_SIZE	(WIFI_MANAGER_QUEUE_LENGTH + 3)
+
 /** @brief Defines the auth mode as an access point
  *  Value must be of type wifi_auth_mode_t
  *  @see esp_wifi_types.h
@@ -180,11 +233,18 @@ extern "C" {
  */
 #define JSON_ONE_APP_SIZE					99
 
+/**
+ * @brief Defines the maximum length in bytes of the JSON list of access points: 4 bytes for the encapsulation "[", "]\n" and \0.
+ * The list is streamed in chunks and never held whole in memory: this is only the worst case of a response.
+ */
+#define JSON_ACCESS_POINTS_SIZE				(MAX_AP_NUM * JSON_ONE_APP_SIZE + 4)
+
 /**
  * @brief Defines the maximum length in bytes of a JSON representation of the IP information
  * assuming all ips are 4*3 digits, and all characters in the ssid require to be escaped.
  * example: {"ssid":"abcdefghijklmnopqrstuvwxyz012345","ip":"192.168.1.119","netmask":"255.255.255.0","gw":"192.168.1.1","urc":99}
  * Run this JS (browser console is easiest) to come to the conclusion that 159 is the worst case.
+ * JSON_REACHABILITY_SIZE more bytes are reserved for the reachability object appended when the probe is enabled.
  * ```
  * var a = {"ssid":"abcdefghijklmnopqrstuvwxyz012345","ip":"255.255.255.255","netmask":"255.255.255.255","gw":"255.255.255.255","urc":99};
  * // Replace all ssid characters with a double quote which will have to be escaped
@@ -193,7 +253,25 @@ extern "C" {
  * console.log(JSON.stringify(a)); // print it
  * ```
  */
-#define JSON_IP_INFO_SIZE 					159
+#define JSON_IP_INFO_SIZE 					(159 + JSON_REACHABILITY_SIZE)
+
+/**
+ * @brief Defines the maximum length in bytes of the CBOR representation of an access point. Nothing needs escaping in CBOR.
+ * map header 1, "ssid" 5 + 2 + 32, "chan" 5 + 1, "rssi" 5 + 2, "auth" 5 + 1 = 59.
+ */
+#define CBOR_ONE_APP_SIZE					59
+
+/**
+ * @brief Defines the maximum length in bytes of the CBOR list of access points, 0 if CBOR is disabled: the array header takes 2 bytes at most.
+ * Like the json list it is streamed in chunks.
+ */
+#define CBOR_ACCESS_POINTS_SIZE				(CBOR_ENABLED ? MAX_AP_NUM * CBOR_ONE_APP_SIZE + 2 : 0)
+
+/**
+ * @brief Defines the maximum length in bytes of the CBOR representation of the IP information, 0 if CBOR is disabled.
+ * map header 1, "ssid" 5 + 2 + 32, "ip" 3 + 16, "netmask" 8 + 16, "gw" 3 + 16, "urc" 4 + 1 = 107, and the reachability pair.
+ */
+#define CBOR_IP_INFO_SIZE					(CBOR_ENABLED ? 107 + CBOR_REACHABILITY_SIZE : 0)
 
 
 /**
@@ -227,7 +305,9 @@ typedef enum message_code_t {
 	WM_EVENT_SCAN_DONE = 11,
 	WM_EVENT_STA_GOT_IP = 12,
 	WM_ORDER_STOP_AP = 13,
-	WM_MESSAGE_CODE_COUNT = 14 /* important for the callback array */
+	WM_EVENT_MEMORY_PRESSURE = 14, /* param is the new mem_pressure_level_t */
+	WM_EVENT_STA_REACHABILITY = 15, /* a reachability probe finished, see reachability_get_result */
+	WM_MESSAGE_CODE_COUNT = 16 /* important for the callback array */
 
 }message_code_t;
 
@@ -243,6 +323,36 @@ typedef enum update_reason_code_t {
 	UPDATE_LOST_CONNECTION = 3
 }update_reason_code_t;
 
+/**
+ * @brief Outcome of a connection attempt requested with wifi_manager_connect_async.
+ */
+typedef struct{
+	uint32_t attempt;				/* number of the last attempt resolved, 0 if none resolved yet. Attempts requested before it are resolved too */
+	update_reason_code_t urc;		/* UPDATE_CONNECTION_OK or UPDATE_FAILED_ATTEMPT */
+	uint8_t reason;					/* wifi disconnect reason of a failed attempt, see wifi_err_reason_t. 0 for a connection */
+}wifi_manager_connect_result_t;
+
+/**
+ * @brief Stages of the boot pipeline started by wifi_manager_start.
+ *
+ * The saved STA configuration is read from NVS by a short lived task while the wifi_manager task
+ * initializes the network stack and the wifi driver. Everything that is not needed to get an IP
+ * (e.g. the HTTP server) is deferred until WM_EVENT_STA_GOT_IP or until the access point is started.
+ *
+ * @see wifi_manager_get_boot_stage_time
+ */
+typedef enum wifi_manager_boot_stage_t {
+	WM_BOOT_STAGE_START = 0,			/* wifi_manager_start called */
+	WM_BOOT_STAGE_NETIF_INIT = 1,		/* tcp stack, event loop and netif objects ready */
+	WM_BOOT_STAGE_DRIVER_INIT = 2,		/* esp_wifi_init done */
+	WM_BOOT_STAGE_CONFIG_LOADED = 3,	/* saved STA config read from NVS (found or not) */
+	WM_BOOT_STAGE_WIFI_STARTED = 4,		/* esp_wifi_start done */
+	WM_BOOT_STAGE_STA_CONNECT = 5,		/* esp_wifi_connect issued on WIFI_EVENT_STA_START */
+	WM_BOOT_STAGE_GOT_IP = 6,			/* first IP obtained */
+	WM_BOOT_STAGE_DEFERRED_DONE = 7,	/* deferred, non essential setup is completed */
+	WM_BOOT_STAGE_COUNT = 8
+}wifi_manager_boot_stage_t;
+
 typedef enum connection_request_made_by_code_t{
 	CONNECTION_REQUEST_NONE = 0,
 	CONNECTION_REQUEST_USER = 1,
@@ -272,6 +382,25 @@ struct wifi_settings_t{
 extern struct wifi_settings_t wifi_settings;
 
 
+/**
+ * @brief An access point as the portal shows it: the part of wifi_ap_record_t that goes into the access points json.
+ */
+typedef struct{
+	uint8_t ssid[33];
+	uint8_t primary;
+	int8_t rssi;
+	uint8_t authmode;
+}wifi_manager_ap_t;
+
+/**
+ * @brief The access points kept by the last scan, one per SSID.
+ * @see wifi_manager_pin_ap_list
+ */
+typedef struct{
+	uint16_t count;
+	wifi_manager_ap_t ap[MAX_AP_NUM];
+}wifi_manager_ap_list_t;
+
 /**
  * @brief Structure used to store one message in the queue.
  */
@@ -292,6 +421,49 @@ esp_netif_t* wifi_manager_get_esp_netif_sta();
 esp_netif_t* wifi_manager_get_esp_netif_ap();
 #endif
 
+/**
+ * @brief Tasks whose priority, stack size and core can be configured.
+ * @see wifi_manager_set_task_config
+ */
+typedef enum wifi_manager_task_t{
+	WM_TASK_WIFI_MANAGER = 0,
+	WM_TASK_DNS_SERVER = 1,
+	WM_TASK_HTTPD = 2,
+	WM_TASK_MQTT_MANAGER = 3,
+	WM_TASK_REACHABILITY = 4,
+	WM_TASK_HTTPD_WORKER = 5,
+	WM_TASK_HTTPD_EVENTS = 6,
+	WM_TASK_COUNT = 7
+}wifi_manager_task_t;
+
+/**
+ * @brief Placement of a task. Defaults come from menuconfig.
+ */
+typedef struct{
+	UBaseType_t priority;
+	uint32_t stack_size;	/* in bytes */
+	int core_id;			/* -1 for no affinity. Ignored on single core targets */
+}wifi_manager_task_config_t;
+
+/**
+ * @brief Changes the priority, stack size and core of a task. It takes effect the next time the task is created:
+ * call it before wifi_manager_start / mqtt_manager_start. The DNS and http servers pick it up whenever they are restarted.
+ * @note in static allocation mode the stack size stays the one set in menuconfig since the stacks are sized at compile time.
+ */
+void wifi_manager_set_task_config(wifi_manager_task_t task, const wifi_manager_task_config_t *config);
+
+/**
+ * @brief Returns the priority, stack size and core a task is (or will be) created with.
+ */
+wifi_manager_task_config_t wifi_manager_get_task_config(wifi_manager_task_t task);
+
+/**
+ * @brief Creates one of the configurable tasks with its current configuration.
+ * If stack and tcb are not NULL the task is created statically with them: the stack must hold the configured stack size.
+ * @return the task handle, NULL if the task could not be created.
+ */
+TaskHandle_t wifi_manager_create_task(wifi_manager_task_t task, TaskFunction_t fn, const char *name, void *param, StackType_t *stack, StaticTask_t *tcb);
+
 /**
  * Allocate heap memory for the wifi manager and start the wifi_manager RTOS task
   If SSID is NULL, DEFAULT_AP_SSID is used.
@@ -315,9 +487,68 @@ void filter_unique( wifi_ap_record_t * aplist, uint16_t * ap_num);
 void wifi_manager( void * pvParameters );
 
 
-char* wifi_manager_get_ap_list_json();
+/**
+ * @brief Returns the connection status json, rendering it first if the status changed since the last read.
+ * @note This is not thread-safe and should be called only if wifi_manager_lock_json_buffer call is successful.
+ */
 char* wifi_manager_get_ip_info_json();
 
+/**
+ * @brief Pins the access points found by the latest scan so that they can be serialized without holding the json mutex.
+ * The mutex is only taken briefly to copy a newer scan; if it is busy the previous list is returned.
+ * @return NULL if no scan was ever requested, otherwise a list to release with wifi_manager_unpin_ap_list.
+ */
+const wifi_manager_ap_list_t* wifi_manager_pin_ap_list();
+
+/**
+ * @brief Releases a list returned by wifi_manager_pin_ap_list. NULL is ignored.
+ */
+void wifi_manager_unpin_ap_list(const wifi_manager_ap_list_t *list);
+
+/**
+ * @brief Pins the latest connection status json so that it can be sent without holding the json mutex.
+ * The mutex is only taken briefly to render a newer status; if it is busy the previous status is returned.
+ * @return NULL if no status exists yet, otherwise a json to release with wifi_manager_unpin_json.
+ */
+const char* wifi_manager_pin_ip_info_json();
+
+/**
+ * @brief CBOR encoding of a json pinned by wifi_manager_pin_ip_info_json.
+ * It is the same version of the document and stays valid until the json is unpinned.
+ * @return NULL if CBOR is disabled or the encoding didn't fit.
+ */
+const uint8_t* wifi_manager_get_pinned_cbor(const char *json, size_t *len);
+
+/**
+ * @brief Releases a json returned by wifi_manager_pin_ip_info_json. NULL is ignored.
+ */
+void wifi_manager_unpin_json(const char *json);
+
+/**
+ * @brief Version of a list pinned by wifi_manager_pin_ap_list, never the same for two different lists. The http server uses it as ETag.
+ * @return 0 for NULL.
+ */
+uint32_t wifi_manager_get_ap_list_version(const wifi_manager_ap_list_t *list);
+
+/**
+ * @brief Copies the list of access points that had the given version, if it is one of the last WIFI_MANAGER_AP_HISTORY_LENGTH lists
+ * replaced or the one published. The http server diffs it against the pinned list to send only what changed.
+ * @return false if the version is unknown, too old or the json mutex is busy: the client gets the full list instead.
+ */
+bool wifi_manager_get_ap_list_since(uint32_t version, wifi_manager_ap_list_t *list);
+
+/**
+ * @brief Version of a json pinned by wifi_manager_pin_ip_info_json, never the same for two different documents.
+ * @return 0 for NULL.
+ */
+uint32_t wifi_manager_get_pinned_version(const char *json);
+
+/**
+ * @brief Number of changes of the connection status since boot. It changes whenever the status json would.
+ * @note to be called with the json buffer locked.
+ */
+uint32_t wifi_manager_get_ip_info_generation();
+
 
 void wifi_manager_scan_async();
 
@@ -325,6 +556,12 @@ void wifi_manager_erase_config();
 
 bool wifi_manager_is_started();
 
+/**
+ * @brief Returns the time at which a boot stage was reached.
+ * @return time in microseconds since wifi_manager_start was called, or -1 if the stage was not reached yet.
+ */
+int64_t wifi_manager_get_boot_stage_time(wifi_manager_boot_stage_t stage);
+
 /**
  * @brief saves the current STA wifi config to flash ram storage.
  */
@@ -343,8 +580,15 @@ struct wifi_settings_t * wifi_manager_get_wifi_settings();
 
 /**
  * @brief requests a connection to an access point that will be process in the main task thread.
+ * @return the number of this attempt, to find its outcome with wifi_manager_get_connect_result.
+ */
+uint32_t wifi_manager_connect_async();
+
+/**
+ * @brief Returns the outcome of the last connection attempt requested with wifi_manager_connect_async that resolved,
+ * by WM_EVENT_STA_GOT_IP or WM_EVENT_STA_DISCONNECTED. Thread safe.
  */
-void wifi_manager_connect_async();
+wifi_manager_connect_result_t wifi_manager_get_connect_result();
 
 /**
  * @brief requests a wifi scan
@@ -379,18 +623,19 @@ bool wifi_manager_lock_json_buffer(TickType_t xTicksToWait);
 void wifi_manager_unlock_json_buffer();
 
 /**
- * @brief Generates the connection status json: ssid and IP addresses.
+ * @brief Records a change of the connection status: ssid and IP addresses. The json itself is only rendered
+ * when it is read with wifi_manager_get_ip_info_json.
  * @note This is not thread-safe and should be called only if wifi_manager_lock_json_buffer call is successful.
  */
 void wifi_manager_generate_ip_info_json(update_reason_code_t update_reason_code);
 /**
- * @brief Clears the connection status json.
+ * @brief Clears the connection status json. Like wifi_manager_generate_ip_info_json it only takes effect on the next read.
  * @note This is not thread-safe and should be called only if wifi_manager_lock_json_buffer call is successful.
  */
 void wifi_manager_clear_ip_info_json();
 
 /**
- * @brief Generates the list of access points after a wifi scan.
+ * @brief Records that the scan results changed. They are copied for the http server when it next reads them.
  * @note This is not thread-safe and should be called only if wifi_manager_lock_json_buffer call is successful.
  */
 void wifi_manager_generate_acess_points_json();
@@ -416,6 +661,17 @@ void wifi_manager_unlock_sta_ip_string();
  */
 char* wifi_manager_get_sta_ip_string();
 
+/**
+ * @brief STA IP address in the byte order of ip4_addr_t, 0 when not connected. Lock free: meant for per request checks of the http server.
+ */
+uint32_t wifi_manager_get_sta_ip();
+
+/**
+ * @brief Seconds left before the access point shuts down, once a connection started its shutdown timer. Rounded up.
+ * @return -1 if the access point isn't about to shut down.
+ */
+int32_t wifi_manager_get_ap_shutdown_remaining();
+
 /**
  * @brief thread safe char representation of the STA IP update
  */
@@ -436,6 +692,13 @@ void wifi_manager_set_callback(message_code_t message_code, void (*func_ptr)(voi
 BaseType_t wifi_manager_send_message(message_code_t code, void *param);
 BaseType_t wifi_manager_send_message_to_front(message_code_t code, void *param);
 
+/**
+ * @brief Same as wifi_manager_send_message, but gives up right away when the queue is full.
+ * For tasks the wifi_manager may be waiting for, such as the ones of the http server while it is stopped.
+ * @return pdTRUE if the message was queued.
+ */
+BaseType_t wifi_manager_try_send_message(message_code_t code, void *param);
+
 #ifdef __cplusplus
 }
 #endif